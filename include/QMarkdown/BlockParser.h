@@ -8,11 +8,14 @@
 #ifndef BLOCKPARSER_H_
 #define BLOCKPARSER_H_
 
+#include <functional>
 #include <memory>
 
+#include <QMutex>
 #include <QStringList>
 
 #include "BlockProcessors.h"
+#include "LineBuffer.h"
 
 namespace markdown{
 
@@ -75,6 +78,22 @@ private:
 
 };
 
+/*!
+ * Work the BlockParser has yet to do: blocks to parse under a parent
+ * element, or a step a processor scheduled after other work.
+ */
+struct BlockFrame
+{
+    Element parent;
+    QStringList blocks;
+    //! set on the State while the blocks are parsed, unless empty
+    QString state;
+    bool entered;
+    std::function<void()> step;
+};
+
+typedef QList<std::shared_ptr<BlockFrame>> BlockFrames;
+
 /*!
  * Parse Markdown blocks into an ElementTree object.
  *
@@ -95,6 +114,7 @@ public:
 	 *   This should only be called on an entire document, not pieces.
 	 */
     ElementTree parseDocument(const QStringList &lines);
+    ElementTree parseDocument(const LineBuffer &lines);
 
 	/*!
 	 * Parse a chunk of markdown text and attach to given etree node.
@@ -118,15 +138,80 @@ public:
 	 *
 	 *   This is a public method as an extension may need to add/alter additional
 	 *   BlockProcessors which call this method to recursively parse a nested
-	 *   block.
+	 *   block. Called from a run, it returns once the nested blocks are
+	 *   parsed, at the cost of a level of recursion; scheduleBlocks doesn't.
      */
     void parseBlocks(const Element &parent, QStringList &blocks);
 
+    /*!
+     * Parse blocks under parent once the processor running now returns,
+     * instead of calling parseBlocks from its run.
+     *
+     *   Work scheduled while a block is dispatched is done in the order it
+     *   was scheduled, before the parser goes on with the blocks the
+     *   processor was handed, just as if it had been parsed right away.
+     *   The parser keeps it on a stack of its own rather than recursing,
+     *   so how deep lists and blockquotes nest is only limited by memory.
+     *   The blocks are still the text the processor re-joined and
+     *   re-detabbed for its level, so a line nested n levels deep is
+     *   copied n times.
+     *
+     *   While the blocks are parsed, ``state`` is set on the State, unless
+     *   it's empty. Outside of parseBlocks the blocks are parsed at once.
+     */
+    void scheduleBlocks(const Element &parent, const QStringList &blocks, const QString &state=QString());
+    //! scheduleBlocks for text split on blank lines, like parseChunk
+    void scheduleChunk(const Element &parent, const QString &text, const QString &state=QString());
+    /*!
+     * Call step after the work scheduled before it is done, e.g. to look
+     * at what the blocks parsed before turned into.
+     */
+    void schedule(const std::function<void()> &step);
+
+    /*!
+     * Nesting state of the document being parsed, kept in the current
+     * Context.
+     */
+    State &state() const;
+
+    /*!
+     * The line index of a block.
+     *
+     * The parser indexes every block once before testing processors on
+     * it, and the index of the block looked at last is kept in the current
+     * Context, so processors asking for the block they were handed get
+     * that index instead of splitting the block again.
+     */
+    LineIndex lines(const QString &block) const;
+
+private:
+    /*!
+     * The block processors in order together with their prefilters, built
+     * once per version of blockprocessors.
+     */
+    struct Dispatch
+    {
+        quint64 version;
+        QList<std::shared_ptr<BlockProcessor>> processors;
+        QList<BlockPrefilter> prefilters;
+    };
+
+    std::shared_ptr<const Dispatch> dispatch() const;
+
+    //! work off the frames above base
+    void drain(int base);
+    //! calls f, then stacks what it scheduled so it's done first
+    void collect(const std::function<void()> &f);
+    void enqueue(const std::shared_ptr<BlockFrame> &frame);
+
 public:
     std::weak_ptr<Markdown> markdown;
 	OrderedDictBlockProcessors blockprocessors;
-    State state;
-    ElementTree root;
+
+private:
+    //! documents on other threads share the parser
+    mutable QMutex dispatch_mutex;
+    mutable std::shared_ptr<const Dispatch> dispatch_cache;
 
 };
 
@@ -13,6 +13,7 @@
 #include <tuple>
 
 #include "ElementTree.hpp"
+#include "LineIndex.h"
 #include "odict.hpp"
 
 namespace markdown{
@@ -20,6 +21,77 @@ namespace markdown{
 class Markdown;     //!< forward declaration
 class BlockParser;  //!< forward declaration
 
+/*!
+ * A cheap condition a block has to meet before a BlockProcessor is tested
+ * on it.
+ *
+ * The condition only looks at the leading characters of the lines and at
+ * which characters occur in the block, all collected in one pass over the
+ * block.  It must hold for every block the processor's test() accepts;
+ * blocks it lets through may still be rejected by test().
+ */
+class BlockPrefilter
+{
+public:
+    /*!
+     * The characters of a block the conditions look at, which its line
+     * index collects anyway.
+     */
+    typedef LineIndex Shape;
+
+    /*!
+     * No condition: the processor is tested on every block.
+     */
+    BlockPrefilter();
+
+    /*!
+     * The first line is indented by minIndent to maxIndent spaces and goes
+     * on with one of `chars` ('\n' for a blank line), or with anything if
+     * `chars` is empty.
+     */
+    static BlockPrefilter start(const QString &chars, int minIndent=0, int maxIndent=0);
+    static BlockPrefilter indented(int minIndent);
+    /*!
+     * Some line is indented by at most maxIndent (up to 3) spaces and goes
+     * on with one of `chars`.
+     */
+    static BlockPrefilter lineStart(const QString &chars, int maxIndent=0);
+    /*!
+     * One of `chars` occurs anywhere in the block.
+     */
+    static BlockPrefilter contains(const QString &chars);
+
+    //! either of both conditions
+    BlockPrefilter operator |(const BlockPrefilter &other) const;
+
+    bool isEmpty() const;
+    bool accepts(const Shape &shape) const;
+
+private:
+    enum Kind
+    {
+        Start,
+        LineStart,
+        Contains
+    };
+
+    struct Clause
+    {
+        Kind kind;
+        int minIndent;
+        int maxIndent;
+        QString chars;
+        quint64 mask[2];
+        bool ascii;
+    };
+
+    static Clause clause(Kind kind, const QString &chars, int minIndent, int maxIndent);
+
+    //! any of them has to hold, none at all means no condition
+    QList<Clause> clauses;
+
+};
+
 class BlockProcessor
 {
 public:
@@ -82,10 +154,22 @@ public:
 	 */
     virtual bool run(const Element &parent, QStringList &blocks) = 0;
 
+    /*!
+     * The BlockParser only calls test() on blocks that pass this filter;
+     * processors without one are tested on every block.
+     */
+    BlockPrefilter prefilter(void) const
+    { return this->block_prefilter; }
+    void setPrefilter(const BlockPrefilter &prefilter)
+    { this->block_prefilter = prefilter; }
+
 protected:
     std::weak_ptr<BlockParser> parser;
 	int tab_length;
 
+private:
+    BlockPrefilter block_prefilter;
+
 };
 
 typedef OrderedDict<std::shared_ptr<BlockProcessor>> OrderedDictBlockProcessors;
@@ -21,6 +21,8 @@ public:
     QString clean(const QString &line);
 
 private:
+    QString clean(const LineIndex &lines, int index) const;
+
     const QRegularExpression RE;
 
 };
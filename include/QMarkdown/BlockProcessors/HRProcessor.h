@@ -19,9 +19,11 @@ public:
     bool run(const Element &parent, QStringList &blocks);
 
 private:
+    //! Match of the hr in a block, if there is one.
+    QRegularExpressionMatch search(const QString &block) const;
+
     //! Detect hr on any line of a block.
     QRegularExpression SEARCH_RE;
-    QRegularExpressionMatch match;
 
 };
 
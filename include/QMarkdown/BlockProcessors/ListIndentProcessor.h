@@ -29,7 +29,8 @@ public:
     bool run(const Element &parent, QStringList &blocks);
 
     /*!
-     * Create a new li and parse the block with it as the parent.
+     * Create a new li and schedule the block to be parsed with it as the
+     * parent, in the "detabbed" state like every block run handles.
      */
     virtual void create_item(const Element &parent, const QString &block);
 
@@ -42,9 +43,6 @@ protected:
     QSet<QString> ITEM_TYPES;
     QSet<QString> LIST_TYPES;
 
-private:
-    QRegularExpression INDENT_RE;
-
 };
 
 } // namespace markdown
@@ -23,24 +23,24 @@ public:
 
     /*!
      * Break a block into list items.
+     *
+     * Returns: the items and the integer the list starts with.
      */
-    QStringList get_items(const QString &block);
+    std::tuple<QStringList, QString> get_items(const QString &block) const;
 
 protected:
     QString TAG;
-    //! Detect an item (``1. item``). ``group(1)`` contains contents of item.
-    QRegularExpression RE;
+    //! Detect an item (``1. item``) by the marker of the first line,
+    //! indented by less than a tab.  Items on secondary lines can be of
+    //! either list type, nested ones are indented by one more tab.
+    LineIndex::Marker MARKER;
 
 private:
-    //! Detect items on secondary lines. they can be of either list type.
-    const QRegularExpression CHILD_RE;
-    //! Detect indented (nested) items of either type
-    const QRegularExpression INDENT_RE;
     //! The integer (python string) with which the lists starts (default=1)
     //! Eg: If list is intialized as)
     //!   3. Item
     //! The ol tag will get starts="3" attribute
-    QString STARTSWITH;
+    const QString STARTSWITH;
     //! List of allowed sibling tags.
     const QSet<QString> SIBLING_TAGS;
 
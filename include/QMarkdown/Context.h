@@ -0,0 +1,94 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <memory>
+
+#include "BlockParser.h"
+#include "ElementArena.h"
+#include "Markdown.h"
+
+namespace markdown{
+
+/*!
+ * The mutable state of one conversion.
+ *
+ * A Markdown instance only holds the compiled profile: processors,
+ * patterns and options, none of which change while converting.  Whatever
+ * a document accumulates on its way through the pipeline lives here
+ * instead, so any number of threads can convert against one profile.
+ *
+ * Processors reach the context of the conversion they are part of
+ * through Context::current().
+ */
+class Context
+{
+public:
+    /*!
+     * Makes a context the current one on this thread, together with its
+     * element arena, for as long as the scope lives.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(Context &context);
+        ~Scope();
+
+    private:
+        Scope(const Scope &);
+        Scope &operator =(const Scope &);
+
+        Context *previous;
+        ElementArena::Scope arena;
+
+    };
+
+    /*!
+     * A context with an arena for the elements of its document.
+     */
+    Context();
+
+    /*!
+     * The context of the innermost Scope on this thread.  Outside of a
+     * conversion, e.g. when processors are driven by hand, this is a
+     * default context of the thread.  It is cleared by Markdown::reset()
+     * and whenever a conversion starts on the thread, so state does not
+     * build up in it from one document to the next.
+     */
+    static Context &current();
+
+    /*!
+     * Resets all state variables so that we can start with a new text.
+     */
+    void reset();
+
+    //! link references collected by the ReferencePreprocessor
+    Markdown::Reference references;
+    //! raw html blocks, replaced back by the RawHtmlPostprocessor
+    HtmlStash htmlStash;
+    //! nesting state of the BlockParser
+    State state;
+    //! work of the BlockParser, innermost last
+    BlockFrames frames;
+    //! where work scheduled by the processor running now goes, if any
+    BlockFrames *scheduled;
+    //! line index of the block the BlockParser looked at last
+    LineIndex lines;
+    //! tree built by BlockParser::parseDocument
+    ElementTree root;
+    //! inline nodes hidden behind placeholders by the InlineProcessor
+    TreeProcessor::StashNodes stashed_nodes;
+    //! inline patterns of this document only, tried after the ones of
+    //! the profile (e.g. abbreviations)
+    OrderedDictPatterns inlinePatterns;
+
+    std::shared_ptr<ElementArena> arena;
+
+private:
+    Context(const Context &);
+    Context &operator =(const Context &);
+
+};
+
+} // end of namespace markdown
+
+#endif // CONTEXT_H
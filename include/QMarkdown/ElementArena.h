@@ -0,0 +1,105 @@
+#ifndef ELEMENTARENA_H
+#define ELEMENTARENA_H
+
+#include <memory>
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+
+namespace markdown{
+
+namespace impl {
+class Element;  //!< forward declaration
+}
+
+/*!
+ * Storage for the elements of one document.
+ *
+ * Elements are constructed in place inside blocks owned by the arena and
+ * are released together when the last handle into the arena goes away;
+ * individual elements carry no reference count of their own.  Tag strings
+ * are shared within an arena, so every element with the same tag starts out
+ * with one copy of it.
+ *
+ * An element may be moved under a parent from another arena; the parent's
+ * arena then keeps the child's alive for as long as the link exists.  Two
+ * arenas linked both ways keep each other alive until one of the links is
+ * removed, so trees should not be interleaved across documents.
+ */
+class ElementArena : public std::enable_shared_from_this<ElementArena>
+{
+public:
+    /*!
+     * Makes an arena the one new elements are allocated from on this
+     * thread, for as long as the scope lives.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(const std::shared_ptr<ElementArena> &arena);
+        ~Scope();
+
+    private:
+        Scope(const Scope &);
+        Scope &operator =(const Scope &);
+
+        std::shared_ptr<ElementArena> arena;
+        ElementArena *previous;
+
+    };
+
+    explicit ElementArena(int blockSize=256);
+    ~ElementArena();
+
+    /*!
+     * The arena of the innermost Scope on this thread.  Outside of a Scope,
+     * elements share a thread-wide arena for as long as any of them is
+     * alive, and a new one is started once they are all gone.
+     */
+    static std::shared_ptr<ElementArena> current();
+
+    impl::Element *create(const QString &tag, const QMap<QString, QString> &attrib);
+
+    //! number of elements allocated so far
+    int size() const;
+
+    /*!
+     * Keeps another arena alive, because one of its elements became a child
+     * of an element of this arena.  Every retain() is paired with a
+     * release() once that child is unlinked again.
+     */
+    void retain(const std::shared_ptr<ElementArena> &arena);
+    void release(ElementArena *arena);
+
+private:
+    struct Block
+    {
+        impl::Element *nodes;
+        int capacity;
+        int used;
+    };
+
+    ElementArena(const ElementArena &);
+    ElementArena &operator =(const ElementArena &);
+
+    int blockSize;
+    QList<Block> blocks;
+    int count;
+
+    QSet<QString> tags;
+
+    struct Retained
+    {
+        std::shared_ptr<ElementArena> arena;
+        int links;
+    };
+    QHash<ElementArena *, Retained> retained;
+
+};
+
+} // end of namespace markdown
+
+#endif // ELEMENTARENA_H
@@ -10,33 +10,364 @@
 
 #include "pypp/xml/etree/elementtree.hpp"
 
+#include "ElementArena.h"
+
 namespace markdown{
 
 namespace impl {
 
-class Element : public pypp::xml::etree::ElementImpl<Element>
+/*!
+ * An element allocated from an ElementArena.
+ *
+ * Children are kept as an intrusive doubly linked list, so an element
+ * belongs to at most one parent: adding it somewhere else moves it.
+ * Handles are std::shared_ptr that share ownership of the arena rather
+ * than of the element itself.
+ */
+class Element
 {
 public:
-    Element(const pypp::str &tag, const Attribute_t &attrib=Attribute_t()) :
-        ElementImpl(tag, attrib),
-        atomic(false)
+    typedef std::shared_ptr<Element> ElementPtr;
+    typedef QMap<pypp::str, pypp::str> Attribute_t;
+    typedef QList<ElementPtr> ElementList_t;
+
+    typedef pypp::xml::etree::SimpleElementPath<Element> ElementPath;
+
+    /*!
+     * Walks the children in document order.  The next sibling is looked
+     * up in advance, so the current child may be removed while iterating.
+     */
+    class const_iterator
+    {
+    public:
+        const_iterator(const Element *node=nullptr) :
+            node(node),
+            next(node ? node->_next : nullptr)
+        {}
+
+        ElementPtr operator *() const
+        {
+            return this->node->handle();
+        }
+        const_iterator &operator ++()
+        {
+            this->node = this->next;
+            this->next = this->node ? this->node->_next : nullptr;
+            return *this;
+        }
+        bool operator ==(const const_iterator &other) const
+        {
+            return this->node == other.node;
+        }
+        bool operator !=(const const_iterator &other) const
+        {
+            return this->node != other.node;
+        }
+
+    private:
+        const Element *node;
+        const Element *next;
+
+    };
+    typedef const_iterator iterator;
+
+    //! Element tag, shared with every element of the same tag in the arena.
+    pypp::str tag;
+    //! Element attribute dictionary.
+    Attribute_t attrib;
+    //! Text before first subelement.
+    pypp::str text;
+    //! Text after this element's end tag.
+    pypp::str tail;
+
+    bool atomic;
+
+    /*!
+     * Use makeelement(), elements only live inside an ElementArena.
+     */
+    Element(ElementArena *arena, const pypp::str &tag, const Attribute_t &attrib) :
+        tag(tag),
+        attrib(attrib),
+        text(),
+        tail(),
+        atomic(false),
+        _arena(arena),
+        _parent(nullptr),
+        _first(nullptr),
+        _last(nullptr),
+        _prev(nullptr),
+        _next(nullptr),
+        _count(0)
     {}
 
+    /*!
+     * Creates a new element in the current arena of this thread.
+     */
+    static ElementPtr makeelement(const pypp::str &tag, const Attribute_t &attrib=Attribute_t())
+    {
+        std::shared_ptr<ElementArena> arena = ElementArena::current();
+        return ElementPtr(arena, arena->create(tag, attrib));
+    }
+
+    /*!
+     * Copies the current element into the same arena.  Because an element
+     * has a single parent, subelements are copied as well, each into the
+     * arena it lives in.
+     */
     ElementPtr copy() const
     {
-        ElementPtr elem = Element::makeelement(this->tag, this->attrib);
-        elem->text = this->text;
-        elem->tail = this->tail;
-        elem->_children = this->_children;
-        elem->atomic = this->atomic;
+        ElementPtr elem = this->copyNode();
+        //! walks the subelements in document order, with target the copy
+        //! of the last one reached
+        Element *target = elem.get();
+        const Element *node = this;
+        for ( ;; ) {
+            if ( node->_first != nullptr ) {
+                node = node->_first;
+            } else {
+                while ( node != this && node->_next == nullptr ) {
+                    node = node->_parent;
+                    target = target->_parent;
+                }
+                if ( node == this ) {
+                    break;
+                }
+                node = node->_next;
+                target = target->_parent;
+            }
+            ElementPtr child = node->copyNode();
+            target->append(child);
+            target = child.get();
+        }
         return elem;
     }
 
-    bool atomic;
+    std::shared_ptr<ElementArena> arena() const
+    {
+        return this->_arena->shared_from_this();
+    }
+
+    /*!
+     * Returns the number of subelements.
+     */
+    int size() const
+    {
+        return this->_count;
+    }
+
+    /*!
+     * Returns the given subelement, by index.  Negative indexes count from
+     * the end; the list is walked from whichever end is nearer.
+     *
+     * @exception IndexError If the given element does not exist.
+     */
+    ElementPtr operator [](int index) const
+    {
+        return this->nodeAt(this->normalize_index(index))->handle();
+    }
+
+    /*!
+     * Deletes the given subelement, by index.
+     *
+     * @exception IndexError If the given element does not exist.
+     */
+    void removeAt(int index)
+    {
+        this->unlink(this->nodeAt(this->normalize_index(index)));
+    }
+
+    /*!
+     * Adds a subelement to the end of this element.
+     */
+    void append(const ElementPtr &element)
+    {
+        this->link(nullptr, element);
+    }
+
+    /*!
+     * Appends subelements from a sequence.
+     */
+    void extend(const ElementList_t &elements)
+    {
+        for ( const ElementPtr &element : elements ) {
+            this->append(element);
+        }
+    }
+
+    /*!
+     * Inserts a subelement at the given position in this element.
+     */
+    void insert(int index, const ElementPtr &element)
+    {
+        if ( element->_parent == this ) {
+            //! positions are counted without the element being moved
+            if ( this->indexOf(element) < index ) {
+                --index;
+            }
+            this->unlink(element.get());
+        }
+        if ( index < 0 ) {
+            index += this->size();
+        }
+        if ( index < 0 ) {
+            index = 0;
+        }
+        if ( index >= this->size() ) {
+            this->link(nullptr, element);
+        } else {
+            this->link(this->nodeAt(index), element);
+        }
+    }
+
+    /*!
+     * Inserts subelements in order right after `sibling`, one of the
+     * subelements, or at the beginning when it is null.  No positions
+     * are counted, so it only takes time in the number of elements.
+     *
+     * @exception ValueError If sibling is not a subelement.
+     */
+    void insertAfter(const ElementPtr &sibling, const ElementList_t &elements)
+    {
+        if ( sibling && sibling->_parent != this ) {
+            throw pypp::ValueError();
+        }
+        Element *after = sibling.get();
+        for ( const ElementPtr &element : elements ) {
+            Element *node = element.get();
+            if ( node == after ) {
+                continue;
+            }
+            if ( node->_parent != nullptr ) {
+                node->_parent->unlink(node);
+            }
+            this->link(after ? after->_next : this->_first, element);
+            after = node;
+        }
+    }
+
+    /*!
+     * Removes a matching subelement, compared by identity.
+     */
+    void remove(const ElementPtr &element)
+    {
+        if ( element && element->_parent == this ) {
+            this->unlink(element.get());
+        }
+    }
+
+    //! position of a subelement, or -1
+    int indexOf(const ElementPtr &element) const
+    {
+        if ( ! element || element->_parent != this ) {
+            return -1;
+        }
+        int index = 0;
+        for ( const Element *node = this->_first; node != element.get(); node = node->_next ) {
+            ++index;
+        }
+        return index;
+    }
+
+    /*!
+     * Finds the first matching subelement, by tag name or path.
+     */
+    ElementPtr find(const pypp::str &path, const pypp::xml::etree::Namespaces_t &namespaces=pypp::xml::etree::Namespaces_t())
+    {
+        return ElementPath::find(this->handle(), path, namespaces);
+    }
+
+    /*!
+     * Finds text for the first matching subelement, by tag name or path.
+     */
+    pypp::str findtext(const pypp::str &path, const pypp::str &default_=pypp::str(), const pypp::xml::etree::Namespaces_t &namespaces=pypp::xml::etree::Namespaces_t())
+    {
+        return ElementPath::findtext(this->handle(), path, default_, namespaces);
+    }
+
+    /*!
+     * Finds all matching subelements, by tag name or path.
+     */
+    ElementList_t findall(const pypp::str &path, const pypp::xml::etree::Namespaces_t &namespaces=pypp::xml::etree::Namespaces_t())
+    {
+        return ElementPath::findall(this->handle(), path, namespaces);
+    }
+
+    ElementList_t iterfind(const pypp::str &path, const pypp::xml::etree::Namespaces_t &namespaces=pypp::xml::etree::Namespaces_t())
+    {
+        return ElementPath::iterfind(this->handle(), path, namespaces);
+    }
+
+    /*!
+     * Resets an element: removes all subelements, attributes, text and tail.
+     */
+    void clear()
+    {
+        while ( this->_first != nullptr ) {
+            this->unlink(this->_first);
+        }
+        this->attrib.clear();
+        this->text.clear();
+        this->tail.clear();
+    }
+
+    pypp::str get(const pypp::str &key, const pypp::str &default_=pypp::str()) const
+    {
+        if ( this->attrib.contains(key) ) {
+            return this->attrib[key];
+        }
+        return default_;
+    }
+
+    void set(const pypp::str &key, const pypp::str &value)
+    {
+        this->attrib[key] = value;
+    }
+
+    QStringList keys() const
+    {
+        return this->attrib.keys();
+    }
+
+    pypp::xml::etree::ItemList_t items() const
+    {
+        pypp::xml::etree::ItemList_t result;
+        for ( auto it = this->attrib.cbegin(); it != this->attrib.cend(); ++it ) {
+            result.append(pypp::xml::etree::Item_t(it.key(), it.value()));
+        }
+        return result;
+    }
+
+    /*!
+     * This element and all its descendants in document order, optionally
+     * restricted to one tag.
+     */
+    ElementList_t iter(pypp::str tag=pypp::str()) const
+    {
+        if ( tag == "*" ) {
+            tag = "";
+        }
+        ElementList_t result;
+        this->collect(tag, result);
+        return result;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(this->_first);
+    }
+    const_iterator end() const
+    {
+        return const_iterator();
+    }
 
     ElementList_t child() const
     {
-        return this->_children;
+        ElementList_t result;
+        result.reserve(this->_count);
+        for ( const Element *node = this->_first; node != nullptr; node = node->_next ) {
+            result.append(node->handle());
+        }
+        return result;
     }
 
     bool hasText() const
@@ -48,6 +379,131 @@ public:
         return ! this->tail.isEmpty();
     }
 
+private:
+    friend class markdown::ElementArena;
+
+    ElementPtr handle() const
+    {
+        return ElementPtr(this->_arena->shared_from_this(), const_cast<Element *>(this));
+    }
+
+    int normalize_index(int index) const
+    {
+        if ( index < 0 ) {
+            index += this->size();
+        }
+        if ( index < 0 || index >= this->size() ) {
+            throw pypp::IndexError();
+        }
+        return index;
+    }
+
+    Element *nodeAt(int index) const
+    {
+        Element *node;
+        if ( index < this->_count / 2 ) {
+            node = this->_first;
+            for ( int i = 0; i < index; ++i ) {
+                node = node->_next;
+            }
+        } else {
+            node = this->_last;
+            for ( int i = this->_count-1; i > index; --i ) {
+                node = node->_prev;
+            }
+        }
+        return node;
+    }
+
+    //! inserts element before `before`, or at the end when it is null
+    void link(Element *before, const ElementPtr &element)
+    {
+        Element *node = element.get();
+        if ( node->_parent != nullptr ) {
+            node->_parent->unlink(node);
+        }
+        if ( node->_arena != this->_arena ) {
+            this->_arena->retain(node->_arena->shared_from_this());
+        }
+        node->_parent = this;
+        node->_next = before;
+        node->_prev = before ? before->_prev : this->_last;
+        if ( node->_prev != nullptr ) {
+            node->_prev->_next = node;
+        } else {
+            this->_first = node;
+        }
+        if ( before != nullptr ) {
+            before->_prev = node;
+        } else {
+            this->_last = node;
+        }
+        ++this->_count;
+    }
+
+    void unlink(Element *node)
+    {
+        if ( node->_prev != nullptr ) {
+            node->_prev->_next = node->_next;
+        } else {
+            this->_first = node->_next;
+        }
+        if ( node->_next != nullptr ) {
+            node->_next->_prev = node->_prev;
+        } else {
+            this->_last = node->_prev;
+        }
+        node->_parent = nullptr;
+        node->_prev = nullptr;
+        node->_next = nullptr;
+        --this->_count;
+        if ( node->_arena != this->_arena ) {
+            //! last use of node, this may free its arena
+            this->_arena->release(node->_arena);
+        }
+    }
+
+    //! walks the links rather than the call stack, so any depth will do
+    void collect(const pypp::str &tag, ElementList_t &result) const
+    {
+        const Element *node = this;
+        for ( ;; ) {
+            if ( tag.isEmpty() || node->tag == tag ) {
+                result.append(node->handle());
+            }
+            if ( node->_first != nullptr ) {
+                node = node->_first;
+                continue;
+            }
+            while ( node != this && node->_next == nullptr ) {
+                node = node->_parent;
+            }
+            if ( node == this ) {
+                break;
+            }
+            node = node->_next;
+        }
+    }
+
+    //! a copy of this element without its subelements
+    ElementPtr copyNode() const
+    {
+        ElementPtr elem(this->_arena->shared_from_this(), this->_arena->create(this->tag, this->attrib));
+        elem->text = this->text;
+        elem->tail = this->tail;
+        elem->atomic = this->atomic;
+        return elem;
+    }
+
+    ElementArena *_arena;
+
+    Element *_parent;
+    Element *_first;
+    Element *_last;
+    Element *_prev;
+    Element *_next;
+    int _count;
+
 };
 
 } // namespace impl
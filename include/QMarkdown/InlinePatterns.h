@@ -8,6 +8,9 @@
 #ifndef INLINEPATTERNS_H_
 #define INLINEPATTERNS_H_
 
+#include <functional>
+#include <tuple>
+
 #include <boost/optional.hpp>
 
 #include "ElementTree.hpp"
@@ -32,10 +35,10 @@ namespace markdown{
  * All of python markdown's built-in patterns subclass from Pattern,
  * but you can add additional patterns that don't.
  *
- * Also note that all the regular expressions used by inline must
- * capture the whole block.  For this reason, they all start with
- * '^(.*)' and end with '(.*)!'.  In case with built-in expression
- * Pattern takes care of adding the "^(.*)" and "(.*)!".
+ * Unlike Python-Markdown, the regular expressions are not wrapped in
+ * '^(.*?)' and '(.*)$'.  The inline processor matches the bare expression
+ * at an offset into the text, so group 1 is the first group of the
+ * pattern itself and the match span (captured(0)) is what gets replaced.
  *
  * Finally, the order in which regular expressions are applied is very
  * important - e.g. if we first replace http://.../ links with <a> tags
@@ -69,6 +72,20 @@ class Markdown;  //!< forward declaration
 class Pattern
 {
 public:
+    //! start of the leftmost match at or after an offset, or -1
+    typedef std::function<int(const QString &data, int offset)> Locator;
+
+    /*!
+     * Whatever scan() wants to carry from one scan of a text to the next.
+     */
+    class ScanState
+    {
+    public:
+        virtual ~ScanState()
+        {}
+    };
+    typedef std::unique_ptr<ScanState> ScanStatePtr;
+
     /*!
      * Create an instant of an inline pattern.
      *
@@ -93,6 +110,7 @@ public:
      * Keyword arguments:
      *
      * * m: A re match object containing a match of the pattern.
+     *      Group numbers are those of the bare pattern.
      *
      */
     virtual boost::optional<QString> handleMatch(const QRegularExpressionMatch &)
@@ -100,6 +118,33 @@ public:
     virtual Element handleMatch(const ElementTree &, const QRegularExpressionMatch &)
     { return Element(); }
 
+    /*!
+     * Return whether this pattern finds its matches with scan() instead of
+     * its expression.
+     */
+    virtual bool scans(void) const
+    { return false; }
+
+    /*!
+     * Find the leftmost match at or after offset by hand and return its
+     * element.
+     *
+     * Patterns override this when their syntax, e.g. nested brackets, is
+     * beyond what an expression matches in linear time.  The expression
+     * then only describes the syntax.
+     *
+     * `state` is null at the first scan of a text.  Whatever the pattern
+     * leaves there is handed back at the next scan of the same text, as
+     * long as the text only changed by the match returned last being
+     * replaced with a placeholder (or left alone), so work done on the
+     * rest of the text need not be repeated.
+     *
+     * Returns: start and end of the match, start being -1 if there is
+     * none, and the element, which is null if the match stays text.
+     */
+    virtual std::tuple<int, int, Element> scan(const QString &/*data*/, int /*offset*/, ScanStatePtr &/*state*/)
+    { return std::make_tuple(-1, -1, Element()); }
+
     /*!
      * Return class name, to define pattern type
      */
@@ -110,9 +155,73 @@ public:
      */
     virtual QString unescape(const QString &text);
 
+    /*!
+     * Return the characters a match of this pattern can start with.
+     *
+     * The inline processor only tries a pattern at the trigger characters
+     * found while scanning the text.  An empty set means the pattern has
+     * no trigger and is tried on every text.
+     */
+    QString triggers(void) const
+    { return this->trigger_chars; }
+
+    /*!
+     * Register the characters a match of this pattern can start with.
+     */
+    void setTriggers(const QString &chars)
+    { this->trigger_chars = chars; }
+
+    /*!
+     * Return the leftmost match at or after offset.
+     *
+     * With a locator the expression only runs anchored at the starts the
+     * locator finds; otherwise it searches the text itself.
+     */
+    QRegularExpressionMatch match(const QString &data, int offset) const;
+
+    /*!
+     * Register a hand-written search for the start of a match.
+     *
+     * Lazy bodies and back references make the expressions of some
+     * patterns backtrack over the rest of the text at every start that
+     * fails.  A locator finds the start in one forward scan instead; it
+     * must not skip any start the expression matches at.
+     *
+     * Keyword arguments:
+     *
+     * * locator: The search.
+     * * lookback: How far before a match replaced by a placeholder a new
+     *   match can start.  Searching resumes there instead of at the
+     *   beginning of the text.
+     *
+     * This only bounds the search.  Each match is still spliced into a
+     * copy of the text, so n matches cost O(n * length) whatever the
+     * locator does.
+     *
+     */
+    void setLocator(const Locator &locator, int lookback);
+
+    /*!
+     * Return where to search again once the match at start has been
+     * replaced by a placeholder.
+     */
+    virtual int resumeOffset(int start) const;
+
 protected:
+    typedef std::function<QString(const boost::optional<QString> &, const boost::optional<Element> &)> StashReplacer;
+
+    /*!
+     * Replace every inline placeholder in text with what `replace` makes of
+     * the stashed string or node.  The stash of the current conversion is
+     * read in place, and text without placeholders is returned as is.
+     */
+    static QString replacePlaceholders(const QString &text, const StashReplacer &replace);
+
     QString pattern;
     QRegularExpression compiled_re;
+    QString trigger_chars;
+    Locator locator;
+    int locator_lookback;
     bool safe_mode;
     std::weak_ptr<Markdown> markdown;
 
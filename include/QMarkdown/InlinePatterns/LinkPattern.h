@@ -6,6 +6,55 @@
 namespace markdown
 {
 
+/*!
+ * The parts of a link construct.
+ */
+struct LinkMatch
+{
+    int start;      //!< -1 if there is no match
+    int end;
+    QString text;   //!< between the brackets
+    QString href;   //!< between the parentheses, or the reference id
+    QString title;
+};
+
+/*!
+ * What the link scanners carry from one scan of a text to the next.
+ */
+class LinkScanState : public Pattern::ScanState
+{
+public:
+    LinkScanState();
+    ~LinkScanState();
+
+    struct Tables;  //!< defined with the scanners
+    std::unique_ptr<Tables> tables;
+
+private:
+    LinkScanState(const LinkScanState &);
+    LinkScanState &operator =(const LinkScanState &);
+
+};
+
+/*!
+ * Scanners for the link constructs: each returns the leftmost match at or
+ * after offset, with the same extent and parts as the expression in its
+ * name would capture.  Brackets are paired with a counter, so they nest to
+ * any depth, and every scan takes linear time.
+ *
+ * A state carries the tables of the text behind a match over to the next
+ * scan, see Pattern::scan(); that scan then resumes at the outermost
+ * bracket still open at the match, the only one whose pairing the
+ * placeholder can change.  Without a state, a scan works on its own.
+ */
+typedef LinkMatch (*LinkScanner)(const QString &data, int offset, LinkScanState *state);
+
+LinkMatch scanLink(const QString &data, int offset, LinkScanState *state=nullptr);              //!< LINK_RE
+LinkMatch scanImageLink(const QString &data, int offset, LinkScanState *state=nullptr);         //!< IMAGE_LINK_RE
+LinkMatch scanReference(const QString &data, int offset, LinkScanState *state=nullptr);         //!< REFERENCE_RE
+LinkMatch scanImageReference(const QString &data, int offset, LinkScanState *state=nullptr);    //!< IMAGE_REFERENCE_RE
+LinkMatch scanShortReference(const QString &data, int offset, LinkScanState *state=nullptr);    //!< SHORT_REF_RE
+
 /*!
  * Return a link element from the given match.
  */
@@ -15,7 +64,25 @@ public:
     LinkPattern(const QString& pattern, const std::weak_ptr<Markdown> &md);
     virtual ~LinkPattern(void);
 
-    virtual Element handleMatch(const ElementTree &, const QRegularExpressionMatch &m);
+    /*!
+     * Hand the parts of a match of the expression (text: group 1, href or
+     * id: group 8, title: group 12) to the handleMatch() for LinkMatch.
+     */
+    Element handleMatch(const ElementTree &doc, const QRegularExpressionMatch &m);
+    virtual Element handleMatch(const ElementTree &, const LinkMatch &m);
+
+    /*!
+     * Find matches with a scanner rather than the expression.
+     *
+     * A scanned match only reaches the handleMatch() for LinkMatch; a
+     * subclass that overrides the QRegularExpressionMatch overloads
+     * instead must not set a scanner.  The built-in patterns are the only
+     * ones that get one.
+     */
+    void setScanner(LinkScanner scanner);
+
+    bool scans(void) const;
+    std::tuple<int, int, Element> scan(const QString &data, int offset, ScanStatePtr &state);
 
     /*!
      * Sanitize a url against xss attacks in "safe_mode".
@@ -37,6 +104,9 @@ public:
 
     virtual QString type(void) const;
 
+private:
+    LinkScanner scanner;
+
 };
 
 /*!
@@ -47,7 +117,8 @@ class ImagePattern : public LinkPattern
 public:
     ImagePattern(const QString &pattern, const std::weak_ptr<Markdown> &md);
 
-    Element handleMatch(const ElementTree &, const QRegularExpressionMatch &m);
+    using LinkPattern::handleMatch;
+    Element handleMatch(const ElementTree &, const LinkMatch &m);
 
     QString type(void) const;
 
@@ -59,7 +130,8 @@ public:
     ReferencePattern(const QString &pattern, const std::weak_ptr<Markdown> &md);
     virtual ~ReferencePattern(void);
 
-    Element handleMatch(const ElementTree &doc, const QRegularExpressionMatch &m);
+    using LinkPattern::handleMatch;
+    Element handleMatch(const ElementTree &doc, const LinkMatch &m);
 
     virtual Element makeTag(const ElementTree &, const QString &href, const QString &title, const QString &text);
 
@@ -68,6 +68,23 @@ extern const QString ENTITY_RE;
 //! two spaces at end of line
 extern const QString LINE_BREAK_RE;
 
+/*!
+ * Exact searches for the leftmost match of the emphasis expressions,
+ * each a single forward scan from offset (see Pattern::setLocator()).
+ *
+ * Returns: the start of the match at or after offset, or -1.
+ */
+int locateNotStrong(const QString &data, int offset);
+int locateEmStrong(const QString &data, int offset);
+int locateStrongEm(const QString &data, int offset);
+int locateStrong(const QString &data, int offset);
+int locateEmphasis(const QString &data, int offset);
+int locateEmphasis2(const QString &data, int offset);
+int locateSmartEmphasis(const QString &data, int offset);
+
+//! `\b` at index, with the Unicode word characters of the expressions
+bool isWordBoundary(const QString &data, int index);
+
 //! Remove quotes from around a string.
 QString dequote(const QString &string);
 
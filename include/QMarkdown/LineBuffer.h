@@ -0,0 +1,77 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <QString>
+#include <QStringList>
+#include <QStringRef>
+#include <QVector>
+
+namespace markdown{
+
+/*!
+ * The lines of a document as spans over one source buffer.
+ *
+ * Splitting the source into lines only records where each line starts and
+ * ends; the text itself stays in the (implicitly shared) source string.
+ * Preprocessors drop or reorder lines by editing the spans, and text they
+ * produce themselves is appended to a second buffer, so the source is
+ * never copied or rejoined between stages.
+ */
+class LineBuffer
+{
+public:
+    struct Span
+    {
+        int begin;
+        int length;
+        bool added;  //!< in the added text rather than the source
+    };
+    typedef QVector<Span> Spans;
+
+    LineBuffer();
+    //! splits the source on "\n"
+    explicit LineBuffer(const QString &source);
+    explicit LineBuffer(const QStringList &lines);
+
+    int size() const;
+    bool isEmpty() const;
+
+    //! the text of a line, valid as long as the buffer is not modified
+    QStringRef at(int index) const;
+    //! a copy of the text of a line
+    QString line(int index) const;
+
+    const Span &span(int index) const;
+    const Spans &spans() const;
+    /*!
+     * Replaces the lines, e.g. with a filtered list of the current spans
+     * and spans returned by add().
+     */
+    void setSpans(const Spans &spans);
+
+    /*!
+     * Stores a new line of text without inserting it anywhere yet.
+     */
+    Span add(const QString &text);
+    void append(const QString &line);
+
+    /*!
+     * Lines [first, last) joined with "\n".  A contiguous range of the
+     * source is copied in one piece.
+     */
+    QString join(int first, int last) const;
+    QString join() const;
+    QStringList toList() const;
+
+private:
+    QStringRef text(const Span &span) const;
+
+    QString source;
+    QString added;
+    Spans lines;
+
+};
+
+} // end of namespace markdown
+
+#endif // LINEBUFFER_H
@@ -0,0 +1,85 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <QString>
+#include <QStringRef>
+#include <QVector>
+
+namespace markdown{
+
+/*!
+ * What the block processors look at in each line of a block, collected
+ * in one pass over it.
+ *
+ * Instead of splitting a block and matching every line against their
+ * expressions, processors ask the index where lines start, how far they
+ * are indented and which list, quote or header marker follows the
+ * indentation.  Indentation only counts spaces, the same as the `[ ]`
+ * of the expressions it replaces.
+ */
+class LineIndex
+{
+public:
+    enum Marker
+    {
+        NoMarker,
+        Ordered,  //!< `\d+\.[ ]+`
+        Bullet,   //!< `[*+-][ ]+`
+        Quote,    //!< `>`
+        Hash      //!< `#`
+    };
+
+    struct Line
+    {
+        int begin;
+        int length;
+        //! leading spaces
+        int indent;
+        //! character after them, '\n' if the line ends there
+        QChar first;
+        //! nothing but whitespace
+        bool blank;
+        Marker marker;
+        //! offset into the line of the text after the marker, e.g. the
+        //! item text or the quoted text after an optional space
+        int content;
+    };
+
+    //! the index of a single empty line
+    LineIndex();
+    //! lines are split on "\n", so there is always at least one
+    explicit LineIndex(const QString &text);
+
+    const QString &text() const;
+    int size() const;
+    const Line &at(int index) const;
+
+    //! the text of a line, valid as long as the index lives
+    QStringRef line(int index) const;
+    //! the text of a line after `offset` characters
+    QString mid(int index, int offset) const;
+    //! lines [first, last) with the newlines between them
+    QString join(int first, int last) const;
+
+    //! the first line indented by at most maxIndent with the marker, or -1
+    int find(Marker marker, int maxIndent, int from=0) const;
+
+    //! whether this is the index of `text` itself, not only of an equal one
+    bool indexes(const QString &text) const;
+
+private:
+    friend class BlockPrefilter;
+
+    QString source;
+    QVector<Line> lines;
+    //! ASCII characters starting a line after exactly i spaces
+    quint64 lineStarts[4][2];
+    //! ASCII characters anywhere in the text
+    quint64 chars[2];
+    bool nonAscii;
+
+};
+
+} // end of namespace markdown
+
+#endif // LINEINDEX_H
@@ -42,6 +42,7 @@
 
 #include <functional>
 
+#include <QIODevice>
 #include <QPair>
 #include <QSet>
 
@@ -55,6 +56,7 @@
 namespace markdown{
 
 class BlockParser;  //!< forward declaration
+class SerializerSink;  //!< forward declaration
 
 /*!
  * Convert Markdown to HTML.
@@ -67,6 +69,27 @@ public:
 
     typedef QList<Extension::Ptr> Extensions;
 
+    /*!
+     * Throughput of a batch conversion.
+     */
+    struct BatchStats
+    {
+        int documents;        //!< documents converted
+        int failures;         //!< documents that could not be read or converted
+        qint64 characters;    //!< characters of markdown read
+        qint64 elapsed;       //!< wall time in milliseconds
+        int threads;          //!< workers used
+
+        double documentsPerSecond() const;
+        double charactersPerSecond() const;
+    };
+
+    /*!
+     * Receives every converted document of a batch, on the worker thread
+     * that converted it and in completion order.
+     */
+    typedef std::function<void(int index, const QString &html)> BatchCallback;
+
 public:
     typedef enum{
         default_mode,
@@ -143,8 +166,17 @@ public:
     std::shared_ptr<Markdown> registerExtension(const Extension::Ptr &extension);
     /*!
      * Resets all state variables so that we can start with a new text.
+     *
+     * convert() always starts from a fresh Context; this only clears the
+     * current one, for callers that drive the processors themselves.
      */
     std::shared_ptr<Markdown> reset(void);
+    /*!
+     * The link references and the raw html stash of the document being
+     * converted on this thread, i.e. those of Context::current().
+     */
+    Reference &references(void);
+    HtmlStash &htmlStash(void);
     /*!
      * Set the output format for the class instance.
      */
@@ -163,34 +195,89 @@ public:
      *    pre-processed text into an ElementTree.
      * 3. A bunch of "treeprocessors" are run against the ElementTree. One
      *    such treeprocessor runs InlinePatterns against the ElementTree,
-     *    detecting inline markup.
+     *    detecting inline markup.  Consecutive TreeVisitors share a walk.
      * 4. Some post-processors are run against the text after the ElementTree
      *    has been serialized into text.
      * 5. The output is written to a string.
      *
+     * Every call keeps its state in a Context of its own, so an initialized
+     * instance may convert on several threads at once.  Changing the
+     * processors, patterns or options meanwhile is not safe.
+     *
      */
     QString convert(const QString &source);
     /*!
-     * Converts a markdown file and returns the HTML as a unicode string.
+     * Like convert(), writing the HTML into a sink.
      *
-     * Decodes the file using the provided encoding (defaults to utf-8),
-     * passes the file content to markdown, and outputs the html to either
-     * the provided stream or the file with provided name, using the same
-     * encoding as the source file. The 'xmlcharrefreplace' error handler is
-     * used when encoding the output.
+     * Each top-level block is serialized, post-processed and written on
+     * its own, so the whole output is never held at once.  That takes
+     * post-processors that all work blockwise() (the built-in ones do);
+     * otherwise they see the whole document in one pass, as convert()
+     * always did.
+     */
+    void convert(const QString &source, SerializerSink &sink);
+    /*!
+     * Converts a markdown file and writes the HTML to a device or file.
      *
-     * **Note:** This is the only place that decoding and encoding of unicode
-     * takes place in Python-Markdown.  (All other code is unicode-in /
-     * unicode-out.)
+     * The input is mapped into memory and decoded as UTF-8 (a leading byte
+     * order mark is skipped) directly from the mapping; the output is
+     * encoded as UTF-8 and written in chunks as the blocks are serialized,
+     * see convert(const QString &, SerializerSink &).
      *
      * Keyword arguments:
      *
-     * * input: File object or path. Reads from stdin if `None`.
-     * * output: File object or path. Writes to stdout if `None`.
-     * * encoding: Encoding of input and output files. Defaults to utf-8.
+     * * input: Path of the source file.
+     * * output: Device opened for writing, or path of the file to write.
      *
+     * @exception pypp::IOError If a file cannot be opened or mapped, or
+     *                          the output cannot be written.
+     */
+    std::shared_ptr<Markdown> convertFile(const QString &input, QIODevice *output);
+    std::shared_ptr<Markdown> convertFile(const QString &input, const QString &output);
+    /*!
+     * Converts many documents in parallel.
+     *
+     * The documents are handed out one at a time to workers on a private
+     * thread pool, so a long document never holds up the short ones queued
+     * behind it.  All workers share this instance; see convert().
+     *
+     * Keyword arguments:
+     *
+     * * sources: Source texts.
+     * * callback: Receives each result as soon as it is ready.
+     * * stats: Filled with the throughput of the batch, if given.
+     * * threads: Number of workers, QThread::idealThreadCount() if 0.
+     *
+     * Returns the results in the order of the sources, unless a callback
+     * is given.  A document whose conversion or callback throws gives an
+     * empty result and is counted as a failure; the rest of the batch
+     * goes on.
+     */
+    QStringList convertBatch(const QStringList &sources, BatchStats *stats=nullptr, int threads=0);
+    void convertBatch(const QStringList &sources, const BatchCallback &callback, BatchStats *stats=nullptr, int threads=0);
+    /*!
+     * Like convertBatch(), reading the sources from UTF-8 encoded files.
+     * A file that cannot be read gives an empty result and is counted as
+     * a failure.
+     */
+    QStringList convertFiles(const QStringList &paths, BatchStats *stats=nullptr, int threads=0);
+    void convertFiles(const QStringList &paths, const BatchCallback &callback, BatchStats *stats=nullptr, int threads=0);
+
+private:
+    //! runs the preprocessors, the parser and the tree-processors
+    Element buildTree(const QString &source);
+    //! serializes the tree without the top-level tags and runs the
+    //! post-processors over the result, untrimmed
+    QString render(Element &root);
+    //! the same into a sink, a top-level block at a time when every
+    //! post-processor can take the blocks one by one
+    void render(Element &root, SerializerSink &sink);
+    QString postprocess(const QString &text);
+    /*!
+     * Fans `count` documents out to the workers; `source` reads the i-th
+     * one and returns false when it cannot be read.
      */
-    std::shared_ptr<Markdown> convertFile(/*input, output, encoding="utf-8"*/);
+    void runBatch(int count, const std::function<bool(int, QString &)> &source, const BatchCallback &callback, BatchStats *stats, int threads);
 
 public:
     QString doc_tag(void) const
@@ -257,8 +344,6 @@ public:
     OrderedDictPostProcessors postprocessors;
 
     QList<Extension::Ptr> registeredExtensions;
-    Reference references;
-	HtmlStash htmlStash;
 
     std::function<QString(Element &)> serializer;
 
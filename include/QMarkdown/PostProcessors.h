@@ -47,6 +47,13 @@ public:
      */
     virtual QString run(const QString &text) = 0;
 
+    /*!
+     * Whether run() may be handed the document one top-level block at a
+     * time, because it only changes text within a block.  The output of
+     * a conversion is only streamed while every postprocessor says so.
+     */
+    virtual bool blockwise(void) const;
+
 public:
     std::weak_ptr<Markdown> markdown;
 
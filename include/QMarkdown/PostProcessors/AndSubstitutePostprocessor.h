@@ -15,6 +15,7 @@ public:
     AndSubstitutePostprocessor(const std::weak_ptr<Markdown> &markdown_instance=std::weak_ptr<Markdown>());
 
     QString run(const QString &text);
+    bool blockwise(void) const;
 
 };
 
@@ -18,6 +18,7 @@ public:
      * Iterate over html stash and restore "safe" html.
      */
     QString run(const QString &text);
+    bool blockwise(void) const;
 
     /*!
      * Basic html escaping
@@ -23,6 +23,22 @@ public:
     {}
 };
 
+/*!
+ * Base of the preprocessors written against a plain list of lines: they
+ * implement the list run() only, and get a copy of the lines to work on.
+ */
+class LegacyPreProcessor : public PreProcessor
+{
+public:
+    using PreProcessor::PreProcessor;
+
+    void run(LineBuffer &lines)
+    {
+        lines = LineBuffer(this->run(lines.toList()));
+    }
+    virtual QStringList run(const QStringList &lines) = 0;
+};
+
 OrderedDictProcessors build_preprocessors(const std::shared_ptr<Markdown> &md_instance);
 
 } // end of namespace markdown
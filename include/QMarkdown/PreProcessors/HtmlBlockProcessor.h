@@ -18,21 +18,27 @@ public:
     HtmlBlockProcessor(const std::weak_ptr<Markdown> &markdown_instance);
     virtual ~HtmlBlockProcessor(void);
 
-    QStringList run(const QStringList &lines);
+    using PreProcessor::run;
+    void run(LineBuffer &lines);
 
 private:
+    /*!
+     * Stashes the html blocks of a whole document and returns the text
+     * with the remaining blocks.
+     */
+    QString process(const QString &text);
     std::tuple<QString, int, Attributes> get_left_tag(const QString &block);
-    int recursive_tagfind(const QString &ltag, const QString &rtag, int start_index, const QString &block);
+    /*!
+     * The end of the rtag closing the tag open at start_index, skipping
+     * nested pairs of ltag and rtag, or -1.
+     */
+    int tagfind(const QString &ltag, const QString &rtag, int start_index, const QString &block);
     std::tuple<QString, int> get_right_tag(const QString &left_tag, int left_index, const QString &block);
     bool equal_tags(const QString &left_tag, const QString &right_tag);
     bool is_oneliner(const QString &tag);
 
 private:
     QStringList        right_tag_patterns;
-    QString            attrs_pattern;
-    QString            left_tag_pattern;
-    QRegularExpression attrs_re;
-    QRegularExpression left_tag_re;
     bool               markdown_in_raw;
 
 };
@@ -16,7 +16,8 @@ public:
 
     virtual ~NormalizeWhitespace(void);
 
-    QStringList run(const QStringList &lines);
+    using PreProcessor::run;
+    void run(LineBuffer &lines);
 
 };
 
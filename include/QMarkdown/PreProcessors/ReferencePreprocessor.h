@@ -14,9 +14,13 @@ class ReferencePreprocessor : public PreProcessor
 public:
     ReferencePreprocessor(const std::weak_ptr<Markdown> &markdown_instance);
 
-    QStringList run(const QStringList &lines);
+    using PreProcessor::run;
+    void run(LineBuffer &lines);
 
 private:
+    //! cheap test before matching RE
+    bool may_be_reference(const QStringRef &line) const;
+
     const QString TITLE;
     const QRegularExpression RE;
     const QRegularExpression TITLE_RE;
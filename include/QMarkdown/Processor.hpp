@@ -9,6 +9,7 @@
 #define PROCESSOR_H_
 
 #include "odict.hpp"
+#include "LineBuffer.h"
 
 namespace markdown{
 
@@ -23,7 +24,20 @@ public:
 	virtual ~Processor(void)
 	{}
 
-    virtual QStringList run(const QStringList &lines) = 0;
+    /*!
+     * Edits the lines of the document in place.
+     */
+    virtual void run(LineBuffer &lines) = 0;
+    /*!
+     * Takes a list of lines and returns a (possibly modified) list, by way
+     * of the run() above.
+     */
+    QStringList run(const QStringList &lines)
+    {
+        LineBuffer buffer(lines);
+        this->run(buffer);
+        return buffer.toList();
+    }
 
 protected:
     std::weak_ptr<Markdown> markdown;
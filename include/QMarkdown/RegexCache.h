@@ -0,0 +1,56 @@
+#ifndef REGEXCACHE_H
+#define REGEXCACHE_H
+
+#include <QRegularExpression>
+#include <QString>
+
+namespace markdown{
+
+/*!
+ * Compiled regular expressions shared by the whole process.
+ *
+ * Processors and patterns look their expressions up here instead of
+ * compiling their own, so every Markdown instance, and every thread
+ * converting against one, matches with the same compiled (and once
+ * optimized, JIT compiled) pattern.  QRegularExpression is implicitly
+ * shared, so a lookup only copies a handle.
+ *
+ * Like the cache of Python's re module, it is bounded, so expressions
+ * that depend on a document, e.g. the abbreviations, don't pile up
+ * forever.  Once full, the oldest entry makes room; whoever still holds
+ * it keeps its compiled pattern.
+ */
+class RegexCache
+{
+public:
+    //! most patterns kept
+    static const int MAX_SIZE = 1024;
+
+    /*!
+     * The compiled expression for a pattern and options, compiled on the
+     * first request.  Safe to call from any thread.
+     */
+    static QRegularExpression compile(const QString &pattern, QRegularExpression::PatternOptions options=QRegularExpression::NoPatternOption);
+
+    /*!
+     * Compiles and, where PCRE supports it, JIT compiles every cached
+     * expression now instead of on its first match.
+     *
+     * Call it once at startup, after creating the Markdown instances that
+     * will be used, so the first conversion doesn't pay for compilation.
+     *
+     * Returns: the number of expressions warmed up.
+     */
+    static int warmUp();
+
+    //! number of cached expressions
+    static int size();
+
+private:
+    RegexCache();
+
+};
+
+} // end of namespace markdown
+
+#endif // REGEXCACHE_H
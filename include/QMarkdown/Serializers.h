@@ -8,14 +8,122 @@
 #ifndef SERIALIZERS_H_
 #define SERIALIZERS_H_
 
+#include <functional>
+
+#include <QIODevice>
+
 #include "ElementTree.hpp"
 
 namespace markdown{
 
+/*!
+ * Destination of the serializers.  Fragments are handed over as ranges of
+ * UTF-16 code units, so unescaped text is never copied on the way.
+ */
+class SerializerSink
+{
+public:
+    virtual ~SerializerSink();
+
+    virtual void write(const QChar *data, int size) = 0;
+    virtual void flush();
+
+    void write(const QString &text)
+    {
+        this->write(text.constData(), text.size());
+    }
+    void write(const char *ascii);
+
+};
+
+/*!
+ * Appends everything into one growable buffer.
+ */
+class StringSink : public SerializerSink
+{
+public:
+    explicit StringSink(QString &buffer, int sizeHint=0);
+
+    using SerializerSink::write;
+    void write(const QChar *data, int size);
+
+private:
+    QString &buffer;
+
+};
+
+/*!
+ * Hands the output over in chunks of about `chunkSize` code units.  A
+ * surrogate pair is never split between two chunks.
+ */
+class CallbackSink : public SerializerSink
+{
+public:
+    typedef std::function<void(const QString &)> Callback;
+
+    explicit CallbackSink(const Callback &callback, int chunkSize=16384);
+    ~CallbackSink();
+
+    using SerializerSink::write;
+    void write(const QChar *data, int size);
+    void flush();
+
+private:
+    Callback callback;
+    int chunkSize;
+    QString buffer;
+
+};
+
+/*!
+ * Writes UTF-8 encoded chunks to a device opened for writing.  Once a chunk
+ * cannot be written completely, the error is kept and the rest of the
+ * output is dropped.
+ */
+class DeviceSink : public CallbackSink
+{
+public:
+    explicit DeviceSink(QIODevice *device, int chunkSize=16384);
+    ~DeviceSink();
+
+    bool hasError() const;
+    QString errorString() const;
+
+private:
+    void writeChunk(const QString &chunk);
+
+    QIODevice *device;
+    bool failed;
+    QString error;
+
+};
+
+/*!
+ * Serialize a tree as HTML or XHTML.  Attribute names are written as
+ * they are, in lexical order.
+ */
+void to_html(SerializerSink &sink, const Element &element);
+
+void to_xhtml(SerializerSink &sink, const Element &element);
+
 QString to_html_string(const Element &element);
 
 QString to_xhtml_string(const Element &element);
 
+/*!
+ * Like the ones above, but qualified attribute names, "{uri}local",
+ * get a prefix declared on the root, the way ElementTree writes them.
+ * Markdown never creates such names, so only trees built by hand need
+ * these; they walk the tree once more to collect the names first.
+ */
+void to_namespaced_html(SerializerSink &sink, const Element &element);
+
+void to_namespaced_xhtml(SerializerSink &sink, const Element &element);
+
+QString to_namespaced_html_string(const Element &element);
+
+QString to_namespaced_xhtml_string(const Element &element);
+
 } // end of namespace markdown
 
 #endif // SERIALIZERS_H_
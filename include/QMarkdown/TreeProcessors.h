@@ -8,8 +8,12 @@
 #ifndef TREEPROCESSORS_H_
 #define TREEPROCESSORS_H_
 
+#include <functional>
 #include <tuple>
 
+#include <QList>
+#include <QVector>
+
 #include <boost/optional.hpp>
 
 #include "ElementTree.hpp"
@@ -40,12 +44,61 @@ public:
 public:
     std::weak_ptr<Markdown> markdown;
     typedef std::tuple<boost::optional<QString>, boost::optional<Element>> NodeItem;
-    typedef QMap<QString, NodeItem> StashNodes;
-    StashNodes stashed_nodes;
+    //! indexed by the id in the placeholder
+    typedef QVector<NodeItem> StashNodes;
 
 
 };
 
+/*!
+ * A Treeprocessor that doesn't walk the tree itself but registers hooks
+ * for the elements it is interested in.
+ *
+ * Consecutive visitors in the treeprocessors share a single depth-first
+ * walk: for every element, the enter hooks of all of them are called in
+ * order before its children are visited, the exit hooks after.  So
+ * whatever a visitor sees of an element and its children was already
+ * done by the hooks of the visitors before it.  Hooks may change the
+ * element they are called with, its text, tail and attributes and the
+ * texts and tails of its children, and enter hooks may add children to
+ * it.  A visitor that needs the whole tree to be finished by the ones
+ * before it has to be a plain Treeprocessor.
+ */
+class TreeVisitor : public TreeProcessor
+{
+public:
+    /*!
+     * Returns: whether to go on calling the hook for the descendants
+     * of the element.
+     */
+    typedef std::function<bool(const Element &)> EnterHook;
+    typedef std::function<void(const Element &)> ExitHook;
+
+    using TreeProcessor::TreeProcessor;
+
+    /*!
+     * Walks the tree with this visitor alone.
+     */
+    Element run(const Element &root);
+
+    //! called before the walk starts at root
+    virtual void begin(const Element &root);
+    //! called after the walk
+    virtual void end(const Element &root);
+
+protected:
+    //! hooks for one tag, or for every element if tag is empty
+    void onEnter(const QString &tag, const EnterHook &hook);
+    void onExit(const QString &tag, const ExitHook &hook);
+
+private:
+    friend class TreeWalker;
+
+    QList<QPair<QString, EnterHook>> enterHooks;
+    QList<QPair<QString, ExitHook>> exitHooks;
+
+};
+
 typedef OrderedDict<std::shared_ptr<TreeProcessor>> OrderedDictTreeProcessors;
 
 /*!
@@ -53,6 +106,14 @@ typedef OrderedDict<std::shared_ptr<TreeProcessor>> OrderedDictTreeProcessors;
  */
 OrderedDictTreeProcessors build_treeprocessors(const std::shared_ptr<Markdown> &md_instance);
 
+/*!
+ * Run treeprocessors against root in order, consecutive TreeVisitors in
+ * one walk.
+ *
+ * Returns: the root, or the one a treeprocessor replaced it with.
+ */
+Element run_treeprocessors(const QList<std::shared_ptr<TreeProcessor>> &treeprocessors, const Element &root);
+
 } // end of namespace markdown
 
 #endif // TREEPROCESSORS_H_
@@ -1,6 +1,9 @@
 #ifndef INLINEPROCESSOR_H
 #define INLINEPROCESSOR_H
 
+#include <QHash>
+#include <QVector>
+
 #include "../InlinePatterns.h"
 #include "../TreeProcessors.h"
 
@@ -18,10 +21,21 @@ public:
     ~InlineProcessor(void);
 
 private:
+    /*!
+     * Inline patterns of one run, the ones of the profile followed by the
+     * ones of the current document, and the characters that trigger them.
+     */
+    struct Dispatch
+    {
+        QList<std::shared_ptr<Pattern>> patterns;
+        QHash<ushort, QList<int>> trigger_table;
+        QList<int> untriggered_patterns;
+    };
+
     /*!
      * Generate a placeholder
      */
-    std::tuple<QString, QString> makePlaceholder(const QString &/*type*/);
+    std::tuple<QString, int> makePlaceholder(const QString &/*type*/);
 
     /*!
      * Extract id from data string, start from index
@@ -31,10 +45,11 @@ private:
      * * data: string
      * * index: index, from which we start search
      *
-     * Returns: placeholder id and string index, after the found placeholder.
+     * Returns: placeholder id (-1 if there is no placeholder at index) and
+     * string index, after the found placeholder.
      *
      */
-    std::tuple<boost::optional<QString>, int> findPlaceholder(const QString &data, int index);
+    std::tuple<int, int> findPlaceholder(const QString &data, int index);
 
     /*!
      * Add node to stash
@@ -42,10 +57,41 @@ private:
     QString stashNode(const Element &node, const QString &type);
     QString stashNode(const QString &node, const QString &type);
 
+    /*!
+     * Build the trigger character table from the current inline patterns.
+     *
+     * The patterns can change between documents (e.g. abbreviations),
+     * so the table is rebuilt at the start of every run.
+     */
+    Dispatch buildDispatch(void) const;
+
+    /*!
+     * Scan data once, left to right, and flag every inline pattern
+     * whose trigger characters occur in it.
+     *
+     * Returns: one flag per inline pattern.
+     *
+     */
+    QVector<bool> scanTriggers(const Dispatch &dispatch, const QString &data) const;
+
+    /*!
+     * Find the first trigger character of a pattern in data,
+     * start from index.
+     *
+     * Returns: index of the trigger character or -1.
+     *
+     */
+    int findTrigger(const QString &triggers, const QString &data, int index) const;
+
     /*!
      * Process string with inline patterns and replace it
      * with placeholders
      *
+     * The patterns are still applied one after another, in priority
+     * order, each over the whole text; the trigger scan only skips the
+     * ones that cannot match.  Every match is spliced into a copy of the
+     * text, so a text with n matches is copied n times.
+     *
      * Keyword arguments:
      *
      * * data: A line of Markdown text
@@ -54,7 +100,7 @@ private:
      * Returns: String with placeholders.
      *
      */
-    QString handleInline(const QString &data, int patternIndex = 0);
+    QString handleInline(const Dispatch &dispatch, const QString &data, int patternIndex = 0);
 
     /*!
      * Process placeholders in Element.text or Element.tail
@@ -94,11 +140,12 @@ private:
      * * pattern: the pattern to be checked
      * * patternIndex: index of current pattern
      * * startIndex: string index, from which we start searching
+     * * scanState: what a scanning pattern kept from its last scan of data
      *
      * Returns: String with placeholders instead of ElementTree elements.
      *
      */
-    std::tuple<QString, bool, int> applyPattern(std::shared_ptr<Pattern> pattern, const QString &data, int patternIndex, int startIndex=0);
+    std::tuple<QString, bool, int> applyPattern(const Dispatch &dispatch, std::shared_ptr<Pattern> pattern, const QString &data, int patternIndex, int startIndex, Pattern::ScanStatePtr &scanState);
 
     /*!
      * Apply inline patterns to a parsed Markdown tree.
@@ -121,9 +168,6 @@ private:
 
 private:
     QString placeholder_prefix;
-    QString placeholder_suffix;
-    unsigned int placeholder_length;
-    QRegularExpression placeholder_re;
 
 };
 
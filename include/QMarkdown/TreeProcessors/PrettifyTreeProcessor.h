@@ -9,22 +9,34 @@ namespace markdown
 /*!
  * Add linebreaks to the html document.
  */
-class PrettifyTreeProcessor : public TreeProcessor
+class PrettifyTreeProcessor : public TreeVisitor
 {
 public:
-    using TreeProcessor::TreeProcessor;
+    PrettifyTreeProcessor(const std::weak_ptr<Markdown> &md_instance);
 
 private:
     /*!
-     * Recursively add linebreaks to ElementTree children.
+     * Add linebreaks to a block level element and go on with its
+     * children, unless it holds code or inline content.
      */
-    void prettifyETree(const Element &elem);
+    bool prettifyElement(const Element &elem);
+
+    /*!
+     * Do <br />'s seperately as they are often in the middle of
+     * inline content and missed by prettifyElement.
+     */
+    bool prettifyBreak(const Element &br);
+
+    /*!
+     * Clean up extra empty lines at end of code blocks.
+     */
+    bool prettifyCode(const Element &pre);
 
 public:
     /*!
      * Add linebreaks to ElementTree root object.
      */
-    Element run(const Element &root);
+    void begin(const Element &root);
 
 };
 
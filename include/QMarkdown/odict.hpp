@@ -11,10 +11,9 @@
 #include <memory>
 #include <stdexcept>
 
+#include <QHash>
 #include <QList>
-#include <QMap>
-
-#include <boost/range/algorithm_ext/erase.hpp>
+#include <QStringList>
 
 #include "pypp.hpp"
 
@@ -25,6 +24,11 @@ namespace markdown{
  *
  * Copied from Django's SortedDict with some modifications.
  *
+ * Keys and values are kept in two parallel lists, with a hash from key to
+ * position, so access by index or by key takes constant time and toList()
+ * hands out the value list itself (implicitly shared) instead of building
+ * a new one.  Only reordering rebuilds the hash.
+ *
  */
 template <class T>
 class OrderedDict
@@ -37,83 +41,98 @@ public:
 
 public:
     OrderedDict() :
-        _dict(), _keyOrder()
+        _keyOrder(), _values(), _index(), _version(0)
     {}
     OrderedDict(const OrderedDict &copy) :
-        _dict(copy._dict), _keyOrder(copy._keyOrder)
+        _keyOrder(copy._keyOrder), _values(copy._values), _index(copy._index), _version(copy._version)
     {}
     OrderedDict &operator =(const OrderedDict &rhs)
     {
-        this->_dict     = rhs._dict;
         this->_keyOrder = rhs._keyOrder;
+        this->_values   = rhs._values;
+        this->_index    = rhs._index;
+        ++this->_version;
         return *this;
     }
 
+    /*!
+     * A number that changes whenever the dictionary may have changed, so
+     * whatever is derived from its contents can be cached against it.
+     * Handing out a non-const reference counts as a change.
+     */
+    quint64 version() const
+    {
+        return this->_version;
+    }
+
     /*!
      * Returns the value of the item at the given zero-based index.
      */
     ValueType &at(int i)
     {
-        if ( i < 0 ) {
-            i = this->_dict.size() + i;
-        }
-        return this->_dict[this->_keyOrder.at(i)];
+        ++this->_version;
+        return this->_values[this->normalize_index(i)];
     }
     const ValueType at(int i) const
     {
-        if ( i < 0 ) {
-            i = this->_dict.size() + i;
-        }
-        return this->_dict[this->_keyOrder.at(i)];
+        return this->_values.at(this->normalize_index(i));
     }
     const ValueType operator [](int i) const
     {
-        if ( i < 0 ) {
-            i = this->_dict.size() + i;
-        }
-        return this->_dict[this->_keyOrder.at(i)];
+        return this->_values.at(this->normalize_index(i));
     }
     ValueType &operator [](const QString &key)
     {
-        if ( ! this->exists(key) ) {
+        int i = this->index(key);
+        if ( i == -1 ) {
             this->append(key, ValueType());
+            i = this->size() - 1;
         }
-        return this->_dict[key];
+        ++this->_version;
+        return this->_values[i];
     }
-    const ValueType &operator [](const QString &key) const
+    const ValueType operator [](const QString &key) const
     {
-        return this->_dict[key];
+        int i = this->index(key);
+        if ( i == -1 ) {
+            return ValueType();
+        }
+        return this->_values.at(i);
     }
-    bool exists(const QString &key)
+    bool exists(const QString &key) const
     {
-        return this->_dict.contains(key);
+        return this->_index.contains(key);
     }
     /*!
      * Return the index of a given key.
      */
-    int index(const QString &key)
+    int index(const QString &key) const
     {
-        if ( ! this->_keyOrder.contains(key) ) {
-            return -1;
-        }
-        return this->_keyOrder.indexOf(key);
+        return this->_index.value(key, -1);
     }
     int size(void) const
     {
-        return this->_dict.size();
+        return this->_values.size();
     }
     void clear(void)
     {
-        this->_dict.clear();
         this->_keyOrder.clear();
+        this->_values.clear();
+        this->_index.clear();
+        ++this->_version;
     }
 
     void append(const QString &key, const ValueType &val)
     {
-        if ( this->index(key) == -1 ) {
+        int i = this->index(key);
+        if ( i == -1 ) {
+            this->_index.insert(key, this->_keyOrder.size());
             this->_keyOrder.push_back(key);
+            this->_values.push_back(val);
+        } else {
+            this->_values[i] = val;
         }
-        this->_dict[key] = val;
+        ++this->_version;
     }
     /*!
      * Insert by key location.
@@ -132,49 +151,65 @@ public:
      */
     void insert(int index, const QString &key, const ValueType &val)
     {
-        if ( this->exists(key) ) {
-            boost::range::remove_erase(this->_keyOrder, key);
-        }
+        int size = this->size();
         if ( index < 0 ) {
-            index = this->_dict.size() + index;
+            index = size + index;
         }
         if ( index < 0 ) {
             throw pypp::IndexError();
         }
-        this->_keyOrder.insert(std::min(index, this->_keyOrder.size()), key);
-        this->append(key, val);
+        int n = this->index(key);
+        if ( n != -1 ) {
+            this->_keyOrder.removeAt(n);
+            this->_values.removeAt(n);
+        }
+        index = std::min(index, this->_keyOrder.size());
+        this->_keyOrder.insert(index, key);
+        this->_values.insert(index, val);
+        this->reindex();
     }
     /*!
      * Change location of an existing item.
+     *
+     * @exception ValueError If there is no such key.
      */
     void link(const QString &key, const QString &location)
     {
         int n = this->index(key);
-        if ( n < 0 ) {
-            n = this->_dict.size() + n;
+        if ( n == -1 ) {
+            throw pypp::ValueError(("No such key: \"" + key + "\"").toStdString());
         }
-        int counter = 0;
-        boost::range::remove_erase_if(this->_keyOrder, [&](const QString &) -> bool{ bool result = counter == n; ++counter; return result;  });
+        ValueType value = this->_values.at(n);
+        this->_keyOrder.removeAt(n);
+        this->_values.removeAt(n);
+        this->reindex();
+        int i;
         try {
-            int i = this->index_for_location(location);
-            if ( i < 0 ) {
-                this->_keyOrder.push_back(key);
-            } else {
-                this->_keyOrder.insert(std::min(i, this->_keyOrder.size()), key);
-            }
+            i = this->index_for_location(location);
         } catch (const std::invalid_argument &) {
             //! restore to prevent data loss and reraise
+            i = n;
+            this->_keyOrder.insert(i, key);
+            this->_values.insert(i, value);
+            this->reindex();
+            throw;
         }
-
+        if ( i < 0 ) {
+            i = this->_keyOrder.size();
+        }
+        i = std::min(i, this->_keyOrder.size());
+        this->_keyOrder.insert(i, key);
+        this->_values.insert(i, value);
+        this->reindex();
     }
 
+    /*!
+     * The values in order.  Shares the dictionary's own list, so it is
+     * cheap to take and stays valid whatever happens to the dictionary.
+     */
     Sequence toList(void) const
     {
-        Sequence result;
-        for ( const QString &key : this->_keyOrder ) {
-            result.push_back(this->_dict[key]);
-        }
-        return result;
+        return this->_values;
     }
 
     QStringList keys() const
@@ -188,8 +223,9 @@ public:
     Pairs items() const
     {
         Pairs result;
-        for ( const QString &key : this->_keyOrder ) {
-            result.append(qMakePair(key, this->_dict[key]));
+        result.reserve(this->size());
+        for ( int i = 0; i < this->size(); ++i ) {
+            result.append(qMakePair(this->_keyOrder.at(i), this->_values.at(i)));
         }
         return result;
     }
@@ -199,7 +235,7 @@ private:
     /*!
      * Return index or None for a given location.
      */
-    int index_for_location(const QString &location)
+    int index_for_location(const QString &location) const
     {
         int i = 0;
         if ( location == "_begin" ) {
@@ -209,7 +245,7 @@ private:
         } else if ( location.startsWith("<") || location.startsWith(">") ) {
             i = this->index(location.mid(1));
             if ( location.startsWith(">") ) {
-                if ( i >= this->_dict.size() ) {
+                if ( i >= this->size() ) {
                     //! last item
                     i = -1;
                 } else {
@@ -223,9 +259,30 @@ private:
         return i;
     }
 
+    int normalize_index(int i) const
+    {
+        if ( i < 0 ) {
+            i = this->size() + i;
+        }
+        return i;
+    }
+
+    //! positions after an insertion or removal
+    void reindex()
+    {
+        this->_index.clear();
+        this->_index.reserve(this->_keyOrder.size());
+        for ( int i = 0; i < this->_keyOrder.size(); ++i ) {
+            this->_index.insert(this->_keyOrder.at(i), i);
+        }
+        ++this->_version;
+    }
+
 private:
-    QMap<QString, ValueType> _dict;
     QStringList _keyOrder;
+    Sequence _values;
+    QHash<QString, int> _index;
+    quint64 _version;
 
 };
 
@@ -62,6 +62,18 @@ public:
     using StandardError::StandardError;
 };
 
+class EnvironmentError : public StandardError
+{
+public:
+    using StandardError::StandardError;
+};
+
+class IOError : public EnvironmentError
+{
+public:
+    using EnvironmentError::EnvironmentError;
+};
+
 } // namespace pypp
 
 #endif // EXCEPTIONS_HPP
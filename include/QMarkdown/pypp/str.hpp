@@ -58,7 +58,8 @@ inline pypp::str expandtabs(const pypp::str &in, int tabsize)
 
 inline QStringList split(const pypp::str &in)
 {
-    return in.split(QRegularExpression("\\s"));
+    static const QRegularExpression whitespace("\\s");
+    return in.split(whitespace);
 }
 
 inline pypp::str lstrip(const pypp::str &in)
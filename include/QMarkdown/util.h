@@ -30,6 +30,19 @@ static const QString AMP_SUBSTITUTE;
 
 static bool isBlockLevel(const QString &tag);
 
+/*!
+ * The inline placeholder for a stash id, e.g. STX "klzzwxh:42" ETX.  Ids
+ * are written with as many digits as they need.
+ */
+static QString inlinePlaceholder(int id);
+/*!
+ * Reads the inline placeholder starting at `index` of `text`.
+ *
+ * Returns: its id and, through `end`, the index after it; or -1 if there
+ * is no well-formed placeholder at `index`.
+ */
+static int inlinePlaceholderId(const QString &text, int index, int *end=nullptr);
+
 private:
 	util(void);
     util(const util &);
@@ -50,7 +63,15 @@ public:
     QString store(const QString &html, bool safe=false);
 	void reset(void);
 
-    QString get_placeholder(int key);
+    QString get_placeholder(int key) const;
+    /*!
+     * Reads the placeholder of a stored block starting at `index` of
+     * `text`, as get_placeholder() writes it.
+     *
+     * Returns: its key and, through `end`, the index after it; or -1 if
+     * there is no such placeholder at `index`.
+     */
+    int placeholderKey(const QString &text, int index, int *end=nullptr) const;
 
 public:
     int   html_counter;
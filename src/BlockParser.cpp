@@ -7,43 +7,230 @@
 
 #include "BlockParser.h"
 
+#include <QMutexLocker>
+
+#include "Context.h"
 #include "Markdown.h"
 
 namespace markdown{
 
+namespace {
+
+//! Points the context at a list of scheduled frames for as long as it
+//! lives, so a processor that throws does not leave it dangling.
+class ScheduleScope
+{
+public:
+    ScheduleScope(Context &context, BlockFrames *scheduled) :
+        context(context),
+        outer(context.scheduled)
+    {
+        context.scheduled = scheduled;
+    }
+    ~ScheduleScope()
+    {
+        this->context.scheduled = this->outer;
+    }
+
+private:
+    ScheduleScope(const ScheduleScope &);
+    ScheduleScope &operator =(const ScheduleScope &);
+
+    Context &context;
+    BlockFrames *outer;
+
+};
+
+}
+
 BlockParser::BlockParser(const std::weak_ptr<Markdown> &markdown) :
 	markdown(markdown),
-    blockprocessors(), root()
+    blockprocessors(),
+    dispatch_mutex(),
+    dispatch_cache()
 {}
 
 ElementTree BlockParser::parseDocument(const QStringList &lines)
+{
+    return this->parseDocument(LineBuffer(lines));
+}
+
+ElementTree BlockParser::parseDocument(const LineBuffer &lines)
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
 
-    this->root = ElementTree(createElement(markdown->doc_tag()));
-    Element tmp = this->root.getroot();
-    this->parseChunk(tmp, lines.join("\n"));
-	return this->root;
+    Context &context = Context::current();
+    context.root = ElementTree(createElement(markdown->doc_tag()));
+    Element tmp = context.root.getroot();
+
+    //! Cut the blocks straight out of the lines, the same way splitting
+    //! the joined text on "\n\n" would.
+    QStringList blocks;
+    int begin = 0;
+    for ( int i = 0; i+2 < lines.size(); ++i ) {
+        if ( lines.at(i+1).isEmpty() ) {
+            blocks.append(lines.join(begin, i+1));
+            begin = i + 2;
+            ++i;
+        }
+    }
+    blocks.append(lines.join(begin, lines.size()));
+    this->parseBlocks(tmp, blocks);
+	return context.root;
 }
 
 void BlockParser::parseChunk(const Element &parent, const QString &text)
 {
-    QStringList buffer = text.split(QRegularExpression("\n\n"));
+    QStringList buffer = text.split("\n\n");
 	this->parseBlocks(parent, buffer);
 }
 
 void BlockParser::parseBlocks(const Element &parent, QStringList &blocks)
 {
-	while ( blocks.size() > 0 ) {
-        for (OrderedDictBlockProcessors::ValueType processor : this->blockprocessors.toList()) {
+    std::shared_ptr<BlockFrame> frame = std::make_shared<BlockFrame>();
+    frame->parent = parent;
+    frame->blocks.swap(blocks);
+    frame->entered = false;
+
+    BlockFrames &frames = Context::current().frames;
+    int base = frames.size();
+    frames.append(frame);
+    this->drain(base);
+}
+
+void BlockParser::scheduleBlocks(const Element &parent, const QStringList &blocks, const QString &state)
+{
+    std::shared_ptr<BlockFrame> frame = std::make_shared<BlockFrame>();
+    frame->parent = parent;
+    frame->blocks = blocks;
+    frame->state = state;
+    frame->entered = false;
+    this->enqueue(frame);
+}
+
+void BlockParser::scheduleChunk(const Element &parent, const QString &text, const QString &state)
+{
+    this->scheduleBlocks(parent, text.split("\n\n"), state);
+}
+
+void BlockParser::schedule(const std::function<void()> &step)
+{
+    std::shared_ptr<BlockFrame> frame = std::make_shared<BlockFrame>();
+    frame->entered = false;
+    frame->step = step;
+    this->enqueue(frame);
+}
+
+void BlockParser::enqueue(const std::shared_ptr<BlockFrame> &frame)
+{
+    Context &context = Context::current();
+    if ( context.scheduled != nullptr ) {
+        context.scheduled->append(frame);
+        return;
+    }
+    //! nothing is being parsed, so there is nothing to wait for
+    int base = context.frames.size();
+    context.frames.append(frame);
+    this->drain(base);
+}
+
+void BlockParser::drain(int base)
+{
+    std::shared_ptr<const Dispatch> dispatch = this->dispatch();
+    Context &context = Context::current();
+    BlockFrames &frames = context.frames;
+    while ( frames.size() > base ) {
+        std::shared_ptr<BlockFrame> frame = frames.last();
+        if ( frame->step ) {
+            frames.removeLast();
+            this->collect(frame->step);
+            continue;
+        }
+        if ( ! frame->entered ) {
+            frame->entered = true;
+            if ( ! frame->state.isEmpty() ) {
+                context.state.set(frame->state);
+            }
+        }
+        if ( frame->blocks.isEmpty() ) {
+            if ( ! frame->state.isEmpty() ) {
+                context.state.reset();
+            }
+            frames.removeLast();
+            continue;
+        }
+
+        //! only processors whose prefilter passes are tested at all
+        const Element &parent = frame->parent;
+        QStringList &blocks = frame->blocks;
+        QString block = blocks.front();
+        LineIndex shape = this->lines(block);
+        for ( int i = 0; i < dispatch->processors.size(); ++i ) {
+            if ( ! dispatch->prefilters.at(i).accepts(shape) ) {
+                continue;
+            }
+            const std::shared_ptr<BlockProcessor> &processor = dispatch->processors.at(i);
             if ( processor->test(parent, blocks.front()) ) {
-                if ( processor->run(parent, blocks) ) {
+                bool done = false;
+                this->collect([&]() { done = processor->run(parent, blocks); });
+                if ( done ) {
                     //! run returns True
                     break;
                 }
-			}
-		}
-	}
+                //! a processor that declined may still have replaced the block
+                if ( blocks.isEmpty() ) {
+                    break;
+                }
+                if ( ! shape.indexes(blocks.front()) ) {
+                    block = blocks.front();
+                    shape = this->lines(block);
+                }
+            }
+        }
+    }
+}
+
+void BlockParser::collect(const std::function<void()> &f)
+{
+    Context &context = Context::current();
+    BlockFrames scheduled;
+    {
+        ScheduleScope scope(context, &scheduled);
+        f();
+    }
+    //! the first one scheduled goes on top
+    for ( int i = scheduled.size()-1; i >= 0; --i ) {
+        context.frames.append(scheduled.at(i));
+    }
+}
+
+std::shared_ptr<const BlockParser::Dispatch> BlockParser::dispatch() const
+{
+    QMutexLocker locker(&this->dispatch_mutex);
+    if ( ! this->dispatch_cache || this->dispatch_cache->version != this->blockprocessors.version() ) {
+        std::shared_ptr<Dispatch> dispatch = std::make_shared<Dispatch>();
+        dispatch->version = this->blockprocessors.version();
+        dispatch->processors = this->blockprocessors.toList();
+        for ( const std::shared_ptr<BlockProcessor> &processor : dispatch->processors ) {
+            dispatch->prefilters.append(processor->prefilter());
+        }
+        this->dispatch_cache = dispatch;
+    }
+    return this->dispatch_cache;
+}
+
+State &BlockParser::state() const
+{
+    return Context::current().state;
+}
+
+LineIndex BlockParser::lines(const QString &block) const
+{
+    LineIndex &lines = Context::current().lines;
+    if ( ! lines.indexes(block) ) {
+        lines = LineIndex(block);
+    }
+    return lines;
 }
 
 } // end of namespace markdown
@@ -7,6 +7,8 @@
 
 #include "BlockProcessors.h"
 
+#include <limits>
+
 #include <QDebug>
 #include <QRegularExpression>
 #include <QSet>
@@ -28,8 +30,116 @@
 
 namespace markdown{
 
+namespace {
+
+inline void insert_ascii(quint64 *mask, ushort ch)
+{
+    mask[ch >> 6] |= quint64(1) << (ch & 63);
+}
+
+inline bool intersects(const quint64 *lhs, const quint64 *rhs)
+{
+    return ( lhs[0] & rhs[0] ) != 0 || ( lhs[1] & rhs[1] ) != 0;
+}
+
+}
+
+BlockPrefilter::BlockPrefilter() :
+    clauses()
+{}
+
+BlockPrefilter BlockPrefilter::start(const QString &chars, int minIndent, int maxIndent)
+{
+    BlockPrefilter result;
+    result.clauses.append(clause(Start, chars, minIndent, maxIndent));
+    return result;
+}
+
+BlockPrefilter BlockPrefilter::indented(int minIndent)
+{
+    return start(QString(), minIndent, std::numeric_limits<int>::max());
+}
+
+BlockPrefilter BlockPrefilter::lineStart(const QString &chars, int maxIndent)
+{
+    BlockPrefilter result;
+    result.clauses.append(clause(LineStart, chars, 0, maxIndent));
+    return result;
+}
+
+BlockPrefilter BlockPrefilter::contains(const QString &chars)
+{
+    BlockPrefilter result;
+    result.clauses.append(clause(Contains, chars, 0, 0));
+    return result;
+}
+
+BlockPrefilter BlockPrefilter::operator |(const BlockPrefilter &other) const
+{
+    //! no condition on either side leaves no condition
+    if ( this->isEmpty() || other.isEmpty() ) {
+        return BlockPrefilter();
+    }
+    BlockPrefilter result(*this);
+    result.clauses.append(other.clauses);
+    return result;
+}
+
+bool BlockPrefilter::isEmpty() const
+{
+    return this->clauses.isEmpty();
+}
+
+bool BlockPrefilter::accepts(const Shape &shape) const
+{
+    if ( this->clauses.isEmpty() ) {
+        return true;
+    }
+    for ( const Clause &clause : this->clauses ) {
+        switch ( clause.kind ) {
+        case Start:
+            if ( shape.at(0).indent >= clause.minIndent && shape.at(0).indent <= clause.maxIndent
+                 && ( clause.chars.isEmpty() || clause.chars.contains(shape.at(0).first) ) ) {
+                return true;
+            }
+            break;
+        case LineStart:
+            if ( ! clause.ascii || clause.maxIndent > 3 ) {
+                return true;
+            }
+            for ( int i = 0; i <= clause.maxIndent; ++i ) {
+                if ( intersects(shape.lineStarts[i], clause.mask) ) {
+                    return true;
+                }
+            }
+            break;
+        case Contains:
+            if ( ( ! clause.ascii && shape.nonAscii ) || intersects(shape.chars, clause.mask) ) {
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+BlockPrefilter::Clause BlockPrefilter::clause(Kind kind, const QString &chars, int minIndent, int maxIndent)
+{
+    Clause result = {kind, minIndent, maxIndent, chars, {0, 0}, true};
+    for ( const QChar &ch : chars ) {
+        if ( ch.unicode() < 128 ) {
+            insert_ascii(result.mask, ch.unicode());
+        } else {
+            result.ascii = false;
+        }
+    }
+    return result;
+}
+
+
 BlockProcessor::BlockProcessor(const std::weak_ptr<BlockParser> &parser) :
-    parser(parser), tab_length(parser.lock()->markdown.lock()->tab_length())
+    parser(parser), tab_length(parser.lock()->markdown.lock()->tab_length()),
+    block_prefilter()
 {}
 
 BlockProcessor::~BlockProcessor()
@@ -45,52 +155,61 @@ Element BlockProcessor::lastChild(const Element &parent)
 
 std::tuple<QString, QString> BlockProcessor::detab(const QString &text)
 {
-    QStringList newtext, lines = text.split(QRegularExpression("\n"));
-    for ( const QString &line : lines ) {
-        if ( line.startsWith(QString(this->tab_length, ' ')) ) {
-            newtext.push_back(line.mid(this->tab_length));
-        } else if ( line.trimmed().isEmpty() ) {
-            newtext.push_back(QString());
-		} else {
-			break;
-		}
-	}
-    QStringList resultLines;
-    int counter = 0;
-    for ( QStringList::const_iterator it = lines.begin(); it != lines.end(); ++it, ++counter ) {
-		if ( counter < newtext.size() ) {
-			continue;
-		}
-		resultLines.push_back(*it);
+    const LineIndex lines = this->parser.lock()->lines(text);
+    QString newtext;
+    newtext.reserve(text.size());
+    int i = 0;
+    for ( ; i < lines.size(); ++i ) {
+        const LineIndex::Line &line = lines.at(i);
+        if ( line.indent < this->tab_length && ! line.blank ) {
+            break;
+        }
+        if ( i > 0 ) {
+            newtext.append('\n');
+        }
+        if ( line.indent >= this->tab_length ) {
+            newtext.append(lines.line(i).mid(this->tab_length));
+        }
     }
-    return std::make_tuple(newtext.join("\n"), resultLines.join("\n"));
+    return std::make_tuple(newtext, lines.join(i, lines.size()));
 }
 
 QString BlockProcessor::looseDetab(const QString &text, unsigned int level)
 {
-	const unsigned int length = this->tab_length*level;
-    QStringList lines = text.split(QRegularExpression("\n"));
+    const int length = this->tab_length*level;
+    const LineIndex lines = this->parser.lock()->lines(text);
+    QString result;
+    result.reserve(text.size());
     for ( int i = 0; i < lines.size(); ++i ) {
-        if ( lines[i].startsWith(QString(length, ' ')) ) {
-            lines[i] = lines[i].mid(length);
-		}
-	}
-    return lines.join("\n");
+        if ( i > 0 ) {
+            result.append('\n');
+        }
+        result.append(lines.line(i).mid(lines.at(i).indent >= length ? length : 0));
+    }
+    return result;
 }
 
 
+//! Wrap a built-in processor and register the blocks worth testing it on.
+static std::shared_ptr<BlockProcessor> filtered(BlockProcessor *processor, const BlockPrefilter &prefilter)
+{
+    processor->setPrefilter(prefilter);
+    return std::shared_ptr<BlockProcessor>(processor);
+}
+
 std::shared_ptr<BlockParser> build_block_parser(const std::shared_ptr<Markdown> &md_instance)
 {
+    const int tab_length = md_instance->tab_length();
     std::shared_ptr<BlockParser> parser(new BlockParser(md_instance));
-    parser->blockprocessors.append("empty", std::shared_ptr<BlockProcessor>(new EmptyBlockProcessor(parser)));
-    parser->blockprocessors.append("indent", std::shared_ptr<BlockProcessor>(new ListIndentProcessor(parser)));
-    parser->blockprocessors.append("code", std::shared_ptr<BlockProcessor>(new CodeBlockProcessor(parser)));
-    parser->blockprocessors.append("hashheader", std::shared_ptr<BlockProcessor>(new HashHeaderProcessor(parser)));
-    parser->blockprocessors.append("setextheader", std::shared_ptr<BlockProcessor>(new SetextHeaderProcessor(parser)));
-    parser->blockprocessors.append("hr", std::shared_ptr<BlockProcessor>(new HRProcessor(parser)));
-    parser->blockprocessors.append("olist", std::shared_ptr<BlockProcessor>(new OListProcessor(parser)));
-    parser->blockprocessors.append("ulist", std::shared_ptr<BlockProcessor>(new UListProcessor(parser)));
-    parser->blockprocessors.append("quote", std::shared_ptr<BlockProcessor>(new BlockQuoteProcessor(parser)));
+    parser->blockprocessors.append("empty", filtered(new EmptyBlockProcessor(parser), BlockPrefilter::start("\n")));
+    parser->blockprocessors.append("indent", filtered(new ListIndentProcessor(parser), BlockPrefilter::indented(tab_length)));
+    parser->blockprocessors.append("code", filtered(new CodeBlockProcessor(parser), BlockPrefilter::indented(tab_length)));
+    parser->blockprocessors.append("hashheader", filtered(new HashHeaderProcessor(parser), BlockPrefilter::lineStart("#")));
+    parser->blockprocessors.append("setextheader", filtered(new SetextHeaderProcessor(parser), BlockPrefilter::lineStart("=-")));
+    parser->blockprocessors.append("hr", filtered(new HRProcessor(parser), BlockPrefilter::lineStart("-_*", 3)));
+    parser->blockprocessors.append("olist", filtered(new OListProcessor(parser), BlockPrefilter::start("0123456789", 0, tab_length-1)));
+    parser->blockprocessors.append("ulist", filtered(new UListProcessor(parser), BlockPrefilter::start("*+-", 0, tab_length-1)));
+    parser->blockprocessors.append("quote", filtered(new BlockQuoteProcessor(parser), BlockPrefilter::lineStart(">", 3)));
     parser->blockprocessors.append("paragraph", std::shared_ptr<BlockProcessor>(new ParagraphProcessor(parser)));
 	return parser;
 }
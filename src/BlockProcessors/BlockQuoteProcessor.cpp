@@ -1,18 +1,19 @@
 #include "BlockProcessors/BlockQuoteProcessor.h"
 
 #include "BlockParser.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
 BlockQuoteProcessor::BlockQuoteProcessor(const std::weak_ptr<BlockParser> &parser) :
         BlockProcessor(parser),
-        RE("(^|\\n)[ ]{0,3}>[ ]?(.*)")
+        RE(RegexCache::compile("(^|\\n)[ ]{0,3}>[ ]?(.*)"))
     {}
 
 bool BlockQuoteProcessor::test(const Element &, const QString &block)
 {
-    return this->RE.match(block).hasMatch();
+    return this->parser.lock()->lines(block).find(LineIndex::Quote, 3) != -1;
 }
 
 bool BlockQuoteProcessor::run(const Element &parent, QStringList &blocks)
@@ -21,36 +22,58 @@ bool BlockQuoteProcessor::run(const Element &parent, QStringList &blocks)
 
     QString block = blocks.front();
     blocks.pop_front();
-    QRegularExpressionMatch m = this->RE.match(block);
-    if ( m.hasMatch() ) {
-        QString before = block.left(m.capturedStart());  //!< Lines before blockquote
-        //! Pass lines before blockquote in recursively for parsing forst.
-        QStringList new_blocks = {before};
-        parser->parseBlocks(parent, new_blocks);
-        //! Remove ``> `` from begining of each line.
-        QString after = block.mid(m.capturedStart());
-        QStringList lines = after.split("\n");
-        QStringList new_lines;
-        for ( const QString &line : lines ) {
-            new_lines.push_back(this->clean(line));
+    const LineIndex lines = parser->lines(block);
+    int first = lines.find(LineIndex::Quote, 3);
+    if ( first != -1 ) {
+        //! Lines before blockquote, without the newline that ends them
+        QString before = block.left(qMax(lines.at(first).begin-1, 0));
+        //! Pass lines before blockquote in for parsing first.
+        parser->scheduleBlocks(parent, {before});
+        //! Remove ``> `` from begining of each line.  The newline before
+        //! the blockquote is kept as an empty first line.
+        QString cleaned;
+        cleaned.reserve(block.size()-lines.at(first).begin+1);
+        if ( first > 0 ) {
+            cleaned.append('\n');
         }
-        block = new_lines.join("\n");
+        for ( int i = first; i < lines.size(); ++i ) {
+            if ( i > first ) {
+                cleaned.append('\n');
+            }
+            cleaned.append(this->clean(lines, i));
+        }
+        block = cleaned;
     }
-    Element sibling = this->lastChild(parent);
-    Element quote = Element();
-    if ( sibling && sibling->tag == "blockquote" ) {
-        //! Previous block was a blockquote so set that as this blocks parent
-        quote = sibling;
+    //! Whether to continue the last blockquote depends on what the lines
+    //! before turn into, so look once they're parsed.
+    parser->schedule([this, parser, parent, block]() {
+        Element sibling = this->lastChild(parent);
+        Element quote = Element();
+        if ( sibling && sibling->tag == "blockquote" ) {
+            //! Previous block was a blockquote so set that as this blocks parent
+            quote = sibling;
+        } else {
+            //! This is a new blockquote. Create a new parent element.
+            quote = createSubElement(parent, "blockquote");
+        }
+        //! Parse block with blockquote as parent.
+        //! change parser state so blockquotes embedded in lists use p tags
+        parser->scheduleChunk(quote, block, "blockquote");
+    });
+    return true;
+}
+
+QString BlockQuoteProcessor::clean(const LineIndex &lines, int index) const
+{
+    QStringRef line = lines.line(index);
+    const LineIndex::Line &info = lines.at(index);
+    if ( line.trimmed() == ">" ) {
+        return QString();
+    } else if ( info.marker == LineIndex::Quote && info.indent <= 3 ) {
+        return lines.mid(index, info.content);
     } else {
-        //! This is a new blockquote. Create a new parent element.
-        quote = createSubElement(parent, "blockquote");
+        return line.toString();
     }
-    //! Recursively parse block with blockquote as parent.
-    //! change parser state so blockquotes embedded in lists use p tags
-    parser->state.set("blockquote");
-    parser->parseChunk(quote, block);
-    parser->state.reset();
-    return true;
 }
 
 QString BlockQuoteProcessor::clean(const QString &line)
@@ -1,17 +1,22 @@
 #include "BlockProcessors/HRProcessor.h"
 
 #include "BlockParser.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
 HRProcessor::HRProcessor(const std::weak_ptr<BlockParser> &parser) :
     BlockProcessor(parser),
-    SEARCH_RE("^[ ]{0,3}((-+[ ]{0,2}){3,}|(_+[ ]{0,2}){3,}|(\\*+[ ]{0,2}){3,})[ ]*", QRegularExpression::MultilineOption),
-    match()
+    SEARCH_RE(RegexCache::compile("^[ ]{0,3}((-+[ ]{0,2}){3,}|(_+[ ]{0,2}){3,}|(\\*+[ ]{0,2}){3,})[ ]*", QRegularExpression::MultilineOption))
 {}
 
 bool HRProcessor::test(const Element &, const QString &block)
+{
+    return this->search(block).hasMatch();
+}
+
+QRegularExpressionMatch HRProcessor::search(const QString &block) const
 {
     //! No atomic grouping in python so we simulate it here for performance.
     //! The regex only matches what would be in the atomic group - the HR.
@@ -20,11 +25,9 @@ bool HRProcessor::test(const Element &, const QString &block)
     if ( m.hasMatch()
          && ( m.capturedEnd() == block.size()
               || block.at(m.capturedStart()+m.capturedLength()) == '\n' ) ) {
-        //! Save match object on class instance so we can use it later.
-        this->match = m;
-        return true;
+        return m;
     }
-    return false;
+    return QRegularExpressionMatch();
 }
 
 bool HRProcessor::run(const Element &parent, QStringList &blocks)
@@ -33,17 +36,19 @@ bool HRProcessor::run(const Element &parent, QStringList &blocks)
 
     QString block = blocks.front();
     blocks.pop_front();
+    //! Search again rather than keeping the match of test() on the
+    //! instance, which is shared by concurrent conversions.
+    QRegularExpressionMatch match = this->search(block);
     //! Check for lines in block before hr.
-    QString prelines = pypp::rstrip(block.left(this->match.capturedStart()), [](const QChar &ch) -> bool { return ch == '\n'; });
+    QString prelines = pypp::rstrip(block.left(match.capturedStart()), [](const QChar &ch) -> bool { return ch == '\n'; });
     if ( ! prelines.isEmpty() ) {
-        //! Recursively parse lines before hr so they get parsed first.
-        QStringList new_blocks = {prelines};
-        parser->parseBlocks(parent, new_blocks);
+        //! Parse lines before hr first.
+        parser->scheduleBlocks(parent, {prelines});
     }
-    //! create hr
-    Element hr = createSubElement(parent, "hr");
+    //! create hr after them
+    parser->schedule([parent]() { createSubElement(parent, "hr"); });
     //! check for lines in block after hr.
-    int begin = this->match.capturedStart()+this->match.capturedLength();
+    int begin = match.capturedStart()+match.capturedLength();
     QString postlines = pypp::lstrip(block.mid(begin), [](const QChar &ch) -> bool { return ch == '\n'; });
     if ( ! postlines.isEmpty() ) {
         //! Add lines after hr to master blocks for later parsing.
@@ -3,18 +3,19 @@
 #include <QDebug>
 
 #include "BlockParser.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
 HashHeaderProcessor::HashHeaderProcessor(const std::weak_ptr<BlockParser> &parser) :
     BlockProcessor(parser),
-    RE("(^|\\n)(?<level>#{1,6})(?<header>.*?)#*(\\n|$)")
+    RE(RegexCache::compile("(^|\\n)(?<level>#{1,6})(?<header>.*?)#*(\\n|$)"))
 {}
 
 bool HashHeaderProcessor::test(const Element &, const QString &block)
 {
-    return this->RE.match(block).hasMatch();
+    return this->parser.lock()->lines(block).find(LineIndex::Hash, 0) != -1;
 }
 
 bool HashHeaderProcessor::run(const Element &parent, QStringList &blocks)
@@ -23,20 +24,27 @@ bool HashHeaderProcessor::run(const Element &parent, QStringList &blocks)
 
     QString block = blocks.front();
     blocks.pop_front();
-    QRegularExpressionMatch m = this->RE.match(block);
+    //! start right at the newline before the header line
+    const LineIndex lines = parser->lines(block);
+    int first = lines.find(LineIndex::Hash, 0);
+    int offset = first > 0 ? lines.at(first).begin-1 : 0;
+    QRegularExpressionMatch m = this->RE.match(block, offset);
     if ( m.hasMatch() ) {
         QString before = block.left(m.capturedStart());  //!< All lines before header
         QString after  = block.mid(m.capturedEnd()); //!< All lines after header
         if ( ! before.isEmpty() ) {
             //! As the header was not the first line of the block and the
             //! lines before the header must be parsed first,
-            //! recursively parse this lines as a block.
-            QStringList new_blocks = {before};
-            parser->parseBlocks(parent, new_blocks);
+            //! parse this lines as a block first.
+            parser->scheduleBlocks(parent, {before});
         }
         //! Create header using named groups from RE
-        Element h = createSubElement(parent, QString("h%1").arg(m.captured("level").size()));
-        h->text = m.captured("header").trimmed();
+        QString tag = QString("h%1").arg(m.captured("level").size());
+        QString text = m.captured("header").trimmed();
+        parser->schedule([parent, tag, text]() {
+            Element h = createSubElement(parent, tag);
+            h->text = text;
+        });
         if ( ! after.isEmpty() ) {
             //! Insert remaining lines as first block for future parsing.
             blocks.push_front(after);
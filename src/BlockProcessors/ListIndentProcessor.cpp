@@ -8,8 +8,7 @@ namespace markdown
 ListIndentProcessor::ListIndentProcessor(const std::weak_ptr<BlockParser> &parser) :
     BlockProcessor(parser),
     ITEM_TYPES({"li"}),
-    LIST_TYPES({"ul", "ol"}),
-    INDENT_RE(QString("^(([ ]{%1})+)").arg(this->tab_length))
+    LIST_TYPES({"ul", "ol"})
 {}
 ListIndentProcessor::~ListIndentProcessor(void)
 {}
@@ -19,7 +18,7 @@ bool ListIndentProcessor::test(const Element &parent, const QString &block)
     std::shared_ptr<BlockParser> parser = this->parser.lock();
 
     return block.startsWith(QString(this->tab_length, ' '))
-            && ! parser->state.isstate("detabbed")
+            && ! parser->state().isstate("detabbed")
             && ( this->ITEM_TYPES.contains(parent->tag)
                  || ( parent->size() > 0
                       && this->LIST_TYPES.contains((*parent)[-1]->tag) )
@@ -37,7 +36,7 @@ bool ListIndentProcessor::run(const Element &parent, QStringList &blocks)
     std::tie(level, sibling) = this->get_level(parent, block);
     block = this->looseDetab(block, level);
 
-    parser->state.set("detabbed");
+    //! every branch parses the block in the "detabbed" state
     if ( this->ITEM_TYPES.contains(parent->tag) ) {
         //! It's possible that this parent has a 'ul' or 'ol' child list
         //! with a member.  If that is the case, then that should be the
@@ -45,18 +44,15 @@ bool ListIndentProcessor::run(const Element &parent, QStringList &blocks)
         //! list whose first member was parsed previous to this point
         //! see OListProcessor
         if ( parent->size() > 0 && this->LIST_TYPES.contains((*parent)[-1]->tag) ) {
-            QStringList new_blocks = {block};
             Element new_parent = (*parent)[-1];
-            parser->parseBlocks(new_parent, new_blocks);
+            parser->scheduleBlocks(new_parent, {block}, "detabbed");
         } else {
-            QStringList new_blocks = {block};
             //! The parent is already a li. Just parse the child block.
-            parser->parseBlocks(parent, new_blocks);
+            parser->scheduleBlocks(parent, {block}, "detabbed");
         }
     } else if ( this->ITEM_TYPES.contains(sibling->tag) ) {
         //! The sibling is a li. Use it as parent.
-        QStringList new_blocks = {block};
-        parser->parseBlocks(sibling, new_blocks);
+        parser->scheduleBlocks(sibling, {block}, "detabbed");
     } else if ( sibling->size() > 0 && this->ITEM_TYPES.contains((*sibling)[-1]->tag) ) {
         //! The parent is a list (``ol`` or ``ul``) which has children.
         //! Assume the last child li is the parent of this block.
@@ -76,11 +72,10 @@ bool ListIndentProcessor::run(const Element &parent, QStringList &blocks)
             }
         }
         Element new_parent = (*sibling)[-1];
-        parser->parseChunk(new_parent, block);
+        parser->scheduleChunk(new_parent, block, "detabbed");
     } else {
         this->create_item(sibling, block);
     }
-    parser->state.reset();
     return true;
 }
 
@@ -92,8 +87,7 @@ void ListIndentProcessor::create_item(const Element &parent, const QString &bloc
     std::shared_ptr<BlockParser> parser = this->parser.lock();
 
     Element li = createSubElement(parent, "li");
-    QStringList new_blocks = {block};
-    parser->parseBlocks(li, new_blocks);
+    parser->scheduleBlocks(li, {block}, "detabbed");
 }
 
 /*!
@@ -104,13 +98,9 @@ std::tuple<int, Element> ListIndentProcessor::get_level(const Element &parent, c
     std::shared_ptr<BlockParser> parser = this->parser.lock();
 
     //! Get indent level
-    int indent_level = 0;
+    int indent_level = parser->lines(block).at(0).indent/this->tab_length;
     int level = 0;
-    QRegularExpressionMatch m = this->INDENT_RE.match(block);
-    if ( m.hasMatch() ) {
-        indent_level = m.captured(1).size()/this->tab_length;
-    }
-    if ( parser->state.isstate("list") ) {
+    if ( parser->state().isstate("list") ) {
         //! We're in a tightlist - so we already are at correct parent.
         level = 1;
     } else {
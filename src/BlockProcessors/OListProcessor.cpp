@@ -9,9 +9,7 @@ namespace markdown
 OListProcessor::OListProcessor(const std::weak_ptr<BlockParser> &parser) :
     BlockProcessor(parser),
     TAG("ol"),
-    RE(QString("^[ ]{0,%1}\\d+\\.[ ]+(.*)").arg(this->tab_length-1)),
-    CHILD_RE(QString("^[ ]{0,%1}((\\d+\\.)|[*+-])[ ]+(.*)").arg(this->tab_length-1)),
-    INDENT_RE(QString("^[ ]{%1,%2}((\\d+\\.)|[*+-])[ ]+.*").arg(this->tab_length).arg(this->tab_length*2-1)),
+    MARKER(LineIndex::Ordered),
     STARTSWITH("1"),
     SIBLING_TAGS({"ol", "ul"})
 {}
@@ -20,7 +18,8 @@ OListProcessor::~OListProcessor()
 
 bool OListProcessor::test(const Element &, const QString &block)
 {
-    return this->RE.match(block).hasMatch();
+    const LineIndex lines = this->parser.lock()->lines(block);
+    return lines.at(0).marker == this->MARKER && lines.at(0).indent < this->tab_length;
 }
 
 bool OListProcessor::run(const Element &parent, QStringList &blocks)
@@ -30,7 +29,9 @@ bool OListProcessor::run(const Element &parent, QStringList &blocks)
     //! Check fr multiple items in one block.
     QString block = blocks.front();
     blocks.pop_front();
-    QStringList items = this->get_items(block);
+    QStringList items;
+    QString startswith;
+    std::tie(items, startswith) = this->get_items(block);
     Element sibling = this->lastChild(parent);
     Element lst;
 
@@ -64,12 +65,9 @@ bool OListProcessor::run(const Element &parent, QStringList &blocks)
 
         //! parse first block differently as it gets wrapped in a p.
         Element li = createSubElement(lst, "li");
-        parser->state.set("looselist");
         QString firstitem = items.front();
         items.pop_front();
-        QStringList new_blocks = {firstitem};
-        parser->parseBlocks(li, new_blocks);
-        parser->state.reset();
+        parser->scheduleBlocks(li, {firstitem}, "looselist");
     } else if ( parent->tag == "ol" || parent->tag == "ul" ) {
         //! this catches the edge case of a multi-item indented list whose
         //! first item is in a blank parent-list item:
@@ -81,61 +79,83 @@ bool OListProcessor::run(const Element &parent, QStringList &blocks)
         //! This is a new list so create parent with appropriate tag.
         lst = createSubElement(parent, this->TAG);
         //! Check if a custom start integer is set
-        if ( ! parser->markdown.lock()->lazy_ol() && this->STARTSWITH != "1" ) {
-            lst->set("start", this->STARTSWITH);
+        if ( ! parser->markdown.lock()->lazy_ol() && startswith != "1" ) {
+            lst->set("start", startswith);
         }
     }
 
-    parser->state.set("list");
-    //! Loop through items in block, recursively parsing each with the
-    //! appropriate parent.
+    //! Loop through items in block, parsing each with the appropriate
+    //! parent.  Items only ever add to their own li, so the li can be
+    //! created right away.
     for ( const QString &item : items ) {
-        QStringList new_blocks = {item};
         if ( item.startsWith(QString(this->tab_length, ' ')) ) {
             Element new_parent = (*lst)[-1];
             //! Item is indented. Parse with last item as parent
-            parser->parseBlocks(new_parent, new_blocks);
+            parser->scheduleBlocks(new_parent, {item}, "list");
         } else {
             //! New item. Create li and parse with it as parent
             Element li = createSubElement(lst, "li");
-            parser->parseBlocks(li, new_blocks);
+            parser->scheduleBlocks(li, {item}, "list");
         }
     }
-    parser->state.reset();
     return true;
 }
 
-QStringList OListProcessor::get_items(const QString &block)
+std::tuple<QStringList, QString> OListProcessor::get_items(const QString &block) const
 {
-    QStringList items;
-    QStringList lines = block.split("\n");
-    for ( const QString &line : lines ) {
-        QRegularExpressionMatch m = this->CHILD_RE.match(line);
-        if ( m.hasMatch() ) {
+    //! Every item is a run of lines, from the text after the marker of
+    //! its first line to its last line.
+    struct Item
+    {
+        int first;
+        int offset;
+        int last;
+    };
+
+    const LineIndex lines = this->parser.lock()->lines(block);
+    QVector<Item> items;
+    QString startswith = this->STARTSWITH;
+    bool indented = false;  //!< whether the last item is an indented one
+    for ( int i = 0; i < lines.size(); ++i ) {
+        const LineIndex::Line &line = lines.at(i);
+        bool marked = line.marker == LineIndex::Ordered || line.marker == LineIndex::Bullet;
+        if ( marked && line.indent < this->tab_length ) {
             //! This is a new list item
             //! Check first item for the start index
             if ( items.empty() && this->TAG == "ol" ) {
                 //! Detect the integer value of first list item
-                QRegularExpression INTEGER_RE("(\\d+)");
-                QRegularExpressionMatch im = INTEGER_RE.match(m.captured(1));
-                this->STARTSWITH = im.captured();
+                QStringRef marker = lines.line(i).mid(line.indent);
+                startswith = line.marker == LineIndex::Ordered ? marker.left(marker.indexOf('.')).toString() : QString();
             }
             //! Append to the list
-            items.push_back(m.captured(3));
-        } else if ( this->INDENT_RE.match(line).hasMatch() ) {
+            items.append(Item{i, line.content, i});
+            indented = false;
+        } else if ( marked && line.indent >= this->tab_length && line.indent < this->tab_length*2 ) {
             //! This is an indented (possibly nested) item.
-            if ( ! items.empty() && items.back().startsWith(QString(this->tab_length, ' ')) ) {
+            if ( ! items.empty() && indented ) {
                 //! Previous item was indented. Append to that item.
-                items.back() = QString("%1\n%2").arg(items.back()).arg(line);
+                items.last().last = i;
             } else {
-                items.push_back(line);
+                items.append(Item{i, 0, i});
+                indented = true;
             }
-        } else {
+        } else if ( ! items.empty() ) {
             //! This is another line of previous item. Append to that item.
-            items.back() = QString("%1\n%2").arg(items.back()).arg(line);
+            items.last().last = i;
+        } else {
+            items.append(Item{i, 0, i});
         }
     }
-    return items;
+
+    QStringList result;
+    result.reserve(items.size());
+    for ( const Item &item : items ) {
+        const LineIndex::Line &first = lines.at(item.first);
+        const LineIndex::Line &last = lines.at(item.last);
+        int begin = first.begin + qMin(item.offset, first.length);
+        result.append(block.mid(begin, last.begin+last.length-begin));
+    }
+    return std::make_tuple(result, startswith);
 }
 
 
@@ -143,7 +163,7 @@ UListProcessor::UListProcessor(const std::weak_ptr<BlockParser> &parser) :
     OListProcessor(parser)
 {
     OListProcessor::TAG = "ul";
-    OListProcessor::RE = QRegularExpression(QString("^[ ]{0,%1}[*+-][ ]+(.*)").arg(this->tab_length-1));
+    OListProcessor::MARKER = LineIndex::Bullet;
 }
 
 } // namespace markdown
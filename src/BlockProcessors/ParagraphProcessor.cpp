@@ -18,7 +18,7 @@ bool ParagraphProcessor::run(const Element &parent, QStringList &blocks)
     blocks.pop_front();
     if ( ! block.trimmed().isEmpty() ) {
         //! Not a blank block. Add to parent, otherwise throw it away.
-        if ( parser->state.isstate("list") ) {
+        if ( parser->state().isstate("list") ) {
             //! The parent is a tight-list.
             //!
             //! Check for any children. This will likely only happen in a
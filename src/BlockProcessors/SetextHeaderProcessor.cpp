@@ -1,13 +1,14 @@
 #include "BlockProcessors/SetextHeaderProcessor.h"
 
 #include "BlockParser.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
 SetextHeaderProcessor::SetextHeaderProcessor(const std::weak_ptr<BlockParser> &parser) :
     BlockProcessor(parser),
-    RE("^.*?\\n[=-]+[ ]*(\\n|$)", QRegularExpression::MultilineOption)
+    RE(RegexCache::compile("^.*?\\n[=-]+[ ]*(\\n|$)", QRegularExpression::MultilineOption))
 {}
 
 bool SetextHeaderProcessor::test(const Element &, const QString &block)
@@ -19,27 +20,19 @@ bool SetextHeaderProcessor::run(const Element &parent, QStringList &blocks)
 {
     QString block = blocks.front();
     blocks.pop_front();
-    QStringList lines = block.split("\n");
+    const LineIndex lines = this->parser.lock()->lines(block);
     //! Determine level. ``=`` is 1 and ``-`` is 2.
     int level = 0;
-    if ( lines.at(1).startsWith("=") ) {
+    if ( lines.line(1).startsWith('=') ) {
         level = 1;
     } else {
         level = 2;
     }
     Element h = createSubElement(parent, QString("h%1").arg(level));
-    h->text = lines.at(0).trimmed();
+    h->text = lines.line(0).trimmed().toString();
     if ( lines.size() > 2 ) {
         //! Block contains additional lines. Add to  master blocks for later.
-        QStringList buff;
-        int counter = 0;
-        for ( const QString &line : lines ) {
-            if ( counter++ < 2 ) {
-                continue;
-            }
-            buff.push_back(line);
-        }
-        blocks.push_front(buff.join("\n"));
+        blocks.push_front(lines.join(2, lines.size()));
     }
     return true;
 }
@@ -0,0 +1,73 @@
+#include "Context.h"
+
+namespace markdown{
+
+namespace {
+
+thread_local Context *current_context = nullptr;
+//! whether the default context of the thread was handed out since it
+//! was last reset
+thread_local bool fallback_used = false;
+
+Context &fallback_context()
+{
+    static thread_local Context fallback;
+    return fallback;
+}
+
+}
+
+Context::Scope::Scope(Context &context) :
+    previous(current_context),
+    arena(context.arena)
+{
+    if ( this->previous == nullptr && fallback_used ) {
+        //! a new top-level conversion, whatever processors driven by
+        //! hand left behind is not wanted any more
+        fallback_context().reset();
+        fallback_used = false;
+    }
+    current_context = &context;
+}
+
+Context::Scope::~Scope()
+{
+    current_context = this->previous;
+}
+
+Context::Context() :
+    references(),
+    htmlStash(),
+    state(),
+    frames(),
+    scheduled(nullptr),
+    lines(),
+    root(),
+    stashed_nodes(),
+    inlinePatterns(),
+    arena(std::make_shared<ElementArena>())
+{}
+
+Context &Context::current()
+{
+    if ( current_context != nullptr ) {
+        return *current_context;
+    }
+    fallback_used = true;
+    return fallback_context();
+}
+
+void Context::reset()
+{
+    this->references.clear();
+    this->htmlStash.reset();
+    this->state = State();
+    this->frames.clear();
+    this->scheduled = nullptr;
+    this->lines = LineIndex();
+    this->root = ElementTree();
+    this->stashed_nodes = TreeProcessor::StashNodes();
+    this->inlinePatterns.clear();
+}
+
+} // end of namespace markdown
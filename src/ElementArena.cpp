@@ -0,0 +1,127 @@
+#include "ElementArena.h"
+
+#include <new>
+
+#include "ElementTree.hpp"
+
+namespace markdown{
+
+namespace {
+
+thread_local ElementArena *current_arena = nullptr;
+thread_local std::weak_ptr<ElementArena> fallback_arena;
+
+//! small, a tree built by hand rarely has many elements
+const int FALLBACK_BLOCK_SIZE = 16;
+
+}
+
+ElementArena::Scope::Scope(const std::shared_ptr<ElementArena> &arena) :
+    arena(arena),
+    previous(current_arena)
+{
+    current_arena = arena.get();
+}
+
+ElementArena::Scope::~Scope()
+{
+    current_arena = this->previous;
+}
+
+ElementArena::ElementArena(int blockSize) :
+    blockSize(blockSize > 0 ? blockSize : 1),
+    blocks(),
+    count(0),
+    tags(),
+    retained()
+{}
+
+ElementArena::~ElementArena()
+{
+    //! Children from retained arenas outlive this one, so detach them
+    //! before their parents and siblings here go away.
+    for ( const Block &block : this->blocks ) {
+        for ( int i = 0; i < block.used; ++i ) {
+            impl::Element *node = block.nodes[i]._first;
+            while ( node != nullptr ) {
+                impl::Element *next = node->_next;
+                if ( node->_arena != this ) {
+                    node->_parent = nullptr;
+                    node->_prev = nullptr;
+                    node->_next = nullptr;
+                }
+                node = next;
+            }
+        }
+    }
+    for ( const Block &block : this->blocks ) {
+        for ( int i = 0; i < block.used; ++i ) {
+            block.nodes[i].~Element();
+        }
+        ::operator delete(block.nodes);
+    }
+}
+
+std::shared_ptr<ElementArena> ElementArena::current()
+{
+    if ( current_arena != nullptr ) {
+        return current_arena->shared_from_this();
+    }
+    std::shared_ptr<ElementArena> arena = fallback_arena.lock();
+    if ( ! arena ) {
+        arena = std::make_shared<ElementArena>(FALLBACK_BLOCK_SIZE);
+        fallback_arena = arena;
+    }
+    return arena;
+}
+
+impl::Element *ElementArena::create(const QString &tag, const QMap<QString, QString> &attrib)
+{
+    if ( this->blocks.isEmpty() || this->blocks.last().used == this->blocks.last().capacity ) {
+        //! grow geometrically so large documents need few blocks
+        int capacity = this->blocks.isEmpty() ? this->blockSize : this->blocks.last().capacity * 2;
+        Block block;
+        block.nodes = static_cast<impl::Element *>(::operator new(sizeof(impl::Element) * capacity));
+        block.capacity = capacity;
+        block.used = 0;
+        this->blocks.append(block);
+    }
+    Block &block = this->blocks.last();
+    const QString &shared = *this->tags.insert(tag);
+    impl::Element *node = new (block.nodes + block.used) impl::Element(this, shared, attrib);
+    ++block.used;
+    ++this->count;
+    return node;
+}
+
+int ElementArena::size() const
+{
+    return this->count;
+}
+
+void ElementArena::retain(const std::shared_ptr<ElementArena> &arena)
+{
+    if ( arena.get() == this ) {
+        return;
+    }
+    auto it = this->retained.find(arena.get());
+    if ( it != this->retained.end() ) {
+        ++it->links;
+    } else {
+        Retained entry = {arena, 1};
+        this->retained.insert(arena.get(), entry);
+    }
+}
+
+void ElementArena::release(ElementArena *arena)
+{
+    auto it = this->retained.find(arena);
+    if ( it == this->retained.end() || --it->links > 0 ) {
+        return;
+    }
+    //! the arena may go away with the entry, take it out of the hash first
+    std::shared_ptr<ElementArena> last = it->arena;
+    this->retained.erase(it);
+}
+
+} // end of namespace markdown
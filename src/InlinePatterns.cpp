@@ -14,8 +14,10 @@
 #include <QPair>
 #include <QSet>
 
+#include "Context.h"
 #include "Markdown.h"
 #include "pypp.hpp"
+#include "RegexCache.h"
 
 #include "InlinePatterns/common.h"
 #include "InlinePatterns/BacktickPattern.h"
@@ -32,64 +34,136 @@ namespace markdown{
 //! Set values of an element based on attribute definitions ({@id=123}).
 
 Pattern::Pattern(const QString &pattern, const std::weak_ptr<Markdown> &markdown_instance) :
-    pattern(pattern), compiled_re(QString("^(.*?)%1(.*)$").arg(pattern), QRegularExpression::DotMatchesEverythingOption | QRegularExpression::UseUnicodePropertiesOption),
+    pattern(pattern), compiled_re(RegexCache::compile(pattern, QRegularExpression::DotMatchesEverythingOption | QRegularExpression::UseUnicodePropertiesOption)),
+    locator(), locator_lookback(0),
     //! Api for Markdown to pass safe_mode into instance
     safe_mode(false), markdown(markdown_instance)
 {}
 
+QRegularExpressionMatch Pattern::match(const QString &data, int offset) const
+{
+    if ( ! this->locator ) {
+        return this->compiled_re.match(data, offset);
+    }
+    for ( int start = this->locator(data, offset); start != -1; start = this->locator(data, start+1) ) {
+        QRegularExpressionMatch m = this->compiled_re.match(data, start, QRegularExpression::NormalMatch, QRegularExpression::AnchoredMatchOption);
+        if ( m.hasMatch() ) {
+            return m;
+        }
+    }
+    return QRegularExpressionMatch();
+}
+
+void Pattern::setLocator(const Locator &locator, int lookback)
+{
+    this->locator = locator;
+    this->locator_lookback = lookback;
+}
+
+int Pattern::resumeOffset(int start) const
+{
+    if ( ! this->locator ) {
+        return 0;
+    }
+    return qMax(0, start - this->locator_lookback);
+}
+
 QString Pattern::unescape(const QString &text)
 {
-    std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    if ( ! text.contains(util::STX) || ! this->markdown.lock()->treeprocessors.exists("inline") ) {
+        return text;
+    }
+    return replacePlaceholders(text, [](const boost::optional<QString> &str, const boost::optional<Element> &node) -> QString {
+        if ( str ) {
+            return *str;
+        }
+        return itertext(*node);
+    });
+}
 
-    TreeProcessor::StashNodes stash;
-    if ( markdown->treeprocessors.exists("inline") ) {
-        stash = markdown->treeprocessors["inline"]->stashed_nodes;
-    } else {
+QString Pattern::replacePlaceholders(const QString &text, const StashReplacer &replace)
+{
+    const TreeProcessor::StashNodes &stash = Context::current().stashed_nodes;
+    const QString &prefix = util::INLINE_PLACEHOLDER_PREFIX;
+    int index = text.indexOf(prefix);
+    if ( index == -1 ) {
         return text;
     }
-    auto get_stash = [&](const QRegularExpressionMatch &m) -> QString {
-        QString id = m.captured(1);
-        if ( stash.contains(id) ) {
-            boost::optional<QString> str;
-            boost::optional<Element> node;
-            std::tie(str, node) = stash[id];
-            if ( str ) {
-                return *str;
-            }
-            return itertext(*node);
+    QString result;
+    result.reserve(text.size());
+    int last = 0;
+    while ( index != -1 ) {
+        int end = index + prefix.size();
+        int id = util::inlinePlaceholderId(text, index, &end);
+        if ( id == -1 ) {
+            index = text.indexOf(prefix, end);
+            continue;
         }
-        return QString();
-    };
-    return pypp::re::sub(util::INLINE_PLACEHOLDER_RE, get_stash, text);
+        result.append(text.unicode()+last, index-last);
+        //! an unknown id vanishes, like an unmatched group in re.sub
+        if ( id < stash.size() ) {
+            const TreeProcessor::NodeItem &item = stash.at(id);
+            result.append(replace(std::get<0>(item), std::get<1>(item)));
+        }
+        last = end;
+        index = text.indexOf(prefix, end);
+    }
+    result.append(text.unicode()+last, text.size()-last);
+    return result;
 }
 
 
+//! Wrap a built-in pattern and register the characters its matches start with.
+static std::shared_ptr<Pattern> triggered(Pattern *pattern, const QString &triggers)
+{
+    pattern->setTriggers(triggers);
+    return std::shared_ptr<Pattern>(pattern);
+}
+
+//! Let a built-in link pattern find its matches with a scanner.
+static Pattern *scanned(LinkPattern *pattern, LinkScanner scanner)
+{
+    pattern->setScanner(scanner);
+    return pattern;
+}
+
+//! Let a built-in pattern search with a locator.
+static Pattern *located(Pattern *pattern, const Pattern::Locator &locator, int lookback)
+{
+    pattern->setLocator(locator, lookback);
+    return pattern;
+}
+
 OrderedDictPatterns build_inlinepatterns(const std::shared_ptr<Markdown> &md_instance)
 {
     OrderedDictPatterns inlinePatterns;
-    inlinePatterns.append("backtick", std::shared_ptr<Pattern>(new BacktickPattern(BACKTICK_RE)));
-    inlinePatterns.append("escape", std::shared_ptr<Pattern>(new EscapePattern(ESCAPE_RE, md_instance)));
-    inlinePatterns.append("reference", std::shared_ptr<Pattern>(new ReferencePattern(REFERENCE_RE, md_instance)));
-    inlinePatterns.append("link", std::shared_ptr<Pattern>(new LinkPattern(LINK_RE, md_instance)));
-    inlinePatterns.append("image_link", std::shared_ptr<Pattern>(new ImagePattern(IMAGE_LINK_RE, md_instance)));
-    inlinePatterns.append("image_reference", std::shared_ptr<Pattern>(new ImageReferencePattern(IMAGE_REFERENCE_RE, md_instance)));
-    inlinePatterns.append("short_reference", std::shared_ptr<Pattern>(new ReferencePattern(SHORT_REF_RE, md_instance)));
-    inlinePatterns.append("autolink", std::shared_ptr<Pattern>(new AutolinkPattern(AUTOLINK_RE, md_instance)));
-    inlinePatterns.append("automail", std::shared_ptr<Pattern>(new AutomailPattern(AUTOMAIL_RE, md_instance)));
-    inlinePatterns.append("linebreak", std::shared_ptr<Pattern>(new SubstituteTagPattern(LINE_BREAK_RE, "br")));
+    inlinePatterns.append("backtick", triggered(new BacktickPattern(BACKTICK_RE), "`"));
+    inlinePatterns.append("escape", triggered(new EscapePattern(ESCAPE_RE, md_instance), "\\"));
+    inlinePatterns.append("reference", triggered(scanned(new ReferencePattern(REFERENCE_RE, md_instance), scanReference), "["));
+    inlinePatterns.append("link", triggered(scanned(new LinkPattern(LINK_RE, md_instance), scanLink), "["));
+    inlinePatterns.append("image_link", triggered(scanned(new ImagePattern(IMAGE_LINK_RE, md_instance), scanImageLink), "!"));
+    inlinePatterns.append("image_reference", triggered(scanned(new ImageReferencePattern(IMAGE_REFERENCE_RE, md_instance), scanImageReference), "!"));
+    inlinePatterns.append("short_reference", triggered(scanned(new ReferencePattern(SHORT_REF_RE, md_instance), scanShortReference), "["));
+    inlinePatterns.append("autolink", triggered(new AutolinkPattern(AUTOLINK_RE, md_instance), "<"));
+    inlinePatterns.append("automail", triggered(new AutomailPattern(AUTOMAIL_RE, md_instance), "<"));
+    inlinePatterns.append("linebreak", triggered(new SubstituteTagPattern(LINE_BREAK_RE, "br"), " "));
     if ( md_instance->safeMode() != Markdown::escape_mode ) {
-        inlinePatterns.append("html", std::shared_ptr<Pattern>(new HtmlPattern(HTML_RE, md_instance)));
+        inlinePatterns.append("html", triggered(new HtmlPattern(HTML_RE, md_instance), "<"));
     }
-    inlinePatterns.append("entity", std::shared_ptr<Pattern>(new HtmlPattern(ENTITY_RE, md_instance)));
-    inlinePatterns.append("not_strong", std::shared_ptr<Pattern>(new SimpleTextPattern(NOT_STRONG_RE)));
-    inlinePatterns.append("em_strong", std::shared_ptr<Pattern>(new DoubleTagPattern(EM_STRONG_RE, "strong,em")));
-    inlinePatterns.append("strong_em", std::shared_ptr<Pattern>(new DoubleTagPattern(STRONG_EM_RE, "em,strong")));
-    inlinePatterns.append("strong", std::shared_ptr<Pattern>(new SimpleTagPattern(STRONG_RE, "strong")));
-    inlinePatterns.append("emphasis", std::shared_ptr<Pattern>(new SimpleTagPattern(EMPHASIS_RE, "em")));
+    inlinePatterns.append("entity", triggered(new HtmlPattern(ENTITY_RE, md_instance), "&"));
+    //! a stand-alone `*` or `_` starts at the preceding space or at the beginning of the text
+    //! Placeholders hold no delimiters, spaces or word characters at their
+    //! ends, so a replaced match only enables new matches that start at
+    //! most `lookback` characters before it.
+    inlinePatterns.append("not_strong", triggered(located(new SimpleTextPattern(NOT_STRONG_RE), locateNotStrong, 2), " *_"));
+    inlinePatterns.append("em_strong", triggered(located(new DoubleTagPattern(EM_STRONG_RE, "strong,em"), locateEmStrong, 2), "*_"));
+    inlinePatterns.append("strong_em", triggered(located(new DoubleTagPattern(STRONG_EM_RE, "em,strong"), locateStrongEm, 2), "*_"));
+    inlinePatterns.append("strong", triggered(located(new SimpleTagPattern(STRONG_RE, "strong"), locateStrong, 1), "*_"));
+    inlinePatterns.append("emphasis", triggered(located(new SimpleTagPattern(EMPHASIS_RE, "em"), locateEmphasis, 1), "*"));
     if ( md_instance->smart_emphasis() ) {
-        inlinePatterns.append("emphasis2", std::shared_ptr<Pattern>(new SimpleTagPattern(SMART_EMPHASIS_RE, "em")));
+        inlinePatterns.append("emphasis2", triggered(located(new SimpleTagPattern(SMART_EMPHASIS_RE, "em"), locateSmartEmphasis, 1), "_"));
     } else {
-        inlinePatterns.append("emphasis2", std::shared_ptr<Pattern>(new SimpleTagPattern(EMPHASIS_2_RE, "em")));
+        inlinePatterns.append("emphasis2", triggered(located(new SimpleTagPattern(EMPHASIS_2_RE, "em"), locateEmphasis2, 0), "_"));
     }
     return inlinePatterns;
 }
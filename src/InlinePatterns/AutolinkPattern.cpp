@@ -10,8 +10,8 @@ AutolinkPattern::AutolinkPattern(const QString &pattern, const std::weak_ptr<Mar
 Element AutolinkPattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
 {
     Element el = createElement("a");
-    el->set("href", this->unescape(m.captured(2)));
-    el->text = m.captured(2);
+    el->set("href", this->unescape(m.captured(1)));
+    el->text = m.captured(1);
     el->atomic = true;
     return el;
 }
@@ -13,7 +13,7 @@ AutomailPattern::AutomailPattern(const QString &pattern, const std::weak_ptr<Mar
 Element AutomailPattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
 {
     Element el = createElement("a");
-    QString email = this->unescape(m.captured(2));
+    QString email = this->unescape(m.captured(1));
     if ( email.startsWith("mailto:") ) {
         email = email.mid(7);
     }
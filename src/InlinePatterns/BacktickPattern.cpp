@@ -11,7 +11,7 @@ BacktickPattern::BacktickPattern(const QString &pattern, const std::weak_ptr<Mar
 Element BacktickPattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
 {
     Element el = createElement(this->tag);
-    el->text = m.captured(3).trimmed();
+    el->text = m.captured(2).trimmed();
     el->atomic = true;
     return el;
 }
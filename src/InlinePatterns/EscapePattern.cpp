@@ -13,7 +13,7 @@ EscapePattern::EscapePattern(const QString &pattern, const std::weak_ptr<Markdow
 
 boost::optional<QString> EscapePattern::handleMatch(const QRegularExpressionMatch &m)
 {
-    QString text = m.captured(2);
+    QString text = m.captured(1);
     if ( text.size() > 1 ) {
         return QString("\\%1").arg(text);
     }
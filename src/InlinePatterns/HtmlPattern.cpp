@@ -1,5 +1,6 @@
 #include "InlinePatterns/HtmlPattern.h"
 
+#include "Context.h"
 #include "Markdown.h"
 
 namespace markdown
@@ -11,8 +12,8 @@ HtmlPattern::HtmlPattern(const QString &pattern, const std::weak_ptr<Markdown> &
 
 boost::optional<QString> HtmlPattern::handleMatch(const QRegularExpressionMatch &m)
 {
-    QString rawHtml = this->unescape(m.captured(2));
-    return this->markdown.lock()->htmlStash.store(rawHtml);
+    QString rawHtml = this->unescape(m.captured(1));
+    return Context::current().htmlStash.store(rawHtml);
 }
 
 QString HtmlPattern::type(void) const
@@ -20,27 +21,21 @@ QString HtmlPattern::type(void) const
 
 QString HtmlPattern::unescape(const QString &text)
 {
-    TreeProcessor::StashNodes stash;
-    if ( this->markdown.lock()->treeprocessors.exists("inline") ) {
-        stash = this->markdown.lock()->treeprocessors["inline"]->stashed_nodes;
-    } else {
+    if ( ! text.contains(util::STX) ) {
         return text;
     }
-    auto get_stash = [&](const QRegularExpressionMatch &m) -> QString {
-        QString id = m.captured(1);
-        if ( stash.contains(id) ) {
-            boost::optional<QString> str;
-            boost::optional<Element> node;
-            std::tie(str, node) = stash[id];
-            if ( str ) {
-                return "\\" + *str;
-            } else {
-                return this->markdown.lock()->serializer(*node);
-            }
+    std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    if ( ! markdown->treeprocessors.exists("inline") ) {
+        return text;
+    }
+    return replacePlaceholders(text, [&](const boost::optional<QString> &str, const boost::optional<Element> &node) -> QString {
+        if ( str ) {
+            return "\\" + *str;
+        } else {
+            Element element = *node;
+            return markdown->serializer(element);
         }
-        return QString();
-    };
-    return pypp::re::sub(util::INLINE_PLACEHOLDER_RE, get_stash, text);
+    });
 }
 
 } // namespace markdown
@@ -3,24 +3,491 @@
 #include <QUrl>
 #include <QUrlQuery>
 
+#include "Context.h"
 #include "Markdown.h"
+#include "RegexCache.h"
 #include "InlinePatterns/common.h"
 
 namespace markdown
 {
 
+namespace {
+
+const LinkMatch NO_LINK = {-1, -1, QString(), QString(), QString()};
+
+/*!
+ * The next index of a needle at or after a position, remembered across
+ * lookups from increasing positions so that all lookups of one scan read
+ * the text once.
+ */
+class NextIndex
+{
+public:
+    explicit NextIndex(const QString &needle) :
+        needle(needle), from(-1), found(-1)
+    {}
+
+    int at(const QString &data, int index)
+    {
+        if ( this->from == -1 || index < this->from || ( this->found != -1 && index > this->found ) ) {
+            this->from = index;
+            this->found = data.indexOf(this->needle, index);
+        }
+        return this->found;
+    }
+
+    void clear(void)
+    {
+        this->from = -1;
+    }
+
+    //! follows [start, end) being replaced by a text delta characters
+    //! longer, which holds no part of the needle
+    void replaced(int start, int end, int delta)
+    {
+        if ( this->from >= end ) {
+            this->from += delta;
+            this->found = this->found != -1 ? this->found + delta : -1;
+        } else if ( this->from >= start || ( this->found != -1 && this->found + this->needle.size() > start && this->found < end ) ) {
+            this->from = -1;
+        } else if ( this->found >= end ) {
+            this->found += delta;
+        }
+    }
+
+private:
+    QString needle;
+    int from;
+    int found;
+
+};
+
+int skipSpaces(const QString &data, int index)
+{
+    while ( index < data.size() && data.at(index).isSpace() ) {
+        ++index;
+    }
+    return index;
+}
+
+/*!
+ * Where the part of LINK_RE after the brackets,
+ *
+ *     \(\s*(<.*?>|((?:(?:\(.*?\))|[^\(\)]))*?)\s*((['"])(.*?)\11\s*)?\)
+ *
+ * matches, for every `(` of a text.  Backtracking would try the ways of
+ * splitting the href into parenthesized runs one by one; instead the first
+ * split that works is worked out for all positions in one backward pass.
+ *
+ * The pass only goes as far back as a lookup needs.  Positions and their
+ * values are kept as distances from the end of the text, so what was
+ * worked out behind a replaced match stays valid.
+ */
+class LinkTails
+{
+public:
+    LinkTails(void) :
+        size(0)
+    {}
+
+    void clear(void)
+    {
+        this->replaced(0, 1);
+    }
+
+    //! forgets the positions before end of a text oldSize long, the
+    //! text up to end having changed
+    void replaced(int oldSize, int end)
+    {
+        int keep = qMax(0, oldSize - end + 1);
+        if ( this->nonSpace.size() > keep ) {
+            for ( QVector<int> *table : {&this->nonSpace, &this->quote[0], &this->quote[1], &this->closeEnd, &this->titleEnd, &this->hrefEnd, &this->angleEnd, &this->goodClose} ) {
+                table->resize(keep);
+            }
+        }
+    }
+
+    //! fills in href, title and end of a link whose `(` is at index
+    bool match(const QString &data, int index, LinkMatch &m)
+    {
+        this->extend(data, index+1);
+        int begin = this->at(this->nonSpace, index+1);
+        int end = -1;
+        if ( begin < this->size && data.at(begin) == '<' ) {
+            end = this->at(this->angleEnd, begin+1);
+        }
+        if ( end == -1 ) {
+            end = this->at(this->hrefEnd, begin);
+        }
+        if ( end == -1 ) {
+            return false;
+        }
+        m.href = data.mid(begin, end-begin);
+        if ( this->at(this->titleEnd, end) != -1 ) {
+            int title = this->at(this->nonSpace, end) + 1;
+            m.title = data.mid(title, this->at(this->titleEnd, end)-title);
+        }
+        m.end = this->at(this->closeEnd, end);
+        return true;
+    }
+
+private:
+    int at(const QVector<int> &table, int index) const
+    {
+        int value = table.at(this->size-index);
+        return value == -1 ? -1 : this->size - value;
+    }
+
+    void append(QVector<int> &table, int value)
+    {
+        table.append(value == -1 ? -1 : this->size - value);
+    }
+
+    //! works out the positions from index on
+    void extend(const QString &data, int index)
+    {
+        const int size = this->size = data.size();
+        for ( int i = size - this->nonSpace.size(); i >= index; --i ) {
+            QChar ch = i < size ? data.at(i) : QChar();
+            int nonSpace = ( i < size && ch.isSpace() ) ? this->at(this->nonSpace, i+1) : i;
+            this->append(this->nonSpace, nonSpace);
+
+            //! `\11\s*\)`: a quote that closes the title
+            int after = i < size ? this->at(this->nonSpace, i+1) : size;
+            bool closesTitle = after < size && data.at(after) == ')';
+            for ( int q = 0; q < 2; ++q ) {
+                bool here = i < size && ch == QChar(q == 0 ? '"' : '\'') && closesTitle;
+                this->append(this->quote[q], here ? i : ( i < size ? this->at(this->quote[q], i+1) : -1 ));
+            }
+
+            //! `\s*((['"])(.*?)\11\s*)?\)`
+            int closeEnd = -1;
+            int titleEnd = -1;
+            if ( nonSpace < size && data.at(nonSpace) == ')' ) {
+                closeEnd = nonSpace + 1;
+            } else if ( nonSpace < size && ( data.at(nonSpace) == '"' || data.at(nonSpace) == '\'' ) ) {
+                int q = this->at(this->quote[data.at(nonSpace) == '"' ? 0 : 1], nonSpace+1);
+                if ( q != -1 ) {
+                    titleEnd = q;
+                    closeEnd = this->at(this->nonSpace, q+1) + 1;
+                }
+            }
+            this->append(this->closeEnd, closeEnd);
+            this->append(this->titleEnd, titleEnd);
+
+            //! `((?:(?:\(.*?\))|[^\(\)]))*?` followed by the above
+            int hrefEnd = -1;
+            if ( closeEnd != -1 ) {
+                hrefEnd = i;
+            } else if ( ch == '(' ) {
+                int close = this->at(this->goodClose, i+1);
+                hrefEnd = close != -1 ? this->at(this->hrefEnd, close+1) : -1;
+            } else if ( i < size && ch != ')' ) {
+                hrefEnd = this->at(this->hrefEnd, i+1);
+            }
+            bool good = ch == ')' && this->at(this->hrefEnd, i+1) != -1;
+            this->append(this->hrefEnd, hrefEnd);
+            this->append(this->goodClose, good ? i : ( i < size ? this->at(this->goodClose, i+1) : -1 ));
+
+            //! `<.*?>` followed by the above
+            bool closesAngle = i < size && ch == '>' && this->at(this->closeEnd, i+1) != -1;
+            this->append(this->angleEnd, closesAngle ? i + 1 : ( i < size ? this->at(this->angleEnd, i+1) : -1 ));
+        }
+    }
+
+    int size;
+    QVector<int> nonSpace;   //!< first non-space at or after
+    QVector<int> quote[2];   //!< first `"` or `'` at or after that can close a title
+    QVector<int> closeEnd;   //!< end of `\s*(title)?\)` starting here
+    QVector<int> titleEnd;   //!< closing quote of its title
+    QVector<int> hrefEnd;    //!< end of the href starting here
+    QVector<int> angleEnd;   //!< end of the first `>` at or after that closes an `<href>`
+    QVector<int> goodClose;  //!< first `)` at or after that an href can go on from
+
+};
+
+}
+
+/*!
+ * What the scanners of LinkPattern.h keep between the scans of a text.
+ */
+struct LinkScanState::Tables
+{
+    Tables(void) :
+        size(-1), matchStart(-1), matchEnd(-1), resumeAt(0), skipped(false),
+        bracket("]"), angle(">)"), quote("\""), closingQuote("\""), paren(")")
+    {}
+
+    //! brings the tables up to date with data and returns where to scan from
+    int begin(const QString &data, int offset)
+    {
+        if ( this->size == -1 || this->matchStart == -1 ) {
+            this->tails.clear();
+            for ( NextIndex *next : {&this->bracket, &this->angle, &this->quote, &this->closingQuote, &this->paren} ) {
+                next->clear();
+            }
+            this->resumeAt = 0;
+            this->skipped = false;
+        } else {
+            this->tails.replaced(this->size, this->matchEnd);
+            int delta = data.size() - this->size;
+            for ( NextIndex *next : {&this->bracket, &this->angle, &this->quote, &this->closingQuote, &this->paren} ) {
+                next->replaced(this->matchStart, this->matchEnd, delta);
+            }
+            //! a match left as text is skipped, and the brackets open
+            //! before it are not seen again
+            this->skipped = offset > this->resumeAt;
+        }
+        this->size = data.size();
+        this->matchStart = -1;
+        return qMax(qMax(offset, 0), this->resumeAt);
+    }
+
+    void matched(const LinkMatch &m, int resume)
+    {
+        this->matchStart = m.start;
+        this->matchEnd = m.end;
+        this->resumeAt = this->skipped ? qMin(this->resumeAt, resume) : resume;
+    }
+
+    int size;           //!< of the text scanned last, -1 before the first scan
+    int matchStart;     //!< of the match returned last, -1 if none
+    int matchEnd;
+    int resumeAt;       //!< no new match can start before
+    bool skipped;       //!< this scan started after resumeAt
+    LinkTails tails;
+    NextIndex bracket, angle, quote, closingQuote, paren;
+};
+
+LinkScanState::LinkScanState() :
+    tables(new Tables())
+{}
+
+LinkScanState::~LinkScanState()
+{}
+
+namespace {
+
+//! the tables of state, or of own when there is none
+LinkScanState::Tables &tablesOf(LinkScanState *state, LinkScanState &own)
+{
+    return *( state != nullptr ? state : &own )->tables;
+}
+
+/*!
+ * `[text]` followed by a part the `tail` function takes apart, for the
+ * `[` not preceded by `!` (or preceded by one when `image` is set).
+ *
+ * Brackets are paired in one pass the way the nested groups of BRK match
+ * them, at any depth: a pair only holds text, then adjacent pairs, then
+ * text; a pair with text between two inner pairs does not match.  Every
+ * pair is a candidate as it closes, and the one that starts first wins
+ * once no bracket is open any more.
+ */
+template <typename Tail>
+LinkMatch scanBrackets(const QString &data, int offset, bool image, LinkScanState::Tables &tables, Tail tail)
+{
+    struct Open
+    {
+        int index;
+        bool pairs;     //!< closed an inner pair
+        bool text;      //!< text after that
+        bool valid;
+    };
+    int first = tables.begin(data, offset);
+    LinkMatch best = NO_LINK;
+    int resume = 0;
+    QVector<Open> open;
+    for ( int i = image ? first+1 : first; i < data.size(); ++i ) {
+        QChar ch = data.at(i);
+        if ( ch == '[' ) {
+            if ( ! open.isEmpty() && open.last().text ) {
+                open.last().valid = false;
+            }
+            Open o = {i, false, false, true};
+            open.append(o);
+        } else if ( ch == ']' ) {
+            if ( open.isEmpty() ) {
+                continue;
+            }
+            Open o = open.takeLast();
+            if ( ! open.isEmpty() ) {
+                open.last().pairs = true;
+                open.last().valid = open.last().valid && o.valid;
+            }
+            int start = image ? o.index - 1 : o.index;
+            bool candidate = image ? data.at(start) == '!' : ( start == 0 || data.at(start-1) != '!' );
+            if ( o.valid && candidate && ( best.start == -1 || start < best.start ) ) {
+                LinkMatch m = {start, -1, data.mid(o.index+1, i-o.index-1), QString(), QString()};
+                if ( tail(i+1, m) ) {
+                    best = m;
+                    //! the outermost open bracket may pair up once the
+                    //! match is a placeholder
+                    resume = open.isEmpty() ? start : ( image ? open.first().index - 1 : open.first().index );
+                }
+            }
+            if ( open.isEmpty() && best.start != -1 ) {
+                break;
+            }
+        } else if ( ! open.isEmpty() && open.last().pairs ) {
+            open.last().text = true;
+        }
+    }
+    tables.matched(best, resume);
+    return best;
+}
+
+//! `\s?\[([^\]]*)\]` of REFERENCE_RE and IMAGE_REFERENCE_RE
+LinkMatch scanReferenceIds(const QString &data, int offset, bool image, LinkScanState *state)
+{
+    LinkScanState own;
+    LinkScanState::Tables &tables = tablesOf(state, own);
+    return scanBrackets(data, offset, image, tables, [&](int index, LinkMatch &m) -> bool {
+        if ( index < data.size() && data.at(index).isSpace() && index+1 < data.size() && data.at(index+1) == '[' ) {
+            index += 1;
+        }
+        if ( index >= data.size() || data.at(index) != '[' ) {
+            return false;
+        }
+        int close = tables.bracket.at(data, index+1);
+        if ( close == -1 ) {
+            return false;
+        }
+        m.href = data.mid(index+1, close-index-1);
+        m.end = close + 1;
+        return true;
+    });
+}
+
+}
+
+LinkMatch scanLink(const QString &data, int offset, LinkScanState *state)
+{
+    LinkScanState own;
+    LinkScanState::Tables &tables = tablesOf(state, own);
+    return scanBrackets(data, offset, false, tables, [&](int index, LinkMatch &m) -> bool {
+        if ( index >= data.size() || data.at(index) != '(' ) {
+            return false;
+        }
+        return tables.tails.match(data, index, m);
+    });
+}
+
+LinkMatch scanImageLink(const QString &data, int offset, LinkScanState *state)
+{
+    LinkScanState own;
+    LinkScanState::Tables &tables = tablesOf(state, own);
+    return scanBrackets(data, offset, true, tables, [&](int index, LinkMatch &m) -> bool {
+        index = skipSpaces(data, index);
+        if ( index >= data.size() || data.at(index) != '(' ) {
+            return false;
+        }
+        int begin = index + 1;
+        int end = -1;
+        //! `<.*?>`
+        if ( begin < data.size() && data.at(begin) == '<' ) {
+            int found = tables.angle.at(data, begin+1);
+            end = found != -1 ? found + 1 : -1;
+        }
+        //! `[^")]+"[^"]*"`
+        int close = tables.paren.at(data, begin);
+        if ( end == -1 ) {
+            int open = tables.quote.at(data, begin);
+            if ( open > begin && ( close == -1 || open < close ) ) {
+                int found = tables.closingQuote.at(data, open+1);
+                if ( found != -1 && found+1 < data.size() && data.at(found+1) == ')' ) {
+                    end = found + 1;
+                }
+            }
+        }
+        //! `[^\)]*`
+        if ( end == -1 ) {
+            end = close;
+        }
+        if ( end == -1 ) {
+            return false;
+        }
+        m.href = data.mid(begin, end-begin);
+        m.end = end + 1;
+        return true;
+    });
+}
+
+LinkMatch scanReference(const QString &data, int offset, LinkScanState *state)
+{
+    return scanReferenceIds(data, offset, false, state);
+}
+
+LinkMatch scanImageReference(const QString &data, int offset, LinkScanState *state)
+{
+    return scanReferenceIds(data, offset, true, state);
+}
+
+LinkMatch scanShortReference(const QString &data, int offset, LinkScanState *state)
+{
+    LinkScanState own;
+    LinkScanState::Tables &tables = tablesOf(state, own);
+    LinkMatch m = NO_LINK;
+    for ( int i = tables.begin(data, offset); i+1 < data.size(); ++i ) {
+        if ( data.at(i) != '[' || ( i > 0 && data.at(i-1) == '!' ) ) {
+            continue;
+        }
+        //! `[^\]]+` does not pair brackets
+        int close = tables.bracket.at(data, i+1);
+        if ( close == -1 ) {
+            break;
+        }
+        if ( close > i+1 ) {
+            m = {i, close+1, data.mid(i+1, close-i-1), QString(), QString()};
+            break;
+        }
+    }
+    tables.matched(m, m.start);
+    return m;
+}
+
+
 LinkPattern::LinkPattern(const QString& pattern, const std::weak_ptr<Markdown> &md) :
-    Pattern(pattern, md)
+    Pattern(pattern, md),
+    scanner(nullptr)
 {}
 LinkPattern::~LinkPattern(void)
 {}
 
-Element LinkPattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
+Element LinkPattern::handleMatch(const ElementTree &doc, const QRegularExpressionMatch &m)
+{
+    LinkMatch parts = {m.capturedStart(), m.capturedEnd(), m.captured(1), m.captured(8), m.captured(12)};
+    return this->handleMatch(doc, parts);
+}
+
+void LinkPattern::setScanner(LinkScanner scanner)
+{
+    this->scanner = scanner;
+}
+
+bool LinkPattern::scans(void) const
+{
+    return this->scanner != nullptr;
+}
+
+std::tuple<int, int, Element> LinkPattern::scan(const QString &data, int offset, ScanStatePtr &state)
+{
+    if ( ! state ) {
+        state.reset(new LinkScanState());
+    }
+    LinkMatch m = this->scanner(data, offset, static_cast<LinkScanState *>(state.get()));
+    if ( m.start == -1 ) {
+        return std::make_tuple(-1, -1, Element());
+    }
+    return std::make_tuple(m.start, m.end, this->handleMatch(ElementTree(), m));
+}
+
+Element LinkPattern::handleMatch(const ElementTree &, const LinkMatch &m)
 {
     Element el = createElement("a");
-    el->text = m.captured(2);
-    QString title = m.captured(13);
-    QString href  = m.captured(9);
+    el->text = m.text;
+    QString title = m.title;
+    QString href  = m.href;
 
     if ( ! href.isEmpty() ) {
         if ( href.startsWith('<') ) {
@@ -108,12 +575,12 @@ ImagePattern::ImagePattern(const QString &pattern, const std::weak_ptr<Markdown>
     LinkPattern(pattern, md)
 {}
 
-Element ImagePattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
+Element ImagePattern::handleMatch(const ElementTree &, const LinkMatch &m)
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
 
     Element el = createElement("img");
-    QString src_parts_source = m.captured(9);
+    QString src_parts_source = m.href;
     QStringList src_parts = pypp::split(src_parts_source);
     if ( ! src_parts.isEmpty() ) {
         QString src = src_parts.at(0);
@@ -131,9 +598,9 @@ Element ImagePattern::handleMatch(const ElementTree &, const QRegularExpressionM
 
     QString truealt;
     if ( markdown->enable_attributes() ) {
-        truealt = handleAttributes(m.captured(2), el);
+        truealt = handleAttributes(m.text, el);
     } else {
-        truealt = m.captured(2);
+        truealt = m.text;
     }
 
     el->set("alt", this->unescape(truealt));
@@ -146,33 +613,33 @@ QString ImagePattern::type(void) const
 
 ReferencePattern::ReferencePattern(const QString &pattern, const std::weak_ptr<Markdown> &md) :
     LinkPattern(pattern, md),
-    NEWLINE_CLEANUP_RE("[ ]?\\n", QRegularExpression::MultilineOption)
+    NEWLINE_CLEANUP_RE(RegexCache::compile("[ ]?\\n", QRegularExpression::MultilineOption))
 {}
 ReferencePattern::~ReferencePattern(void)
 {}
 
-Element ReferencePattern::handleMatch(const ElementTree &doc, const QRegularExpressionMatch &m)
+Element ReferencePattern::handleMatch(const ElementTree &doc, const LinkMatch &m)
 {
-    std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    const Markdown::Reference &references = Context::current().references;
 
     QString id;
-    if ( m.capturedTexts().size() > 8 && ! m.captured(9).isEmpty() ) {
-        id = m.captured(9);
+    if ( ! m.href.isEmpty() ) {
+        id = m.href;
     } else {
         //! if we got something like "[Google][]" or "[Goggle]"
         //! we'll use "google" as the id
-        id = m.captured(2);
+        id = m.text;
     }
     id = id.toLower();
 
     //! Clean up linebreaks in id
     id = id.replace(this->NEWLINE_CLEANUP_RE, " ");
-    if ( ! markdown->references.contains(id) ) {
+    if ( ! references.contains(id) ) {
         return Element();
     }
-    Markdown::ReferenceItem item = markdown->references[id];
+    Markdown::ReferenceItem item = references[id];
 
-    QString text = m.captured(2);
+    QString text = m.text;
     return this->makeTag(doc, item.first, item.second, text);
 }
 
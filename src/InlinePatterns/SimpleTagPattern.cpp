@@ -15,7 +15,7 @@ SimpleTagPattern::~SimpleTagPattern()
 Element SimpleTagPattern::handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
 {
     Element el = createElement(this->tag);
-    el->text = m.captured(3);
+    el->text = m.captured(2);
     return el;
 }
 
@@ -45,9 +45,9 @@ Element DoubleTagPattern::handleMatch(const ElementTree &, const QRegularExpress
     QStringList tags = this->tag.split(",");
     Element el1 = createElement(tags.at(0));
     Element el2 = createSubElement(el1, tags.at(1));
-    el2->text = m.captured(3);
-    if ( ! m.captured(4).isEmpty() ) {
-        el2->tail = m.captured(4);
+    el2->text = m.captured(2);
+    if ( ! m.captured(3).isEmpty() ) {
+        el2->tail = m.captured(3);
     }
     return el1;
 }
@@ -11,7 +11,7 @@ SimpleTextPattern::SimpleTextPattern(const QString &pattern, const std::weak_ptr
 
 boost::optional<QString> SimpleTextPattern::handleMatch(const QRegularExpressionMatch &m)
 {
-    QString text = m.captured(2);
+    QString text = m.captured(1);
     if ( text == util::INLINE_PLACEHOLDER_PREFIX ) {
         return boost::none;
     }
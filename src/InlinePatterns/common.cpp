@@ -1,6 +1,7 @@
 #include "InlinePatterns/common.h"
 
 #include "pypp/re.hpp"
+#include "RegexCache.h"
 
 namespace markdown
 {
@@ -14,31 +15,31 @@ const QString BRK = ( "\\[("
 const QString NOIMG = "(?<!\\!)";
 
 //! `e=f()` or ``e=f("`")``
-const QString BACKTICK_RE = "(?<!\\\\)(`+)(.+?)(?<!`)\\2(?!`)";
+const QString BACKTICK_RE = "(?<!\\\\)(`+)(.+?)(?<!`)\\1(?!`)";
 
 //! \<
 const QString ESCAPE_RE = "\\\\(.)";
 
 //! *emphasis*
-const QString EMPHASIS_RE = "(\\*)([^\\*]+)\\2";
+const QString EMPHASIS_RE = "(\\*)([^\\*]+)\\1";
 
 //! **strong**
-const QString STRONG_RE = "(\\*{2}|_{2})(.+?)\\2";
+const QString STRONG_RE = "(\\*{2}|_{2})(.+?)\\1";
 
 //! ***strongem*** or ***em*strong**
-const QString EM_STRONG_RE = "(\\*|_)\\2{2}(.+?)\\2(.*?)\\2{2}";
+const QString EM_STRONG_RE = "(\\*|_)\\1{2}(.+?)\\1(.*?)\\1{2}";
 
 //! ***strong**em*
-const QString STRONG_EM_RE = "(\\*|_)\\2{2}(.+?)\\2{2}(.*?)\\2";
+const QString STRONG_EM_RE = "(\\*|_)\\1{2}(.+?)\\1{2}(.*?)\\1";
 
 //! _smart_emphasis_
-const QString SMART_EMPHASIS_RE = "(?<!\\w)(_)(?!_)(.+?)(?<!_)\\2(?!\\w)";
+const QString SMART_EMPHASIS_RE = "(?<!\\w)(_)(?!_)(.+?)(?<!_)\\1(?!\\w)";
 
 //! _emphasis_
-const QString EMPHASIS_2_RE = "(_)(.+?)\\2";
+const QString EMPHASIS_2_RE = "(_)(.+?)\\1";
 
 //! [text](url) or [text](<url>) or [text](url "title")
-const QString LINK_RE = NOIMG + BRK + "\\(\\s*(<.*?>|((?:(?:\\(.*?\\))|[^\\(\\)]))*?)\\s*((['\"])(.*?)\\12\\s*)?\\)";
+const QString LINK_RE = NOIMG + BRK + "\\(\\s*(<.*?>|((?:(?:\\(.*?\\))|[^\\(\\)]))*?)\\s*((['\"])(.*?)\\11\\s*)?\\)";
 
 //! ![alttxt](http://x.com/) or ![alttxt](<http://x.com/>)
 const QString IMAGE_LINK_RE = "\\!" + BRK + "\\s*\\((<.*?>|([^\")]+\"[^\"]*\"|[^\\)]*))\\)";
@@ -70,6 +71,193 @@ const QString ENTITY_RE = "(&[\\#a-zA-Z0-9]*;)";
 //! two spaces at end of line
 const QString LINE_BREAK_RE = "  \\n";
 
+namespace {
+
+//! index of a delimiter in per-delimiter state, or -1
+int delimiter(QChar ch)
+{
+    if ( ch == '*' ) {
+        return 0;
+    } else if ( ch == '_' ) {
+        return 1;
+    }
+    return -1;
+}
+
+//! `\w` for the character starting at index
+bool isWordAt(const QString &data, int index)
+{
+    if ( index < 0 || index >= data.size() ) {
+        return false;
+    }
+    QChar ch = data.at(index);
+    uint ucs4 = ch.unicode();
+    if ( ch.isHighSurrogate() && index+1 < data.size() && data.at(index+1).isLowSurrogate() ) {
+        ucs4 = QChar::surrogateToUcs4(ch, data.at(index+1));
+    }
+    return ucs4 == '_' || QChar::isLetterOrNumber(ucs4);
+}
+
+//! `\w` for the character ending before index
+bool isWordBefore(const QString &data, int index)
+{
+    if ( index <= 0 || index > data.size() ) {
+        return false;
+    }
+    int begin = index - 1;
+    if ( data.at(begin).isLowSurrogate() && begin > 0 && data.at(begin-1).isHighSurrogate() ) {
+        begin -= 1;
+    }
+    return isWordAt(data, begin);
+}
+
+//! `$` without the multiline option: the end or before a final newline
+bool isEnd(const QString &data, int index)
+{
+    return index == data.size() || ( index == data.size()-1 && data.at(index) == '\n' );
+}
+
+//! `delimiter{count}` starting at index
+bool isRun(const QString &data, int index, QChar ch, int count)
+{
+    if ( index + count > data.size() ) {
+        return false;
+    }
+    for ( int i = index; i < index+count; ++i ) {
+        if ( data.at(i) != ch ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+/*!
+ * All of them scan forward only.  A candidate start that has a closing
+ * delimiter is the match; one that has none means no later run of the same
+ * delimiter has one either, so each delimiter is given up on at most once.
+ */
+
+int locateNotStrong(const QString &data, int offset)
+{
+    //! `^` only matches at the beginning of the text
+    if ( offset == 0 && data.size() > 0 && delimiter(data.at(0)) != -1 ) {
+        if ( ( data.size() > 1 && data.at(1) == ' ' ) || isEnd(data, 1) ) {
+            return 0;
+        }
+    }
+    for ( int i = qMax(offset, 0); i+1 < data.size(); ++i ) {
+        if ( data.at(i) == ' ' && delimiter(data.at(i+1)) != -1 ) {
+            if ( ( i+2 < data.size() && data.at(i+2) == ' ' ) || isEnd(data, i+2) ) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+int locateEmStrong(const QString &data, int offset)
+{
+    bool open[2] = {true, true};
+    for ( int i = qMax(offset, 0); i+2 < data.size(); ++i ) {
+        QChar ch = data.at(i);
+        int d = delimiter(ch);
+        if ( d == -1 || ! open[d] || ! isRun(data, i, ch, 3) ) {
+            continue;
+        }
+        //! `(.+?)\1` closes at the first delimiter after the body,
+        //! `(.*?)\1{2}` at any double one after that
+        int close = data.indexOf(ch, i+4);
+        if ( close != -1 && data.indexOf(QString(2, ch), close+1) != -1 ) {
+            return i;
+        }
+        open[d] = false;
+    }
+    return -1;
+}
+
+int locateStrongEm(const QString &data, int offset)
+{
+    bool open[2] = {true, true};
+    for ( int i = qMax(offset, 0); i+2 < data.size(); ++i ) {
+        QChar ch = data.at(i);
+        int d = delimiter(ch);
+        if ( d == -1 || ! open[d] || ! isRun(data, i, ch, 3) ) {
+            continue;
+        }
+        //! `(.+?)\1{2}` closes at the first double delimiter after the body,
+        //! `(.*?)\1` at any delimiter after that
+        int close = data.indexOf(QString(2, ch), i+4);
+        if ( close != -1 && data.indexOf(ch, close+2) != -1 ) {
+            return i;
+        }
+        open[d] = false;
+    }
+    return -1;
+}
+
+int locateStrong(const QString &data, int offset)
+{
+    bool open[2] = {true, true};
+    for ( int i = qMax(offset, 0); i+1 < data.size(); ++i ) {
+        QChar ch = data.at(i);
+        int d = delimiter(ch);
+        if ( d == -1 || ! open[d] || data.at(i+1) != ch ) {
+            continue;
+        }
+        if ( data.indexOf(QString(2, ch), i+3) != -1 ) {
+            return i;
+        }
+        open[d] = false;
+    }
+    return -1;
+}
+
+int locateEmphasis(const QString &data, int offset)
+{
+    for ( int i = qMax(offset, 0); i+1 < data.size(); ++i ) {
+        if ( data.at(i) != '*' || data.at(i+1) == '*' ) {
+            continue;
+        }
+        //! `[^\*]+` runs up to the next `*`
+        return data.indexOf('*', i+2) != -1 ? i : -1;
+    }
+    return -1;
+}
+
+int locateEmphasis2(const QString &data, int offset)
+{
+    int i = data.indexOf('_', qMax(offset, 0));
+    if ( i == -1 ) {
+        return -1;
+    }
+    return data.indexOf('_', i+2) != -1 ? i : -1;
+}
+
+int locateSmartEmphasis(const QString &data, int offset)
+{
+    for ( int i = qMax(offset, 0); i+1 < data.size(); ++i ) {
+        if ( data.at(i) != '_' || data.at(i+1) == '_' || isWordBefore(data, i) ) {
+            continue;
+        }
+        //! `(?<!_)\1(?!\w)`: the first `_` after the body that neither
+        //! follows another one nor precedes a word character
+        for ( int close = data.indexOf('_', i+2); close != -1; close = data.indexOf('_', close+1) ) {
+            if ( data.at(close-1) != '_' && ! isWordAt(data, close+1) ) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    return -1;
+}
+
+bool isWordBoundary(const QString &data, int index)
+{
+    return isWordBefore(data, index) != isWordAt(data, index);
+}
+
 //! Remove quotes from around a string.
 QString dequote(const QString &string)
 {
@@ -87,14 +275,14 @@ QString itertext(const Element &elem)
         return QString();
     }
     QString result = elem->text;
-    for ( int i = 0; i < elem->size(); ++i ) {
-        result += itertext((*elem)[i]);
-        result += (*elem)[i]->tail;
+    for ( const Element &e : (*elem) ) {
+        result += itertext(e);
+        result += e->tail;
     }
     return result;
 }
 
-const QRegularExpression ATTR_RE("\\{@([^\\}]*)=([^\\}]*)\\}");
+const QRegularExpression ATTR_RE = RegexCache::compile("\\{@([^\\}]*)=([^\\}]*)\\}");
 
 QString handleAttributes(const QString &text, const Element &parent)
 {
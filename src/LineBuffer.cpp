@@ -0,0 +1,133 @@
+#include "LineBuffer.h"
+
+namespace markdown{
+
+LineBuffer::LineBuffer() :
+    source(),
+    added(),
+    lines()
+{}
+
+LineBuffer::LineBuffer(const QString &source) :
+    source(source),
+    added(),
+    lines()
+{
+    int begin = 0;
+    while ( true ) {
+        int end = this->source.indexOf('\n', begin);
+        if ( end == -1 ) {
+            this->lines.append(Span{begin, this->source.size()-begin, false});
+            break;
+        }
+        this->lines.append(Span{begin, end-begin, false});
+        begin = end + 1;
+    }
+}
+
+LineBuffer::LineBuffer(const QStringList &lines) :
+    LineBuffer(lines.join("\n"))
+{}
+
+int LineBuffer::size() const
+{
+    return this->lines.size();
+}
+
+bool LineBuffer::isEmpty() const
+{
+    return this->lines.isEmpty();
+}
+
+QStringRef LineBuffer::at(int index) const
+{
+    return this->text(this->lines.at(index));
+}
+
+QString LineBuffer::line(int index) const
+{
+    return this->at(index).toString();
+}
+
+const LineBuffer::Span &LineBuffer::span(int index) const
+{
+    return this->lines.at(index);
+}
+
+const LineBuffer::Spans &LineBuffer::spans() const
+{
+    return this->lines;
+}
+
+void LineBuffer::setSpans(const Spans &spans)
+{
+    this->lines = spans;
+}
+
+LineBuffer::Span LineBuffer::add(const QString &text)
+{
+    Span span = {this->added.size(), text.size(), true};
+    this->added.append(text);
+    return span;
+}
+
+void LineBuffer::append(const QString &line)
+{
+    this->lines.append(this->add(line));
+}
+
+QString LineBuffer::join(int first, int last) const
+{
+    if ( first >= last ) {
+        return QString();
+    }
+    //! lines that still follow each other in the source need no rejoining
+    bool contiguous = true;
+    for ( int i = first+1; i < last && contiguous; ++i ) {
+        const Span &prev = this->lines.at(i-1);
+        const Span &span = this->lines.at(i);
+        contiguous = ! prev.added && ! span.added && prev.begin+prev.length+1 == span.begin;
+    }
+    if ( contiguous && ! this->lines.at(first).added ) {
+        const Span &begin = this->lines.at(first);
+        const Span &end = this->lines.at(last-1);
+        return this->source.mid(begin.begin, end.begin+end.length-begin.begin);
+    }
+
+    int size = last - first - 1;
+    for ( int i = first; i < last; ++i ) {
+        size += this->lines.at(i).length;
+    }
+    QString result;
+    result.reserve(size);
+    for ( int i = first; i < last; ++i ) {
+        if ( i > first ) {
+            result.append('\n');
+        }
+        const Span &span = this->lines.at(i);
+        result.append((span.added ? this->added : this->source).unicode()+span.begin, span.length);
+    }
+    return result;
+}
+
+QString LineBuffer::join() const
+{
+    return this->join(0, this->size());
+}
+
+QStringList LineBuffer::toList() const
+{
+    QStringList result;
+    result.reserve(this->size());
+    for ( int i = 0; i < this->size(); ++i ) {
+        result.append(this->line(i));
+    }
+    return result;
+}
+
+QStringRef LineBuffer::text(const Span &span) const
+{
+    return QStringRef(span.added ? &this->added : &this->source, span.begin, span.length);
+}
+
+} // end of namespace markdown
@@ -0,0 +1,164 @@
+#include "LineIndex.h"
+
+namespace markdown{
+
+namespace {
+
+inline void insert_ascii(quint64 *mask, ushort ch)
+{
+    mask[ch >> 6] |= quint64(1) << (ch & 63);
+}
+
+inline bool isDigit(QChar ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+}
+
+LineIndex::LineIndex() :
+    LineIndex(QString())
+{}
+
+LineIndex::LineIndex(const QString &text) :
+    source(text),
+    lines(),
+    lineStarts(),
+    chars(),
+    nonAscii(false)
+{
+    const int size = text.size();
+    const QChar *data = text.constData();
+    int begin = 0;
+    while ( true ) {
+        Line line = {begin, 0, 0, QChar('\n'), true, NoMarker, 0};
+        int i = begin;
+        while ( i < size && data[i] == ' ' ) {
+            ++i;
+        }
+        line.indent = i - begin;
+        if ( line.indent > 0 ) {
+            insert_ascii(this->chars, ' ');
+        }
+        int p = i;
+        for ( ; i < size && data[i] != '\n'; ++i ) {
+            ushort ch = data[i].unicode();
+            if ( ch < 128 ) {
+                insert_ascii(this->chars, ch);
+            } else {
+                this->nonAscii = true;
+            }
+            if ( line.blank && ! data[i].isSpace() ) {
+                line.blank = false;
+            }
+        }
+        int end = i;
+        line.length = end - begin;
+
+        if ( p < end ) {
+            line.first = data[p];
+            QChar ch = data[p];
+            int q = p;
+            if ( isDigit(ch) ) {
+                while ( q < end && isDigit(data[q]) ) {
+                    ++q;
+                }
+                if ( q+1 < end && data[q] == '.' && data[q+1] == ' ' ) {
+                    line.marker = Ordered;
+                    q += 1;
+                }
+            } else if ( ( ch == '*' || ch == '+' || ch == '-' ) && p+1 < end && data[p+1] == ' ' ) {
+                line.marker = Bullet;
+                q = p + 1;
+            } else if ( ch == '>' ) {
+                line.marker = Quote;
+                q = p + 1;
+                if ( q < end && data[q] == ' ' ) {
+                    ++q;
+                }
+            } else if ( ch == '#' ) {
+                line.marker = Hash;
+                while ( q < end && data[q] == '#' ) {
+                    ++q;
+                }
+            }
+            if ( line.marker == Ordered || line.marker == Bullet ) {
+                while ( q < end && data[q] == ' ' ) {
+                    ++q;
+                }
+            }
+            line.content = line.marker == NoMarker ? line.indent : q - begin;
+        } else {
+            line.content = line.indent;
+        }
+        //! a line ending in its indentation starts with its newline
+        if ( line.indent < 4 && ( p < end ? data[p].unicode() < 128 : end < size ) ) {
+            insert_ascii(this->lineStarts[line.indent], line.first.unicode());
+        }
+        this->lines.append(line);
+
+        if ( end == size ) {
+            break;
+        }
+        insert_ascii(this->chars, '\n');
+        begin = end + 1;
+    }
+}
+
+const QString &LineIndex::text() const
+{
+    return this->source;
+}
+
+int LineIndex::size() const
+{
+    return this->lines.size();
+}
+
+const LineIndex::Line &LineIndex::at(int index) const
+{
+    return this->lines.at(index);
+}
+
+QStringRef LineIndex::line(int index) const
+{
+    const Line &line = this->lines.at(index);
+    return QStringRef(&this->source, line.begin, line.length);
+}
+
+QString LineIndex::mid(int index, int offset) const
+{
+    const Line &line = this->lines.at(index);
+    if ( offset >= line.length ) {
+        return QString();
+    }
+    return this->source.mid(line.begin+offset, line.length-offset);
+}
+
+QString LineIndex::join(int first, int last) const
+{
+    if ( first >= last ) {
+        return QString();
+    }
+    int begin = this->lines.at(first).begin;
+    const Line &end = this->lines.at(last-1);
+    return this->source.mid(begin, end.begin+end.length-begin);
+}
+
+int LineIndex::find(Marker marker, int maxIndent, int from) const
+{
+    for ( int i = qMax(from, 0); i < this->lines.size(); ++i ) {
+        const Line &line = this->lines.at(i);
+        if ( line.marker == marker && line.indent <= maxIndent ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool LineIndex::indexes(const QString &text) const
+{
+    return text.constData() == this->source.constData() && text.size() == this->source.size();
+}
+
+} // end of namespace markdown
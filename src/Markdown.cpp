@@ -7,11 +7,22 @@
 
 #include "Markdown.h"
 
+#include <limits>
+
+#include <QAtomicInt>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
 
 #include "PreProcessors.h"
 #include "BlockParser.h"
 #include "BlockProcessors.h"
+#include "Context.h"
 #include "Serializers.h"
 
 namespace markdown{
@@ -35,9 +46,6 @@ Markdown::Markdown(const safe_mode_type &safe_mode) :
     treeprocessors(),
     postprocessors(),
 
-    references(),
-    htmlStash(),
-
     serializer()
 {}
 
@@ -84,12 +92,21 @@ std::shared_ptr<Markdown> Markdown::registerExtension(const Extension::Ptr &exte
 
 std::shared_ptr<Markdown> Markdown::reset(void)
 {
-    this->htmlStash.reset();
-    this->references.clear();
+    Context::current().reset();
     //! TODO: extension
     return this->shared_from_this();
 }
 
+Markdown::Reference &Markdown::references(void)
+{
+    return Context::current().references;
+}
+
+HtmlStash &Markdown::htmlStash(void)
+{
+    return Context::current().htmlStash;
+}
+
 std::shared_ptr<Markdown> Markdown::set_output_format(const output_formats format)
 {
     if ( format == html || format == html4 || format == html5 ) {
@@ -101,6 +118,111 @@ std::shared_ptr<Markdown> Markdown::set_output_format(const output_formats forma
 }
 
 QString Markdown::convert(const QString &source)
+{
+    QString result;
+    StringSink sink(result);
+    this->convert(source, sink);
+    return result;
+}
+
+namespace {
+
+/*!
+ * Passes text on with the whitespace at both ends of the whole stream
+ * removed, like QString::trimmed() on the concatenation.  Whitespace is
+ * held back until it is known not to be trailing.
+ */
+class TrimmedSink : public SerializerSink
+{
+public:
+    explicit TrimmedSink(SerializerSink &sink) :
+        sink(sink), started(false), pending()
+    {}
+
+    using SerializerSink::write;
+    void write(const QChar *data, int size)
+    {
+        int begin = 0;
+        if ( ! this->started ) {
+            while ( begin < size && data[begin].isSpace() ) {
+                ++begin;
+            }
+            if ( begin == size ) {
+                return;
+            }
+            this->started = true;
+        }
+        int end = size;
+        while ( end > begin && data[end-1].isSpace() ) {
+            --end;
+        }
+        if ( end > begin ) {
+            if ( ! this->pending.isEmpty() ) {
+                this->sink.write(this->pending);
+                this->pending.clear();
+            }
+            this->sink.write(data+begin, end-begin);
+        }
+        this->pending.append(data+end, size-end);
+    }
+
+    void flush()
+    {
+        this->sink.flush();
+    }
+
+private:
+    SerializerSink &sink;
+    bool started;
+    QString pending;
+
+};
+
+/*!
+ * Decodes a UTF-8 file straight from its memory mapping, without reading
+ * it into a QByteArray first.  A leading byte order mark is skipped.
+ */
+bool readUtf8File(const QString &path, QString &text, QString *error=nullptr)
+{
+    QFile file(path);
+    if ( ! file.open(QIODevice::ReadOnly) ) {
+        if ( error != nullptr ) {
+            *error = QString("cannot open %1: %2").arg(path).arg(file.errorString());
+        }
+        return false;
+    }
+    text.clear();
+    if ( file.size() == 0 ) {
+        return true;
+    }
+    if ( file.size() > std::numeric_limits<int>::max() ) {
+        //! a QString could not hold it anyway
+        if ( error != nullptr ) {
+            *error = QString("cannot read %1: file is larger than 2 GB").arg(path);
+        }
+        return false;
+    }
+    const uchar *data = file.map(0, file.size());
+    if ( data == nullptr ) {
+        if ( error != nullptr ) {
+            *error = QString("cannot map %1: %2").arg(path).arg(file.errorString());
+        }
+        return false;
+    }
+    const char *bytes = reinterpret_cast<const char *>(data);
+    int size = static_cast<int>(file.size());
+    if ( size >= 3 && bytes[0] == '\xEF' && bytes[1] == '\xBB' && bytes[2] == '\xBF' ) {
+        bytes += 3;
+        size -= 3;
+    }
+    text = QString::fromUtf8(bytes, size);
+    file.unmap(const_cast<uchar *>(data));
+    return true;
+}
+
+}
+
+void Markdown::convert(const QString &source, SerializerSink &sink)
 {
     if ( ! this->initialized ) {
         this->initialize();
@@ -108,15 +230,53 @@ QString Markdown::convert(const QString &source)
 
     //! Fixup the source text
     if ( source.trimmed().isEmpty() ) {
-        return QString();  //!< a blank unicode string
-	}
+        return;
+    }
+
+    //! Everything this document accumulates lives in its own context,
+    //! the elements in the context's arena; both go away in one go
+    //! once the conversion returns.
+    Context context;
+    Context::Scope scope(context);
+
+    Element root = this->buildTree(source);
 
-    QString source_ = source;
+    TrimmedSink output(sink);
+    this->render(root, output);
+    output.flush();
+}
+
+std::shared_ptr<Markdown> Markdown::convertFile(const QString &input, QIODevice *output)
+{
+    QString source, error;
+    if ( ! readUtf8File(input, source, &error) ) {
+        throw pypp::IOError(error.toStdString());
+    }
+
+    DeviceSink sink(output);
+    this->convert(source, sink);
+    if ( sink.hasError() ) {
+        throw pypp::IOError(QString("cannot write output: %1").arg(sink.errorString()).toStdString());
+    }
+    return this->shared_from_this();
+}
 
-    //! Split into lines and run the line preprocessors.
-    QStringList lines = source_.split("\n");
+std::shared_ptr<Markdown> Markdown::convertFile(const QString &input, const QString &output)
+{
+    QFile file(output);
+    if ( ! file.open(QIODevice::WriteOnly | QIODevice::Truncate) ) {
+        throw pypp::IOError(QString("cannot open %1: %2").arg(output).arg(file.errorString()).toStdString());
+    }
+    return this->convertFile(input, &file);
+}
+
+Element Markdown::buildTree(const QString &source)
+{
+    //! Split into lines and run the line preprocessors, all on spans
+    //! over the one source buffer.
+    LineBuffer lines(source);
     for ( OrderedDictProcessors::ValueType pre : this->preprocessors.toList() ) {
-        lines = pre->run(lines);
+        pre->run(lines);
     }
 
     //! Parse the high-level elements.
@@ -124,13 +284,33 @@ QString Markdown::convert(const QString &source)
     Element root = doc.getroot();
 
     //! Run the tree-processors
-    for ( OrderedDictTreeProcessors::ValueType tree : this->treeprocessors.toList() ) {
-        Element newRoot = tree->run(root);
-        if ( newRoot ) {
-            root = newRoot;
-        }
+    return run_treeprocessors(this->treeprocessors.toList(), root);
+}
+
+void Markdown::render(Element &root, SerializerSink &sink)
+{
+    const QList<OrderedDictPostProcessors::ValueType> postprocessors = this->postprocessors.toList();
+    bool blockwise = this->stripTopLevelTags && root->tag == this->doc_tag() && root->attrib.isEmpty() && root->text.trimmed().isEmpty();
+    for ( const OrderedDictPostProcessors::ValueType &post : postprocessors ) {
+        blockwise = blockwise && post->blockwise();
+    }
+    if ( ! blockwise ) {
+        sink.write(this->render(root));
+        return;
     }
 
+    //! The top-level tags are left out by serializing the blocks inside
+    //! them one at a time, each going through the post-processors and on
+    //! into the sink before the next one.  The text before them is only
+    //! the whitespace the prettifier put there.
+    sink.write(root->text);
+    for ( Element block : *root ) {
+        sink.write(this->postprocess(this->serializer(block)));
+    }
+}
+
+QString Markdown::render(Element &root)
+{
     //! Serialize _properly_.  Strip top-level tags.
     QString output;
     output = this->serializer(root);
@@ -138,23 +318,179 @@ QString Markdown::convert(const QString &source)
         int begin = output.indexOf(QString("<%1>").arg(this->doc_tag()));
         int end   = output.lastIndexOf(QString("</%1>").arg(this->doc_tag()));
         if ( begin != -1 && end != -1 ) {
-            output = output.mid(begin+this->doc_tag().size()+2, end-this->doc_tag().size()-2);
+            //! in place, the serialized tree is the only copy
+            output.truncate(end);
+            output.remove(0, begin+this->doc_tag().size()+2);
         } else {
             return QString();
         }
     }
 
+    return this->postprocess(output);
+}
+
+QString Markdown::postprocess(const QString &text)
+{
     //! Run the text post-processors
+    QString output = text;
     for ( OrderedDictPostProcessors::ValueType post : this->postprocessors.toList() ) {
         output = post->run(output);
     }
+    return output;
+}
 
-    return output.trimmed();
+double Markdown::BatchStats::documentsPerSecond() const
+{
+    return this->elapsed > 0 ? this->documents * 1000.0 / this->elapsed : 0.0;
 }
 
-std::shared_ptr<Markdown> Markdown::convertFile(/*input, output, encoding=L"utf-8"*/)
+double Markdown::BatchStats::charactersPerSecond() const
 {
-    return this->shared_from_this();
+    return this->elapsed > 0 ? this->characters * 1000.0 / this->elapsed : 0.0;
+}
+
+namespace {
+
+/*!
+ * Shared by the workers of one batch.  Workers take the next document
+ * off a single counter, so whoever is free picks up the remaining work.
+ */
+struct BatchQueue
+{
+    Markdown *markdown;
+    int count;
+    std::function<bool(int, QString &)> source;
+    Markdown::BatchCallback callback;
+
+    QAtomicInt next;
+
+    QMutex mutex;
+    int documents;
+    int failures;
+    qint64 characters;
+};
+
+class BatchWorker : public QRunnable
+{
+public:
+    explicit BatchWorker(BatchQueue *queue) :
+        queue(queue)
+    {}
+
+    void run()
+    {
+        int documents = 0, failures = 0;
+        qint64 characters = 0;
+        for ( int i = this->queue->next.fetchAndAddRelaxed(1); i < this->queue->count; i = this->queue->next.fetchAndAddRelaxed(1) ) {
+            QString source;
+            QString html;
+            bool converted = false;
+            //! an exception must not leave run(), it would end the process
+            try {
+                if ( this->queue->source(i, source) ) {
+                    html = this->queue->markdown->convert(source);
+                    converted = true;
+                }
+            } catch ( ... ) {
+                html.clear();
+            }
+            try {
+                this->queue->callback(i, html);
+            } catch ( ... ) {
+                converted = false;
+            }
+            if ( converted ) {
+                characters += source.size();
+                documents += 1;
+            } else {
+                failures += 1;
+            }
+        }
+        //! totals are merged once per worker, not per document
+        QMutexLocker locker(&this->queue->mutex);
+        this->queue->documents += documents;
+        this->queue->failures += failures;
+        this->queue->characters += characters;
+    }
+
+private:
+    BatchQueue *queue;
+
+};
+
+}
+
+void Markdown::runBatch(int count, const std::function<bool(int, QString &)> &source, const BatchCallback &callback, BatchStats *stats, int threads)
+{
+    //! workers must not race to build the parser
+    if ( ! this->initialized ) {
+        this->initialize();
+    }
+    if ( threads <= 0 ) {
+        threads = QThread::idealThreadCount();
+    }
+    threads = qMax(1, qMin(threads, count));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    BatchQueue queue;
+    queue.markdown = this;
+    queue.count = count;
+    queue.source = source;
+    queue.callback = callback;
+    queue.documents = 0;
+    queue.failures = 0;
+    queue.characters = 0;
+
+    if ( count > 0 ) {
+        QThreadPool pool;
+        pool.setMaxThreadCount(threads);
+        for ( int i = 0; i < threads; ++i ) {
+            pool.start(new BatchWorker(&queue));
+        }
+        pool.waitForDone();
+    }
+
+    if ( stats ) {
+        stats->documents = queue.documents;
+        stats->failures = queue.failures;
+        stats->characters = queue.characters;
+        stats->elapsed = timer.elapsed();
+        stats->threads = threads;
+    }
+}
+
+QStringList Markdown::convertBatch(const QStringList &sources, BatchStats *stats, int threads)
+{
+    //! every worker writes its own slots only
+    QVector<QString> results(sources.size());
+    this->convertBatch(sources, [&](int index, const QString &html){ results[index] = html; }, stats, threads);
+    return results.toList();
+}
+
+void Markdown::convertBatch(const QStringList &sources, const BatchCallback &callback, BatchStats *stats, int threads)
+{
+    auto source = [&](int index, QString &text) -> bool {
+        text = sources.at(index);
+        return true;
+    };
+    this->runBatch(sources.size(), source, callback, stats, threads);
+}
+
+QStringList Markdown::convertFiles(const QStringList &paths, BatchStats *stats, int threads)
+{
+    QVector<QString> results(paths.size());
+    this->convertFiles(paths, [&](int index, const QString &html){ results[index] = html; }, stats, threads);
+    return results.toList();
+}
+
+void Markdown::convertFiles(const QStringList &paths, const BatchCallback &callback, BatchStats *stats, int threads)
+{
+    auto source = [&](int index, QString &text) -> bool {
+        return readUtf8File(paths.at(index), text);
+    };
+    this->runBatch(paths.size(), source, callback, stats, threads);
 }
 
 std::shared_ptr<Markdown> create_Markdown(const Markdown::safe_mode_type &safe_mode)
@@ -20,6 +20,9 @@ PostProcessor::PostProcessor(const std::weak_ptr<Markdown> &markdown_instance) :
 PostProcessor::~PostProcessor(void)
 {}
 
+bool PostProcessor::blockwise(void) const
+{ return false; }
+
 
 OrderedDictPostProcessors build_postprocessors(const std::shared_ptr<Markdown> &md_instance)
 {
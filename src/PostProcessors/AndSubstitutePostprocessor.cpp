@@ -14,4 +14,7 @@ QString AndSubstitutePostprocessor::run(const QString &text)
     return QString(text).replace(util::AMP_SUBSTITUTE, "&");
 }
 
+bool AndSubstitutePostprocessor::blockwise(void) const
+{ return true; }
+
 } // namespace markdown
@@ -1,18 +1,42 @@
 #include "PostProcessors/RawHtmlPostprocessor.h"
 
+#include "Context.h"
 #include "Markdown.h"
+#include "RegexCache.h"
 #include "util.h"
 
 namespace markdown
 {
 
+namespace {
+
+const QRegularExpression TAG_RE = RegexCache::compile("^\\<\\/?([^ >]+)");
+
+}
+
 QString RawHtmlPostprocessor::run(const QString &text)
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    const HtmlStash &htmlStash = Context::current().htmlStash;
 
-    OrderedDict<QString> replacements;
-    for ( int i = 0; i < markdown->htmlStash.html_counter; ++i ) {
-        HtmlStash::Item item = markdown->htmlStash.rawHtmlBlocks[i];
+    const QChar stx = util::STX.at(0);
+    int i = text.indexOf(stx);
+    if ( i == -1 || htmlStash.html_counter == 0 ) {
+        return text;
+    }
+    //! replaces every placeholder in one pass; what was put in is not
+    //! looked at again
+    QString result;
+    result.reserve(text.size());
+    int start = 0;
+    for ( ; i != -1; i = text.indexOf(stx, i) ) {
+        int end;
+        int key = htmlStash.placeholderKey(text, i, &end);
+        if ( key == -1 ) {
+            ++i;
+            continue;
+        }
+        const HtmlStash::Item &item = htmlStash.rawHtmlBlocks.at(key);
         QString html = item.first;
         bool safe = item.second;
         if ( markdown->safeMode() != Markdown::default_mode && ! safe ) {
@@ -24,21 +48,28 @@ QString RawHtmlPostprocessor::run(const QString &text)
                 html = markdown->html_replacement_text();
             }
         }
-        if ( this->isblocklevel(html) && ( safe || ! markdown->safeMode() ) ) {
-            replacements[QString("<p>%1</p>").arg(markdown->htmlStash.get_placeholder(i))] = html+"\n";
+        //! a block on its own is unwrapped from the paragraph around it
+        if ( i-3 >= start && text.midRef(i-3, 3) == QLatin1String("<p>") && text.midRef(end, 4) == QLatin1String("</p>")
+             && this->isblocklevel(html) && ( safe || ! markdown->safeMode() ) ) {
+            result.append(text.constData()+start, i-3-start);
+            result.append(html);
+            result.append('\n');
+            start = end + 4;
+        } else {
+            result.append(text.constData()+start, i-start);
+            result.append(html);
+            start = end;
         }
-        replacements[markdown->htmlStash.get_placeholder(i)] = html;
-    }
-    QString result = text;
-    if ( replacements.size() > 0 ) {
-        pypp::str pattern = pypp::map(pypp::re::escape, replacements.keys()).join("|");
-        result = pypp::re::sub(QRegularExpression(pattern), [&](const QRegularExpressionMatch &m) -> pypp::str {
-            return replacements[m.captured()];
-        }, result);
+        i = start;
     }
+    result.append(text.constData()+start, text.size()-start);
     return result;
 }
 
+//! a placeholder and the paragraph around it are always within one block
+bool RawHtmlPostprocessor::blockwise(void) const
+{ return true; }
+
 QString RawHtmlPostprocessor::escape(const QString &html)
 {
     QString result = html;
@@ -51,7 +82,7 @@ QString RawHtmlPostprocessor::escape(const QString &html)
 
 bool RawHtmlPostprocessor::isblocklevel(const QString &html)
 {
-    QRegularExpressionMatch m = QRegularExpression("^\\<\\/?([^ >]+)").match(html);
+    QRegularExpressionMatch m = TAG_RE.match(html);
     if ( m.hasMatch() ) {
         QChar ch = m.captured(1).at(0);
         // SPECIAL_CHARS: !, ?, @, %
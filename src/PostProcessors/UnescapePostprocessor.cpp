@@ -1,13 +1,14 @@
 #include "PostProcessors/UnescapePostprocessor.h"
 
 #include "util.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
 UnescapePostprocessor::UnescapePostprocessor(const std::weak_ptr<Markdown> &markdown_instance) :
     PostProcessor(markdown_instance),
-    RE(QString("%1(\\d+)%2").arg(util::STX).arg(util::ETX))
+    RE(RegexCache::compile(QString("%1(\\d+)%2").arg(util::STX).arg(util::ETX)))
 {}
 
 QString UnescapePostprocessor::run(const QString &text)
@@ -19,4 +20,7 @@ QString UnescapePostprocessor::run(const QString &text)
     return pypp::re::sub(this->RE, unescape, text);
 }
 
+bool UnescapePostprocessor::blockwise(void) const
+{ return true; }
+
 } // namespace markdown
@@ -1,40 +1,168 @@
 #include "PreProcessors/HtmlBlockProcessor.h"
 
 #include "util.h"
+#include "Context.h"
 #include "Markdown.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
+namespace {
+
+//! the markdown="1" attribute of a raw html block
+const QRegularExpression MARKDOWN_ATTR_RE = RegexCache::compile("\\smarkdown(=['\"]?[^> ]*['\"]?)?");
+
+//! `\s`
+inline bool isSpace(QChar ch)
+{
+    ushort c = ch.unicode();
+    return c == ' ' || ( c >= '\t' && c <= '\r' );
+}
+
+//! `[^>"'/= ]`, note that it takes whitespace other than ' '
+inline bool isNameChar(QChar ch)
+{
+    ushort c = ch.unicode();
+    return c != '>' && c != '"' && c != '\'' && c != '/' && c != '=' && c != ' ';
+}
+
+/*!
+ * What follows an attribute name ending at `end` in one of the
+ * alternatives of an attribute:
+ *
+ *     0: `=(?<q>['"])(?<value>.*?)\g{q}`
+ *     1: `=(?<value1>[^> ]+)`
+ *     2: nothing
+ *
+ * Returns: the end of the attribute, or -1.
+ */
+int scan_value(const QString &block, int end, int alternative, QString &value)
+{
+    const int size = block.size();
+    value = QString();
+    if ( alternative == 2 ) {
+        return end;
+    }
+    if ( end >= size || block.at(end) != '=' ) {
+        return -1;
+    }
+    int begin = end + 1;
+    int i = begin;
+    if ( alternative == 0 ) {
+        if ( i >= size || ( block.at(i) != '"' && block.at(i) != '\'' ) ) {
+            return -1;
+        }
+        QChar q = block.at(i);
+        begin = ++i;
+        while ( i < size && block.at(i) != q && block.at(i) != '\n' ) {
+            ++i;
+        }
+        if ( i >= size || block.at(i) != q ) {
+            return -1;
+        }
+        value = block.mid(begin, i-begin);
+        return i + 1;
+    }
+    while ( i < size && block.at(i) != '>' && block.at(i) != ' ' ) {
+        ++i;
+    }
+    if ( i == begin ) {
+        return -1;
+    }
+    value = block.mid(begin, i-begin);
+    return i;
+}
+
+/*!
+ * Scans one attribute at `pos` the way the expression
+ *
+ *     \s+(?<attr>NAME)=(?<q>['"])(?<value>.*?)\g{q}
+ *     |\s+(?<attr1>NAME)=(?<value1>[^> ]+)
+ *     |\s+(?<attr2>NAME)
+ *
+ * with NAME `[^>"'/= ]+` matches it: each alternative is tried with the
+ * longest whitespace first, giving back one character at a time, since a
+ * name may start with whitespace other than ' '.  A name always ends at
+ * the same place for all the starts it runs through, so that place is
+ * only looked at once.
+ *
+ * Returns: the end of the attribute, or -1 if there is none.
+ */
+int scan_attribute(const QString &block, int pos, QString &name, QString &value)
+{
+    const int size = block.size();
+    int spaces = 0;
+    while ( pos+spaces < size && isSpace(block.at(pos+spaces)) ) {
+        ++spaces;
+    }
+    for ( int alternative = 0; alternative < 3; ++alternative ) {
+        int end = pos + spaces;
+        while ( end < size && isNameChar(block.at(end)) ) {
+            ++end;
+        }
+        int tried = -1;
+        for ( int k = spaces; k > 0; --k ) {
+            int begin = pos + k;
+            if ( k < spaces && ! isNameChar(block.at(begin)) ) {
+                end = begin;
+            }
+            if ( begin == end || end == tried ) {
+                continue;
+            }
+            tried = end;
+            int stop = scan_value(block, end, alternative, value);
+            if ( stop != -1 ) {
+                name = block.mid(begin, end-begin);
+                return stop;
+            }
+        }
+    }
+    return -1;
+}
+
+}
+
 HtmlBlockProcessor::HtmlBlockProcessor(const std::weak_ptr<Markdown> &markdown_instance) :
     PreProcessor(markdown_instance),
     right_tag_patterns({"</%1>", "%1>"}),
-    attrs_pattern("\\s+(?<attr>[^>\"'/= ]+)=(?<q>['\"])(?<value>.*?)\\g{q}|\\s+(?<attr1>[^>\"'/= ]+)=(?<value1>[^> ]+)|\\s+(?<attr2>[^>\"'/= ]+)"),
-    left_tag_pattern(QString("^<(?<tag>[^> ]+)(?<attrs>(%1)*)\\s*\\/?>?").arg(this->attrs_pattern)),
-    attrs_re(this->attrs_pattern),
-    left_tag_re(this->left_tag_pattern),
     markdown_in_raw(false)
 {}
 HtmlBlockProcessor::~HtmlBlockProcessor(void)
 {}
 
-QStringList HtmlBlockProcessor::run(const QStringList &lines)
+void HtmlBlockProcessor::run(LineBuffer &lines)
+{
+    //! Only a block that starts with '<' can be html, and blocks start
+    //! after a blank line.  Documents without such a block, which do not
+    //! start with a blank line either, pass through untouched.
+    bool untouched = lines.isEmpty() || ! lines.at(0).isEmpty();
+    for ( int i = 0; i < lines.size() && untouched; ++i ) {
+        if ( lines.at(i).startsWith('<') && ( i == 0 || lines.at(i-1).isEmpty() ) ) {
+            untouched = false;
+        }
+    }
+    if ( ! untouched ) {
+        lines = LineBuffer(this->process(lines.join()));
+    }
+}
+
+QString HtmlBlockProcessor::process(const QString &text)
 {
-    std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    HtmlStash &htmlStash = Context::current().htmlStash;
 
-    QString text = lines.join("\n");
     QStringList new_blocks;
     QStringList texts;
-    // python str.rsplit()
+    //! python str.rsplit(), cutting every block out of the text once
+    int end = text.size();
     while ( true ) {
-        int i = text.lastIndexOf("\n\n");
+        int i = end >= 2 ? text.lastIndexOf("\n\n", end-2) : -1;
         if ( i == -1 ) {
-            texts.push_front(text);
+            texts.push_front(text.left(end));
             break;
         }
-        int count = text.size() - (i + 2);
-        texts.push_front(text.mid(i+2, count));
-        text = text.left(i);
+        texts.push_front(text.mid(i+2, end-i-2));
+        end = i;
     }
     QStringList items;
     QString left_tag;
@@ -87,15 +215,15 @@ QStringList HtmlBlockProcessor::run(const QStringList &lines)
                 QString buff = pypp::rstrip(block);
                 if ( buff.endsWith('>') && this->equal_tags(left_tag, right_tag) ) {
                     if ( this->markdown_in_raw && attrs.contains("markdown") ) {
-                        QString start = block.left(left_index).replace(QRegularExpression("\\smarkdown(=['\"]?[^> ]*['\"]?)?"), QString());
+                        QString start = block.left(left_index).replace(MARKDOWN_ATTR_RE, QString());
                         int begin = block.size()-right_tag.size()-2;
                         QString end = block.mid(begin);
                         block = block.mid(left_index, begin-left_index);
-                        new_blocks.push_back(markdown->htmlStash.store(start));
+                        new_blocks.push_back(htmlStash.store(start));
                         new_blocks.push_back(block);
-                        new_blocks.push_back(markdown->htmlStash.store(end));
+                        new_blocks.push_back(htmlStash.store(end));
                     } else {
-                        new_blocks.push_back(markdown->htmlStash.store(block.trimmed()));
+                        new_blocks.push_back(htmlStash.store(block.trimmed()));
                     }
                     continue;
                 } else {
@@ -104,7 +232,7 @@ QStringList HtmlBlockProcessor::run(const QStringList &lines)
                         items.push_back(block.trimmed());
                         in_tag = true;
                     } else {
-                        new_blocks.push_back(markdown->htmlStash.store(block.trimmed()));
+                        new_blocks.push_back(htmlStash.store(block.trimmed()));
                     }
 
                     continue;
@@ -129,18 +257,18 @@ QStringList HtmlBlockProcessor::run(const QStringList &lines)
 
                 in_tag = false;
                 if (this->markdown_in_raw && attrs.contains("markdown") ) {
-                    QString start = items.front().left(left_index).replace(QRegularExpression("\\smarkdown(=['\"]?[^> ]*['\"]?)?"), QString());
+                    QString start = items.front().left(left_index).replace(MARKDOWN_ATTR_RE, QString());
                     items.front() = items.front().mid(left_index);
                     int begin = items.back().size()-right_tag.size()-2;
                     QString end = items.back().mid(begin);
                     items.back() = items.back().left(begin);
-                    new_blocks.push_back(markdown->htmlStash.store(start));
+                    new_blocks.push_back(htmlStash.store(start));
                     for ( const QString &item : items ) {
                         new_blocks.push_back(item);
                     }
-                    new_blocks.push_back(markdown->htmlStash.store(end));
+                    new_blocks.push_back(htmlStash.store(end));
                 } else {
-                    new_blocks.push_back(markdown->htmlStash.store(items.join("\n\n")));
+                    new_blocks.push_back(htmlStash.store(items.join("\n\n")));
                 }
                 items = QStringList();
             }
@@ -148,90 +276,92 @@ QStringList HtmlBlockProcessor::run(const QStringList &lines)
     }
     if ( items.size() > 0 ) {
         if ( this->markdown_in_raw && attrs.contains("markdown") ) {
-            QString start = items.front().left(left_index).replace(QRegularExpression("\\smarkdown(=['\"]?[^> ]*['\"]?)?"), QString());
+            QString start = items.front().left(left_index).replace(MARKDOWN_ATTR_RE, QString());
             items.front() = items.front().mid(left_index);
             int begin = items.back().size()-right_tag.size()-2;
             QString end = items.back().mid(begin);
             items.back() = items.back().left(begin);
-            new_blocks.push_back(markdown->htmlStash.store(start));
+            new_blocks.push_back(htmlStash.store(start));
             for ( const QString &item : items ) {
                 new_blocks.push_back(item);
             }
-            new_blocks.push_back(markdown->htmlStash.store(end));
+            new_blocks.push_back(htmlStash.store(end));
         } else {
-            new_blocks.push_back(markdown->htmlStash.store(items.join("\n\n")));
+            new_blocks.push_back(htmlStash.store(items.join("\n\n")));
         }
         new_blocks.push_back("\n");
     }
-    QString new_text = new_blocks.join("\n\n");
-    return new_text.split("\n");
+    return new_blocks.join("\n\n");
 }
 
 std::tuple<QString, int, HtmlBlockProcessor::Attributes> HtmlBlockProcessor::get_left_tag(const QString &block)
 {
-    QRegularExpressionMatch m = this->left_tag_re.match(block);
-    if ( m.hasMatch() ) {
-        QString tag = m.captured("tag");
-        QString raw_attrs = m.captured("attrs");
+    //! ^<(?<tag>[^> ]+)(?<attrs>(ATTRIBUTE)*)\s*\/?>?
+    const int size = block.size();
+    int i = 1;
+    while ( i < size && block.at(i) != '>' && block.at(i) != ' ' ) {
+        ++i;
+    }
+    if ( i > 1 ) {
+        QString tag = block.mid(1, i-1);
         Attributes attrs;
-        if ( ! raw_attrs.isEmpty() ) {
-            QRegularExpressionMatchIterator it = this->attrs_re.globalMatch(raw_attrs);
-            while ( it.hasNext() ) {
-                QRegularExpressionMatch ma = it.next();
-                if ( ! ma.captured("attr").isEmpty() ) {
-                    QString attr = ma.captured("attr").trimmed();
-                    if ( ! ma.captured("value").isEmpty() ) {
-                        attrs[attr] = ma.captured("value");
-                    } else {
-                        attrs[attr] = QString();
-                    }
-                } else if ( ! ma.captured("attr1").isEmpty() ) {
-                    QString attr1 = ma.captured("attr1").trimmed();
-                    if ( ! ma.captured("value1").isEmpty() ) {
-                        attrs[attr1] = ma.captured("value1");
-                    } else {
-                        attrs[attr1] = QString();
-                    }
-                } else if ( ! ma.captured("attr2").isEmpty() ) {
-                    QString attr2 = ma.captured("attr2").trimmed();
-                    attrs[attr2] = QString();
-                }
-            }
+        QString attr, value;
+        int end;
+        while ( ( end = scan_attribute(block, i, attr, value) ) != -1 ) {
+            attrs[attr.trimmed()] = value;
+            i = end;
+        }
+        while ( i < size && isSpace(block.at(i)) ) {
+            ++i;
+        }
+        if ( i < size && block.at(i) == '/' ) {
+            ++i;
+        }
+        if ( i < size && block.at(i) == '>' ) {
+            ++i;
         }
-        return std::make_tuple(tag, m.captured().size(), attrs);
+        return std::make_tuple(tag, i, attrs);
     } else {
         QString tag = block.mid(1, block.indexOf('>')-1).toLower();
         return std::make_tuple(tag, tag.size()+2, Attributes());
     }
 }
-int HtmlBlockProcessor::recursive_tagfind(const QString &ltag, const QString &rtag, int start_index, const QString &block)
+int HtmlBlockProcessor::tagfind(const QString &ltag, const QString &rtag, int start_index, const QString &block)
 {
-    while ( true ) {
-        int i = block.indexOf(rtag, start_index);
-        if ( i == -1 ) {
-            return -1;
+    //! Every ltag found before the next rtag opens a nested tag whose rtag
+    //! is skipped.  Either tag is only looked up again once passed, so the
+    //! block is scanned once.
+    int depth = 0;
+    int left = block.indexOf(ltag, start_index);
+    int right = block.indexOf(rtag, start_index);
+    while ( right != -1 ) {
+        if ( left == -1 || left > right ) {
+            if ( depth == 0 ) {
+                return right + rtag.size();
+            }
+            depth -= 1;
+            start_index = right + rtag.size();
+        } else {
+            //! another ltag found before rtag, use end of ltag as starting
+            //! point and search again
+            depth += 1;
+            start_index = block.indexOf('>', left) + 1;
         }
-        int j = block.indexOf(ltag, start_index);
-        //! if no ltag, or rtag found before another ltag, return index
-        if ( j > i || j == -1 ) {
-            return i + rtag.size();
+        if ( left != -1 && left < start_index ) {
+            left = block.indexOf(ltag, start_index);
         }
-        //! another ltag found before rtag, use end of ltag as starting
-        //! point and search again
-        j = block.indexOf('>', j);
-        start_index = this->recursive_tagfind(ltag, rtag, j+1, block);
-        if ( start_index == -1 ) {
-            //! HTML potentially malformed- ltag has no corresponding
-            //! rtag
-            return -1;
+        if ( right < start_index ) {
+            right = block.indexOf(rtag, start_index);
         }
     }
+    //! HTML potentially malformed- ltag has no corresponding rtag
+    return -1;
 }
 std::tuple<QString, int> HtmlBlockProcessor::get_right_tag(const QString &left_tag, int left_index, const QString &block)
 {
     for ( const QString &p : this->right_tag_patterns ) {
         QString tag = p.arg(left_tag);
-        int i = this->recursive_tagfind(QString("<%1").arg(left_tag), tag, left_index, block);
+        int i = this->tagfind(QString("<%1").arg(left_tag), tag, left_index, block);
         if ( i > 2 ) {
             tag = pypp::lstrip(tag, [](const QChar &ch) -> bool { return ch == '<'; });
             tag = pypp::rstrip(tag, [](const QChar &ch) -> bool { return ch == '>'; });
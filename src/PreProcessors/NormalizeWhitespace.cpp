@@ -6,22 +6,74 @@
 namespace markdown
 {
 
+namespace {
+
+bool is_spaces(const QStringRef &line)
+{
+    if ( line.isEmpty() ) {
+        return false;
+    }
+    for ( const QChar &ch : line ) {
+        if ( ch != ' ' ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool needs_normalizing(const QStringRef &line)
+{
+    for ( const QChar &ch : line ) {
+        ushort c = ch.unicode();
+        if ( c == '\t' || c == '\r' || c == 2 || c == 3 ) {  //!< tab, CR, STX, ETX
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
 NormalizeWhitespace::~NormalizeWhitespace(void)
 {}
 
-QStringList NormalizeWhitespace::run(const QStringList &lines)
+void NormalizeWhitespace::run(LineBuffer &lines)
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
 
-    QString source = lines.join("\n");
-    source = source.replace(util::STX, QString());
-    source = source.replace(util::ETX, QString());
-    source = source.replace("\r\n", "\n");
-    source = source.replace("\r", "\n");
-    source += "\n\n";
-    source = pypp::expandtabs(source, markdown->tab_length());
-    source = source.replace(QRegularExpression("(?<=\n) +\n"), "\n");
-    return source.split("\n");
+    //! Lines without tabs, carriage returns or placeholder markers are
+    //! kept as they are; only the others are rewritten.
+    LineBuffer::Spans spans;
+    spans.reserve(lines.size()+2);
+    for ( int i = 0; i < lines.size(); ++i ) {
+        QStringRef line = lines.at(i);
+        if ( ! needs_normalizing(line) ) {
+            //! lines of blanks become empty, except the very first one
+            if ( spans.size() > 0 && is_spaces(line) ) {
+                spans.append(lines.add(QString()));
+            } else {
+                spans.append(lines.span(i));
+            }
+            continue;
+        }
+        QString text = line.toString();
+        text.remove(util::STX);
+        text.remove(util::ETX);
+        //! "\r\n" ends the line, any other "\r" starts a new one
+        if ( text.endsWith('\r') && i+1 < lines.size() ) {
+            text.chop(1);
+        }
+        for ( const QString &part : text.split('\r') ) {
+            QString expanded = pypp::expandtabs(part, markdown->tab_length());
+            if ( spans.size() > 0 && is_spaces(QStringRef(&expanded)) ) {
+                expanded.clear();
+            }
+            spans.append(lines.add(expanded));
+        }
+    }
+    spans.append(lines.add(QString()));
+    spans.append(lines.add(QString()));
+    lines.setSpans(spans);
 }
 
 } // namespace markdown
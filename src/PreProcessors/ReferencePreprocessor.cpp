@@ -1,6 +1,8 @@
 #include "PreProcessors/ReferencePreprocessor.h"
 
+#include "Context.h"
 #include "Markdown.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
@@ -8,51 +10,63 @@ namespace markdown
 ReferencePreprocessor::ReferencePreprocessor(const std::weak_ptr<Markdown> &markdown_instance) :
     PreProcessor(markdown_instance),
     TITLE("[ ]*(\\\"(.*)\\\"|\\'(.*)\\'|\\((.*)\\))[ ]*"),
-    RE(QString("^[ ]{0,3}\\[([^\\]]*)\\]:\\s*([^ ]*)[ ]*(%1)?$").arg(this->TITLE), QRegularExpression::DotMatchesEverythingOption),
-    TITLE_RE(QString("^%1$").arg(this->TITLE))
+    RE(RegexCache::compile(QString("^[ ]{0,3}\\[([^\\]]*)\\]:\\s*([^ ]*)[ ]*(%1)?$").arg(this->TITLE), QRegularExpression::DotMatchesEverythingOption)),
+    TITLE_RE(RegexCache::compile(QString("^%1$").arg(this->TITLE)))
 {}
 
-QStringList ReferencePreprocessor::run(const QStringList &lines)
+void ReferencePreprocessor::run(LineBuffer &lines)
 {
-    std::shared_ptr<Markdown> markdown = this->markdown.lock();
+    Markdown::Reference &references = Context::current().references;
 
-    QStringList buffer = lines;
-    QStringList new_text;
-    while ( buffer.size() > 0 ) {
-        QString line = buffer.front();
-        buffer.pop_front();
-        QRegularExpressionMatch m = this->RE.match(line);
+    LineBuffer::Spans new_text;
+    new_text.reserve(lines.size());
+    for ( int i = 0; i < lines.size(); ++i ) {
+        if ( ! this->may_be_reference(lines.at(i)) ) {
+            new_text.append(lines.span(i));
+            continue;
+        }
+        QRegularExpressionMatch m = this->RE.match(lines.line(i));
         if ( m.hasMatch() ) {
             QString id = m.captured(1).trimmed().toLower();
             QString link = m.captured(2);
             link = pypp::lstrip(link, [](const QChar &ch) -> bool { return ch == '<'; });
             link = pypp::rstrip(link, [](const QChar &ch) -> bool { return ch == '>'; });
             QString t;
-            for ( int i = 5; i <= 7; ++i ) {
-                t = m.captured(i);
+            for ( int j = 5; j <= 7; ++j ) {
+                t = m.captured(j);
                 if ( t.size() > 0 ) {
                     break;
                 }
             }
-            if ( t.isEmpty() ) {
+            if ( t.isEmpty() && i+1 < lines.size() ) {
                 //! Check next line for title
-                QRegularExpressionMatch tm = this->TITLE_RE.match(buffer.front());
+                QRegularExpressionMatch tm = this->TITLE_RE.match(lines.line(i+1));
                 if ( tm.hasMatch() ) {
-                    buffer.pop_front();
-                    for ( int i = 2; i <= 4; ++i ) {
-                        t = tm.captured(i);
+                    ++i;
+                    for ( int j = 2; j <= 4; ++j ) {
+                        t = tm.captured(j);
                         if ( t.size() > 0 ) {
                             break;
                         }
                     }
                 }
             }
-            markdown->references[id] = Markdown::ReferenceItem(link, t);
+            references[id] = Markdown::ReferenceItem(link, t);
         } else {
-            new_text.push_back(line);
+            new_text.append(lines.span(i));
         }
     }
-    return new_text;
+    lines.setSpans(new_text);
+}
+
+bool ReferencePreprocessor::may_be_reference(const QStringRef &line) const
+{
+    //! up to three spaces and an opening bracket
+    int i = 0;
+    while ( i < 3 && i < line.size() && line.at(i) == ' ' ) {
+        ++i;
+    }
+    return i < line.size() && line.at(i) == '[';
 }
 
 } // namespace markdown
@@ -0,0 +1,72 @@
+#include "RegexCache.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+
+namespace markdown{
+
+namespace {
+
+typedef QPair<QString, int> Key;
+
+struct Cache
+{
+    QMutex mutex;
+    QHash<Key, QRegularExpression> expressions;
+    QList<Key> order;  //!< oldest first
+};
+
+//! constructed on first use, so static expressions of other translation
+//! units can be compiled through the cache during their initialization
+Cache &cache()
+{
+    static Cache instance;
+    return instance;
+}
+
+}
+
+QRegularExpression RegexCache::compile(const QString &pattern, QRegularExpression::PatternOptions options)
+{
+    Key key(pattern, int(options));
+    Cache &c = cache();
+    QMutexLocker locker(&c.mutex);
+    auto it = c.expressions.constFind(key);
+    if ( it != c.expressions.constEnd() ) {
+        return it.value();
+    }
+    QRegularExpression re(pattern, options);
+    if ( c.order.size() >= RegexCache::MAX_SIZE ) {
+        c.expressions.remove(c.order.takeFirst());
+    }
+    c.expressions.insert(key, re);
+    c.order.append(key);
+    return re;
+}
+
+int RegexCache::warmUp()
+{
+    Cache &c = cache();
+    QList<QRegularExpression> expressions;
+    {
+        QMutexLocker locker(&c.mutex);
+        expressions = c.expressions.values();
+    }
+    //! optimize() locks the shared pattern itself
+    for ( const QRegularExpression &re : expressions ) {
+        re.optimize();
+    }
+    return expressions.size();
+}
+
+int RegexCache::size()
+{
+    Cache &c = cache();
+    QMutexLocker locker(&c.mutex);
+    return c.expressions.size();
+}
+
+} // end of namespace markdown
@@ -15,6 +15,7 @@
 
 #include <QPair>
 #include <QSet>
+#include <QVector>
 
 namespace markdown{
 
@@ -25,6 +26,8 @@ typedef enum {
 
 typedef QMap<QString, QString> NamespaceMap;
 
+static const NamespaceMap NO_NAMESPACES;
+
 static const QSet<QString> HTML_EMPTY = {"area", "base", "basefont", "br", "col", "frame", "hr",
                                          "img", "input", "isindex", "link", "meta", "param"};
 
@@ -41,68 +44,177 @@ static const NamespaceMap namespace_map = {
     std::make_pair("http://purl.org/dc/elements/1.1/", "dc")
 };
 
-QString escape_cdata(const QString &text)
-{
-    //! escape character data
-    QString result = text;
+//! escape classes of the ASCII characters, see write_escaped()
+enum {
+    ESCAPE_CDATA       = 0x1,  //!< & < >
+    ESCAPE_ATTRIB_HTML = 0x2,  //!< & < > "
+    ESCAPE_ATTRIB      = 0x4   //!< & < > " \n
+};
 
-    //! it's worth avoiding do-nothing calls for strings that are
-    //! shorter than 500 character, or so.  assume that's, by far,
-    //! the most common case in most applications.
-    if ( result.contains('&') ) {
-        result = result.replace("&", "&amp;");
-    }
-    if ( result.contains('<') ) {
-        result = result.replace("<", "&lt;");
+static const unsigned char ESCAPE_TABLE[128] = {
+    /* 0x00 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ESCAPE_ATTRIB, 0, 0, 0, 0, 0,
+    /* 0x10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x20 */ 0, 0, ESCAPE_ATTRIB_HTML|ESCAPE_ATTRIB, 0, 0, 0, ESCAPE_CDATA|ESCAPE_ATTRIB_HTML|ESCAPE_ATTRIB, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    /* 0x30 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ESCAPE_CDATA|ESCAPE_ATTRIB_HTML|ESCAPE_ATTRIB, 0, ESCAPE_CDATA|ESCAPE_ATTRIB_HTML|ESCAPE_ATTRIB, 0,
+};
+
+static const char *entity(ushort c)
+{
+    switch ( c ) {
+    case '&':  return "&amp;";
+    case '<':  return "&lt;";
+    case '>':  return "&gt;";
+    case '"':  return "&quot;";
+    case '\n': return "&#10;";
     }
-    if ( result.contains('>') ) {
-        result = result.replace(">", "&gt;");
+    return "";
+}
+
+static bool needs_escape(const QString &text, unsigned char mask)
+{
+    for ( const QChar &c : text ) {
+        if ( c.unicode() < 128 && (ESCAPE_TABLE[c.unicode()] & mask) ) {
+            return true;
+        }
     }
-    return result;
+    return false;
 }
 
-QString escape_attrib(const QString &text)
+//! Writes text with the characters of the escape class replaced, in a
+//! single pass.  Runs without such characters go to the sink as they are.
+static void write_escaped(SerializerSink &sink, const QString &text, unsigned char mask)
 {
-    //! escape attribute value
-    QString result = text;
-    if ( result.contains('&') ) {
-        result = result.replace("&", "&amp;");
+    const QChar *data = text.constData();
+    const int size = text.size();
+    int start = 0;
+    for ( int i = 0; i < size; ++i ) {
+        ushort c = data[i].unicode();
+        if ( c >= 128 || ! (ESCAPE_TABLE[c] & mask) ) {
+            continue;
+        }
+        sink.write(data+start, i-start);
+        sink.write(entity(c));
+        start = i+1;
     }
-    if ( result.contains('<') ) {
-        result = result.replace("<", "&lt;");
+    sink.write(data+start, size-start);
+}
+
+SerializerSink::~SerializerSink()
+{}
+
+void SerializerSink::flush()
+{}
+
+void SerializerSink::write(const char *ascii)
+{
+    QChar buffer[32];
+    while ( *ascii ) {
+        int size = 0;
+        while ( size < 32 && ascii[size] ) {
+            buffer[size] = QLatin1Char(ascii[size]);
+            ++size;
+        }
+        this->write(buffer, size);
+        ascii += size;
     }
-    if ( result.contains('>') ) {
-        result = result.replace(">", "&gt;");
+}
+
+StringSink::StringSink(QString &buffer, int sizeHint) :
+    buffer(buffer)
+{
+    if ( sizeHint > 0 ) {
+        this->buffer.reserve(this->buffer.size()+sizeHint);
     }
-    if ( result.contains('"') ) {
-        result = result.replace("\"", "&quot;");
+}
+
+void StringSink::write(const QChar *data, int size)
+{
+    this->buffer.append(data, size);
+}
+
+CallbackSink::CallbackSink(const Callback &callback, int chunkSize) :
+    callback(callback),
+    chunkSize(chunkSize > 0 ? chunkSize : 1),
+    buffer()
+{
+    this->buffer.reserve(this->chunkSize);
+}
+
+CallbackSink::~CallbackSink()
+{
+    this->flush();
+}
+
+void CallbackSink::write(const QChar *data, int size)
+{
+    this->buffer.append(data, size);
+    if ( this->buffer.size() < this->chunkSize ) {
+        return;
     }
-    if ( result.contains('\n') ) {
-        result = result.replace("\n", "&#10;");
+    QString rest;
+    if ( this->buffer.at(this->buffer.size()-1).isHighSurrogate() ) {
+        rest = this->buffer.right(1);
+        this->buffer.chop(1);
     }
-    return result;
+    this->callback(this->buffer);
+    this->buffer = rest;
+    this->buffer.reserve(this->chunkSize);
 }
 
-QString escape_attrib_html(const QString &text)
+void CallbackSink::flush()
 {
-    //! escape attribute value
-    QString result = text;
-    if ( result.contains('&') ) {
-        result = result.replace("&", "&amp;");
+    if ( ! this->buffer.isEmpty() ) {
+        this->callback(this->buffer);
+        this->buffer.clear();
     }
-    if ( result.contains('<') ) {
-        result = result.replace("<", "&lt;");
+}
+
+DeviceSink::DeviceSink(QIODevice *device, int chunkSize) :
+    CallbackSink([this](const QString &chunk){ this->writeChunk(chunk); }, chunkSize),
+    device(device),
+    failed(false),
+    error()
+{}
+
+DeviceSink::~DeviceSink()
+{
+    //! the base class would flush into members that are already gone
+    this->flush();
+}
+
+bool DeviceSink::hasError() const
+{
+    return this->failed;
+}
+
+QString DeviceSink::errorString() const
+{
+    return this->error;
+}
+
+void DeviceSink::writeChunk(const QString &chunk)
+{
+    if ( this->failed ) {
+        return;
     }
-    if ( result.contains('>') ) {
-        result = result.replace(">", "&gt;");
+    QByteArray data = chunk.toUtf8();
+    qint64 written = this->device->write(data);
+    if ( written == data.size() ) {
+        return;
     }
-    if ( result.contains('"') ) {
-        result = result.replace("\"", "&quot;");
+    this->failed = true;
+    if ( written < 0 ) {
+        this->error = this->device->errorString();
+    } else {
+        this->error = QString("wrote %1 of %2 bytes").arg(written).arg(data.size());
     }
-    return result;
 }
 
-void serialize_html(const std::function<void(const QString &)> &write, const Element &elem, const NamespaceMap &qnames, const NamespaceMap &namespaces, Format format)
+/*!
+ * Writes the start tag and text of elem.  Returns whether its children
+ * and end tag follow, with the tag to close it with in `tag`.
+ */
+static bool write_start(SerializerSink &sink, const Element &elem, const NamespaceMap *qnames, const NamespaceMap &namespaces, Format format, QString &tag)
 {
     /*
     if ( elem->getNodeType() == xercesc::DOMNode::COMMENT_NODE ) {
@@ -111,61 +223,125 @@ void serialize_html(const std::function<void(const QString &)> &write, const Ele
     } else if ( elem->getNodeType() == xercesc::DOMNode::PROCESSING_INSTRUCTION_NODE ) {
         xercesc::DOMProcessingInstruction* pi = reinterpret_cast<xercesc::DOMProcessingInstruction*>(elem);
         write((boost::wformat(L"<?%s %s?>")%escape_cdata(wconvert(pi->getTarget()))%escape_cdata(wconvert(pi->getData()))).str());
-    } else */{
-        QString tag = elem->tag;
-        write("<"+tag);
-        QStringList keys = elem->keys();
-        if ( keys.size() > 0 ) {
-            qSort(keys);  //!< lexical order
-            for ( const QString &key : keys ) {
-                const QString value = escape_attrib_html(elem->get(key));
-                if ( format == html && qnames.contains(key) && qnames[key] == value ) {
-                    //! handle boolean attributes
-                    write(QString(" %1").arg(value));
-                } else if ( qnames.contains(key) ) {
-                    write(QString(" %1=\"%2\"").arg(qnames[key]).arg(value));
+    } else */
+    tag = elem->tag;
+    sink.write("<");
+    sink.write(tag);
+    const impl::Element::Attribute_t &attrib = elem->attrib;
+    if ( ! attrib.isEmpty() ) {
+        for ( auto it = attrib.cbegin(); it != attrib.cend(); ++it ) {
+            const QString *name = &it.key();
+            if ( qnames != nullptr ) {
+                NamespaceMap::const_iterator qname = qnames->constFind(it.key());
+                if ( qname == qnames->constEnd() ) {
+                    continue;
                 }
+                name = &qname.value();
             }
-            if ( ! namespaces.isEmpty() ) {
-                typedef QPair<QString, QString> Pair;
-                typedef QList<Pair> Pairs;
-                Pairs ns_list;
-                for ( NamespaceMap::const_iterator it = namespaces.begin(); it != namespaces.end(); ++it ) {
-                    ns_list.push_back(Pair(it.key(), it.value()));
-                }
-                auto ns_list_ = ns_list.toStdList();
-                ns_list_.sort([](const Pair &a, const Pair &b) -> bool { return a.second < b.second; });  //!< sort on prefix
-                for ( const Pair &pair : ns_list_ ) {
-                    QString key = pair.first;
-                    if ( ! key.isEmpty() ) {
-                        key = ":"+key;
-                    }
-                    write(QString(" xmlns%1=\"%2\"").arg(key).arg(escape_attrib(pair.second)));
-                }
+            const QString &value = it.value();
+            if ( format == html && *name == value && ! needs_escape(value, ESCAPE_ATTRIB_HTML) ) {
+                //! handle boolean attributes
+                sink.write(" ");
+                sink.write(value);
+            } else {
+                sink.write(" ");
+                sink.write(*name);
+                sink.write("=\"");
+                write_escaped(sink, value, ESCAPE_ATTRIB_HTML);
+                sink.write("\"");
             }
         }
-        if ( format == xhtml && HTML_EMPTY.contains(tag) ) {
-            write(" />");
-        } else {
-            write(">");
-            tag = tag.toLower();
-            if ( elem->hasText() ) {
-                if ( tag == "script" || tag == "style" ) {
-                    write(elem->text);
-                } else {
-                    write(escape_cdata(elem->text));
-                }
-            }
-            for ( int i = 0; i < elem->size(); ++i ) {
-                serialize_html(write, (*elem)[i], qnames, NamespaceMap(), format);
+        if ( ! namespaces.isEmpty() ) {
+            typedef QPair<QString, QString> Pair;
+            typedef QList<Pair> Pairs;
+            Pairs ns_list;
+            for ( NamespaceMap::const_iterator it = namespaces.begin(); it != namespaces.end(); ++it ) {
+                ns_list.push_back(Pair(it.key(), it.value()));
             }
-            if ( ! HTML_EMPTY.contains(tag) ) {
-                write(QString("</%1>").arg(tag));
+            auto ns_list_ = ns_list.toStdList();
+            ns_list_.sort([](const Pair &a, const Pair &b) -> bool { return a.second < b.second; });  //!< sort on prefix
+            for ( const Pair &pair : ns_list_ ) {
+                //! uri and prefix
+                sink.write(" xmlns");
+                if ( ! pair.second.isEmpty() ) {
+                    sink.write(":");
+                    sink.write(pair.second);
+                }
+                sink.write("=\"");
+                write_escaped(sink, pair.first, ESCAPE_ATTRIB);
+                sink.write("\"");
             }
         }
     }
+    if ( format == xhtml && HTML_EMPTY.contains(tag) ) {
+        sink.write(" />");
+        return false;
+    }
+    sink.write(">");
+    tag = tag.toLower();
+    if ( elem->hasText() ) {
+        if ( tag == "script" || tag == "style" ) {
+            sink.write(elem->text);
+        } else {
+            write_escaped(sink, elem->text, ESCAPE_CDATA);
+        }
+    }
+    return true;
+}
+
+//! writes the end tag of elem, unless it has none, and its tail
+static void write_end(SerializerSink &sink, const Element &elem, const QString &tag)
+{
+    if ( ! HTML_EMPTY.contains(tag) ) {
+        sink.write("</");
+        sink.write(tag);
+        sink.write(">");
+    }
     if ( elem->hasTail() ) {
-        write(escape_cdata(elem->tail));
+        write_escaped(sink, elem->tail, ESCAPE_CDATA);
+    }
+}
+
+/*!
+ * Writes elem and its descendants.  Without qnames, attribute names are
+ * written as they are; attributes come in the lexical order their map
+ * keeps them in as they are set, so nothing needs sorting here.
+ *
+ * The elements still open are kept on a stack rather than in nested
+ * calls, so a tree may be nested as deep as it likes.
+ */
+void serialize_html(SerializerSink &sink, const Element &elem, const NamespaceMap *qnames, const NamespaceMap &namespaces, Format format)
+{
+    struct Open
+    {
+        Element elem;
+        QString tag;
+        impl::Element::const_iterator next;  //!< child to write next
+    };
+    QVector<Open> open;
+    QString tag;
+    if ( ! write_start(sink, elem, qnames, namespaces, format, tag) ) {
+        if ( elem->hasTail() ) {
+            write_escaped(sink, elem->tail, ESCAPE_CDATA);
+        }
+        return;
+    }
+    Open root = {elem, tag, elem->begin()};
+    open.append(root);
+    while ( ! open.isEmpty() ) {
+        if ( open.last().next == impl::Element::const_iterator() ) {
+            write_end(sink, open.last().elem, open.last().tag);
+            open.removeLast();
+            continue;
+        }
+        Element child = *open.last().next;
+        ++open.last().next;
+        if ( write_start(sink, child, qnames, NO_NAMESPACES, format, tag) ) {
+            Open o = {child, tag, child->begin()};
+            open.append(o);
+        } else if ( child->hasTail() ) {
+            write_escaped(sink, child->tail, ESCAPE_CDATA);
+        }
     }
 }
 
@@ -187,9 +363,10 @@ std::tuple<NamespaceMap, NamespaceMap> namespaces(const Element &elem, const QSt
         if ( qname.startsWith('{') ) {
             QStringList temp = qname.mid(1).split("}");
             QString uri = temp.at(0), tag = temp.at(1);
-            QString prefix;
+            QString prefix = nss.value(uri);
             if ( ! nss.contains(uri) ) {
-                if ( ! namespace_map.contains(uri) ) {
+                prefix = namespace_map.value(uri);
+                if ( prefix.isEmpty() ) {
                     prefix = QString("ns%1").arg(nss.size());
                 }
                 if ( prefix != "xml" ) {
@@ -228,26 +405,71 @@ std::tuple<NamespaceMap, NamespaceMap> namespaces(const Element &elem, const QSt
     return std::make_tuple(qnames, nss);
 }
 
-QString write_html(const Element &root, const Format &format)
+void write_html(SerializerSink &sink, const Element &root, const Format &format, bool resolve_namespaces)
 {
     if ( ! root ) {
-        return QString();
+        return;
+    }
+    if ( resolve_namespaces ) {
+        NamespaceMap qnames, namespaces_map;
+        std::tie(qnames, namespaces_map) = namespaces(root);
+        serialize_html(sink, root, &qnames, namespaces_map, format);
+    } else {
+        serialize_html(sink, root, nullptr, NO_NAMESPACES, format);
     }
-    QStringList data;
-    NamespaceMap qnames, namespaces_map;
-    std::tie(qnames, namespaces_map) = namespaces(root);
-    serialize_html([&](const QString &text){ data.push_back(text); }, root, qnames, namespaces_map, format);
-    return data.join(QString());
+    sink.flush();
+}
+
+void to_html(SerializerSink &sink, const Element &element)
+{
+    write_html(sink, element, html, false);
+}
+
+void to_xhtml(SerializerSink &sink, const Element &element)
+{
+    write_html(sink, element, xhtml, false);
 }
 
 QString to_html_string(const Element &element)
 {
-    return write_html(element, html);
+    QString result;
+    StringSink sink(result);
+    to_html(sink, element);
+    return result;
 }
 
 QString to_xhtml_string(const Element &element)
 {
-    return write_html(element, xhtml);
+    QString result;
+    StringSink sink(result);
+    to_xhtml(sink, element);
+    return result;
+}
+
+void to_namespaced_html(SerializerSink &sink, const Element &element)
+{
+    write_html(sink, element, html, true);
+}
+
+void to_namespaced_xhtml(SerializerSink &sink, const Element &element)
+{
+    write_html(sink, element, xhtml, true);
+}
+
+QString to_namespaced_html_string(const Element &element)
+{
+    QString result;
+    StringSink sink(result);
+    to_namespaced_html(sink, element);
+    return result;
+}
+
+QString to_namespaced_xhtml_string(const Element &element)
+{
+    QString result;
+    StringSink sink(result);
+    to_namespaced_xhtml(sink, element);
+    return result;
 }
 
 } // end of namespace markdown
@@ -7,19 +7,182 @@
 
 #include "TreeProcessors.h"
 
+#include <algorithm>
+
+#include <QHash>
+
+#include "pypp/exceptions.hpp"
+
 #include "TreeProcessors/InlineProcessor.h"
 #include "TreeProcessors/PrettifyTreeProcessor.h"
 
 namespace markdown{
 
 TreeProcessor::TreeProcessor(const std::weak_ptr<Markdown> &md_instance) :
-    markdown(md_instance), stashed_nodes()
+    markdown(md_instance)
 {}
 
 TreeProcessor::~TreeProcessor(void)
 {}
 
 
+/*!
+ * Walks a tree once for a group of visitors.
+ *
+ * Which enter hooks are still called in a subtree is kept as a bit per
+ * hook, so a group takes at most MAX_HOOKS of them.
+ */
+class TreeWalker
+{
+public:
+    static const int MAX_HOOKS = 64;
+
+    //! whether the hooks of visitor still fit into the group
+    bool accepts(const TreeVisitor *visitor) const
+    {
+        return this->enterHooks.size() + visitor->enterHooks.size() <= MAX_HOOKS;
+    }
+    bool isEmpty() const
+    {
+        return this->visitors.isEmpty();
+    }
+
+    void append(TreeVisitor *visitor)
+    {
+        this->visitors.append(visitor);
+        for ( const auto &hook : visitor->enterHooks ) {
+            int bit = this->enterHooks.size();
+            this->enterHooks.append(hook.second);
+            this->enterByTag[hook.first].append(bit);
+        }
+        for ( const auto &hook : visitor->exitHooks ) {
+            int index = this->exitHooks.size();
+            this->exitHooks.append(hook.second);
+            this->exitByTag[hook.first].append(index);
+        }
+    }
+
+    void walk(const Element &root)
+    {
+        this->prepare(this->enterByTag);
+        this->prepare(this->exitByTag);
+        for ( TreeVisitor *visitor : this->visitors ) {
+            visitor->begin(root);
+        }
+
+        struct Frame
+        {
+            Element elem;
+            impl::Element::const_iterator next;
+            quint64 active;
+        };
+        quint64 all = this->enterHooks.size() == MAX_HOOKS ? ~quint64(0) : ( quint64(1) << this->enterHooks.size() ) - 1;
+        QVector<Frame> stack;
+        quint64 active = this->enter(root, all);
+        stack.append({root, root->begin(), active});
+        while ( ! stack.isEmpty() ) {
+            Frame &top = stack.last();
+            if ( top.next != impl::Element::const_iterator() ) {
+                Element child = *top.next;
+                ++top.next;
+                //! children added by the enter hooks are visited as well
+                quint64 childActive = this->enter(child, top.active);
+                stack.append({child, child->begin(), childActive});
+            } else {
+                this->exit(top.elem);
+                stack.removeLast();
+            }
+        }
+
+        for ( TreeVisitor *visitor : this->visitors ) {
+            visitor->end(root);
+        }
+        *this = TreeWalker();
+    }
+
+private:
+    //! hooks for every element join the ones for each tag, in the order
+    //! they were registered
+    static void prepare(QHash<QString, QList<int>> &byTag)
+    {
+        const QList<int> any = byTag.value(QString());
+        for ( auto it = byTag.begin(); it != byTag.end(); ++it ) {
+            if ( ! it.key().isEmpty() && ! any.isEmpty() ) {
+                it.value().append(any);
+                std::sort(it.value().begin(), it.value().end());
+            }
+        }
+    }
+
+    quint64 enter(const Element &elem, quint64 active)
+    {
+        auto it = this->enterByTag.constFind(elem->tag);
+        if ( it == this->enterByTag.constEnd() ) {
+            it = this->enterByTag.constFind(QString());
+            if ( it == this->enterByTag.constEnd() ) {
+                return active;
+            }
+        }
+        for ( int bit : it.value() ) {
+            quint64 mask = quint64(1) << bit;
+            if ( ( active & mask ) && ! this->enterHooks.at(bit)(elem) ) {
+                active &= ~mask;
+            }
+        }
+        return active;
+    }
+
+    void exit(const Element &elem)
+    {
+        auto it = this->exitByTag.constFind(elem->tag);
+        if ( it == this->exitByTag.constEnd() ) {
+            it = this->exitByTag.constFind(QString());
+            if ( it == this->exitByTag.constEnd() ) {
+                return;
+            }
+        }
+        for ( int index : it.value() ) {
+            this->exitHooks.at(index)(elem);
+        }
+    }
+
+    QList<TreeVisitor *> visitors;
+    QList<TreeVisitor::EnterHook> enterHooks;
+    QList<TreeVisitor::ExitHook> exitHooks;
+    QHash<QString, QList<int>> enterByTag;
+    QHash<QString, QList<int>> exitByTag;
+
+};
+
+
+Element TreeVisitor::run(const Element &root)
+{
+    TreeWalker walker;
+    walker.append(this);
+    walker.walk(root);
+    return Element();
+}
+
+void TreeVisitor::begin(const Element &/*root*/)
+{}
+
+void TreeVisitor::end(const Element &/*root*/)
+{}
+
+void TreeVisitor::onEnter(const QString &tag, const EnterHook &hook)
+{
+    if ( this->enterHooks.size() == TreeWalker::MAX_HOOKS ) {
+        throw pypp::ValueError("too many enter hooks");
+    }
+    this->enterHooks.append(qMakePair(tag, hook));
+}
+
+void TreeVisitor::onExit(const QString &tag, const ExitHook &hook)
+{
+    this->exitHooks.append(qMakePair(tag, hook));
+}
+
+
 OrderedDictTreeProcessors build_treeprocessors(const std::shared_ptr<Markdown> &md_instance)
 {
     OrderedDictTreeProcessors treeprocessors;
@@ -28,4 +191,32 @@ OrderedDictTreeProcessors build_treeprocessors(const std::shared_ptr<Markdown> &
     return treeprocessors;
 }
 
+Element run_treeprocessors(const QList<std::shared_ptr<TreeProcessor>> &treeprocessors, const Element &root)
+{
+    Element result = root;
+    TreeWalker walker;
+    for ( const std::shared_ptr<TreeProcessor> &tree : treeprocessors ) {
+        TreeVisitor *visitor = dynamic_cast<TreeVisitor *>(tree.get());
+        if ( visitor != nullptr && walker.accepts(visitor) ) {
+            walker.append(visitor);
+            continue;
+        }
+        if ( ! walker.isEmpty() ) {
+            walker.walk(result);
+        }
+        if ( visitor != nullptr ) {
+            walker.append(visitor);
+            continue;
+        }
+        Element newRoot = tree->run(result);
+        if ( newRoot ) {
+            result = newRoot;
+        }
+    }
+    if ( ! walker.isEmpty() ) {
+        walker.walk(result);
+    }
+    return result;
+}
+
 } // end of namespace markdown
@@ -3,6 +3,7 @@
 #include <QDebug>
 
 #include "util.h"
+#include "Context.h"
 #include "Markdown.h"
 
 namespace markdown
@@ -10,63 +11,114 @@ namespace markdown
 
 InlineProcessor::InlineProcessor(const std::weak_ptr<Markdown> &md) :
     TreeProcessor(md),
-    placeholder_prefix(util::INLINE_PLACEHOLDER_PREFIX),
-    placeholder_suffix(util::ETX),
-    placeholder_length(4 + this->placeholder_prefix.size() + this->placeholder_suffix.size()),
-    placeholder_re(util::INLINE_PLACEHOLDER_RE)
+    placeholder_prefix(util::INLINE_PLACEHOLDER_PREFIX)
 {}
 
 InlineProcessor::~InlineProcessor(void)
 {}
 
-std::tuple<QString, QString> InlineProcessor::makePlaceholder(const QString &/*type*/)
+std::tuple<QString, int> InlineProcessor::makePlaceholder(const QString &/*type*/)
 {
-    QString id = QString("%1").arg(this->stashed_nodes.size(), 4, 10, QChar('0'));
-    QString hash = util::INLINE_PLACEHOLDER.arg(id);
-    return std::make_tuple(hash, id);
+    int id = Context::current().stashed_nodes.size();
+    return std::make_tuple(util::inlinePlaceholder(id), id);
 }
 
-std::tuple<boost::optional<QString>, int> InlineProcessor::findPlaceholder(const QString &data, int index)
+std::tuple<int, int> InlineProcessor::findPlaceholder(const QString &data, int index)
 {
-    QString regexTmp = data;
-    if ( index != -1 ) {
-        regexTmp = data.mid(index);
-    }
-    QRegularExpressionMatch m = this->placeholder_re.match(regexTmp);
-    if ( m.hasMatch() ) {
-        return std::make_tuple(m.captured(1), index+m.capturedEnd());
-    } else {
-        return std::make_tuple(boost::none, index+1);
-    }
+    int end = index + 1;
+    int id = util::inlinePlaceholderId(data, index, &end);
+    return std::make_tuple(id, end);
 }
 
 QString InlineProcessor::stashNode(const Element &node, const QString &type)
 {
-    QString placeholder, id;
+    QString placeholder;
+    int id;
     std::tie(placeholder, id) = this->makePlaceholder(type);
-    this->stashed_nodes[id] = std::make_tuple(boost::none, node);
+    Context::current().stashed_nodes.append(std::make_tuple(boost::none, node));
     return placeholder;
 }
 QString InlineProcessor::stashNode(const QString &node, const QString &type)
 {
-    QString placeholder, id;
+    QString placeholder;
+    int id;
     std::tie(placeholder, id) = this->makePlaceholder(type);
-    this->stashed_nodes[id] = std::make_tuple(node, boost::none);
+    Context::current().stashed_nodes.append(std::make_tuple(node, boost::none));
     return placeholder;
 }
 
-QString InlineProcessor::handleInline(const QString &data, int patternIndex)
+InlineProcessor::Dispatch InlineProcessor::buildDispatch() const
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
 
+    Dispatch dispatch;
+    dispatch.patterns = markdown->inlinePatterns.toList() + Context::current().inlinePatterns.toList();
+    for ( int i = 0; i < dispatch.patterns.size(); ++i ) {
+        QString triggers = dispatch.patterns.at(i)->triggers();
+        if ( triggers.isEmpty() ) {
+            dispatch.untriggered_patterns.append(i);
+            continue;
+        }
+        for ( const QChar &ch : triggers ) {
+            QList<int> &indexes = dispatch.trigger_table[ch.unicode()];
+            if ( ! indexes.contains(i) ) {
+                indexes.append(i);
+            }
+        }
+    }
+    return dispatch;
+}
+
+QVector<bool> InlineProcessor::scanTriggers(const Dispatch &dispatch, const QString &data) const
+{
+    QVector<bool> candidates(dispatch.patterns.size(), false);
+    for ( int i : dispatch.untriggered_patterns ) {
+        candidates[i] = true;
+    }
+    for ( const QChar &ch : data ) {
+        auto it = dispatch.trigger_table.constFind(ch.unicode());
+        if ( it == dispatch.trigger_table.constEnd() ) {
+            continue;
+        }
+        for ( int i : it.value() ) {
+            candidates[i] = true;
+        }
+    }
+    return candidates;
+}
+
+int InlineProcessor::findTrigger(const QString &triggers, const QString &data, int index) const
+{
+    for ( int i = index; i < data.size(); ++i ) {
+        if ( triggers.contains(data.at(i)) ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+QString InlineProcessor::handleInline(const Dispatch &dispatch, const QString &data, int patternIndex)
+{
+    //! Placeholders never contain trigger characters, so one scan
+    //! of the original text is enough to rule patterns out.
+    QVector<bool> candidates = this->scanTriggers(dispatch, data);
+
     int startIndex = 0;
     QString data_ = data;
-    while ( patternIndex < markdown->inlinePatterns.size() ) {
-        std::shared_ptr<Pattern> pattern = markdown->inlinePatterns.at(patternIndex);
+    //! kept by a scanning pattern for as long as it is applied to data_
+    Pattern::ScanStatePtr scanState;
+    while ( patternIndex < dispatch.patterns.size() ) {
+        if ( ! candidates.at(patternIndex) ) {
+            patternIndex += 1;
+            startIndex = 0;
+            continue;
+        }
+        std::shared_ptr<Pattern> pattern = dispatch.patterns.at(patternIndex);
         bool matched;
-        std::tie(data_, matched, startIndex) = this->applyPattern(pattern, data_, patternIndex, startIndex);
+        std::tie(data_, matched, startIndex) = this->applyPattern(dispatch, pattern, data_, patternIndex, startIndex, scanState);
         if ( ! matched ) {
             patternIndex += 1;
+            scanState.reset();
         }
     }
     return data_;
@@ -89,20 +141,18 @@ void InlineProcessor::processElementText(const Element &node, const Element &sub
 
     ElementList_t childResult = this->processPlaceholders(text, subnode, isText);
 
-    int pos = 0;
+    //! the results of a tail follow the subnode, those of a text lead
+    Element after;
     if ( ! isText && node != subnode ) {
-        pos = node->child().indexOf(subnode) + 1;
-    } else {
-        pos = 0;
-    }
-
-    for ( const Element &newChild : childResult ) {
-        node->insert(pos++, newChild);
+        after = subnode;
     }
+    node->insertAfter(after, childResult);
 }
 
 ElementList_t InlineProcessor::processPlaceholders(const QString &data, const Element &parent, bool isText)
 {
+    const StashNodes &stashed_nodes = Context::current().stashed_nodes;
+
     ElementList_t result;
     auto linkText = [&](const QString &text, bool atomic=false){
         if ( ! text.isEmpty() ) {
@@ -137,13 +187,12 @@ ElementList_t InlineProcessor::processPlaceholders(const QString &data, const El
     while ( ! data_.isEmpty() ) {
         int index = data_.indexOf(this->placeholder_prefix, startIndex);
         if ( index != -1 ) {
-            boost::optional<QString> id;
-            int phEndIndex;
+            int id, phEndIndex;
             std::tie(id, phEndIndex) = this->findPlaceholder(data_, index);
-            if ( this->stashed_nodes.contains(*id) ) {
+            if ( id >= 0 && id < stashed_nodes.size() ) {
                 boost::optional<QString> str;
                 boost::optional<Element> nodeptr;
-                std::tie(str, nodeptr) = this->stashed_nodes[*id];
+                std::tie(str, nodeptr) = stashed_nodes.at(id);
                 if ( index > 0 ) {
                     QString text = data_.mid(startIndex, index-startIndex);
                     linkText(text);
@@ -193,21 +242,42 @@ ElementList_t InlineProcessor::processPlaceholders(const QString &data, const El
     return result;
 }
 
-std::tuple<QString, bool, int> InlineProcessor::applyPattern(std::shared_ptr<Pattern> pattern, const QString &data, int patternIndex, int startIndex)
+std::tuple<QString, bool, int> InlineProcessor::applyPattern(const Dispatch &dispatch, std::shared_ptr<Pattern> pattern, const QString &data, int patternIndex, int startIndex, Pattern::ScanStatePtr &scanState)
 {
-    QString regexTmp = data.mid(startIndex);
-    QRegularExpressionMatch match = pattern->getCompiledRegExp().match(regexTmp);
-    if ( ! match.hasMatch() ) {
-        return std::make_tuple(data, false, 0);
+    int offset = startIndex;
+    QString triggers = pattern->triggers();
+    if ( ! triggers.isEmpty() ) {
+        offset = this->findTrigger(triggers, data, startIndex);
+        if ( offset == -1 ) {
+            return std::make_tuple(data, false, 0);
+        }
     }
-    QString leftData = data.left(startIndex);
+    int matchStart, matchEnd;
+    boost::optional<QString> result;
+    Element node;
+    if ( pattern->scans() ) {
+        std::tie(matchStart, matchEnd, node) = pattern->scan(data, offset, scanState);
+        if ( matchStart == -1 ) {
+            return std::make_tuple(data, false, 0);
+        }
+    } else {
+        //! look-behind assertions still see the text before the offset
+        QRegularExpressionMatch match = pattern->match(data, offset);
+        if ( ! match.hasMatch() ) {
+            return std::make_tuple(data, false, 0);
+        }
+        matchStart = match.capturedStart();
+        matchEnd = match.capturedEnd();
 
-    boost::optional<QString> result = pattern->handleMatch(match);  //!< first handleMatch (case String)
+        result = pattern->handleMatch(match);  //!< first handleMatch (case String)
+        if ( ! result ) {
+            node = pattern->handleMatch(ElementTree(), match);     //!< second handleMatch (case Node)
+        }
+    }
     QString placeholder;
     if ( ! result ) {
-        Element node = pattern->handleMatch(ElementTree(), match);     //!< second handleMatch (case Node)
         if ( ! node ) {
-            return std::make_tuple(data, true, leftData.size()+match.capturedStart(match.lastCapturedIndex()));
+            return std::make_tuple(data, true, matchEnd);
         }
         if ( ! node->atomic ) {
             //! We need to process current node too
@@ -217,13 +287,13 @@ std::tuple<QString, bool, int> InlineProcessor::applyPattern(std::shared_ptr<Pat
                 if ( child->hasText() ) {
                     QString text = child->text;
                     if ( ! child->atomic ) {
-                        text = this->handleInline(text, patternIndex+1);
+                        text = this->handleInline(dispatch, text, patternIndex+1);
                     }
                     child->text = text;
                 }
                 if ( child->hasTail() ) {
                     QString tail = child->tail;
-                    tail = this->handleInline(tail, patternIndex);
+                    tail = this->handleInline(dispatch, tail, patternIndex);
                     child->tail = tail;
                 }
             }
@@ -234,14 +304,18 @@ std::tuple<QString, bool, int> InlineProcessor::applyPattern(std::shared_ptr<Pat
         placeholder = this->stashNode(*result, pattern->type());
     }
 
-    return std::make_tuple(QString("%1%2%3%4").arg(leftData).arg(match.captured(1)).arg(placeholder).arg(match.captured(match.lastCapturedIndex())), true, 0);
+    //! copies everything after the match, once per match
+    QString result_data = data;
+    result_data.replace(matchStart, matchEnd-matchStart, placeholder);
+    return std::make_tuple(result_data, true, pattern->resumeOffset(matchStart));
 }
 
 Element InlineProcessor::run(const Element &tree)
 {
     std::shared_ptr<Markdown> markdown = this->markdown.lock();
 
-    this->stashed_nodes = StashNodes();
+    Context::current().stashed_nodes = StashNodes();
+    const Dispatch dispatch = this->buildDispatch();
 
     try{
         ElementList_t stack = {tree};
@@ -251,16 +325,18 @@ Element InlineProcessor::run(const Element &tree)
             typedef QPair<Element, ElementList_t> QueueItem;
             typedef QList<QueueItem> Queue;
             Queue insertQueue;
-            for ( const Element &child : currElement->child() ) {
+            //! walks the children as they were: the iterator has already
+            //! moved on when results are inserted after the child
+            for ( const Element &child : *currElement ) {
                 if ( child->hasText() && ! child->atomic ) {
                     QString text = child->text;
                     child->text.clear();
-                    ElementList_t lst = this->processPlaceholders(this->handleInline(text), child);
+                    ElementList_t lst = this->processPlaceholders(this->handleInline(dispatch, text), child);
                     stack.append(lst);
                     insertQueue.push_back(qMakePair(child, lst));
                 }
                 if ( child->hasTail() ) {
-                    QString tail = this->handleInline(child->tail);
+                    QString tail = this->handleInline(dispatch, child->tail);
                     Element dumby = createElement("d");
                     ElementList_t tailResult = this->processPlaceholders(tail, dumby, false);
                     if ( dumby->hasTail() ) {
@@ -268,10 +344,7 @@ Element InlineProcessor::run(const Element &tree)
                     } else {
                         child->tail.clear();
                     }
-                    int pos = currElement->child().indexOf(child) + 1;
-                    for ( Element elem : pypp::reversed(tailResult) ) {
-                        currElement->insert(pos, elem);
-                    }
+                    currElement->insertAfter(child, tailResult);
                 }
                 if ( child->size() > 0 ) {
                     stack.push_back(child);
@@ -287,7 +360,6 @@ Element InlineProcessor::run(const Element &tree)
                         element->text = text;
                     }
                 }
-                int i = 0;
                 for ( const Element &newChild : lst ) {
                     if ( markdown->enable_attributes() ) {
                         //! Processing attributes
@@ -302,8 +374,9 @@ Element InlineProcessor::run(const Element &tree)
                             newChild->text = text;
                         }
                     }
-                    element->insert(i++, newChild);
                 }
+                //! the results lead the children the element already has
+                element->insertAfter(Element(), lst);
             }
         }
         return tree;
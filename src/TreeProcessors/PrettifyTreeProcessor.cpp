@@ -5,47 +5,65 @@
 namespace markdown
 {
 
-void PrettifyTreeProcessor::prettifyETree(const Element &elem)
+namespace {
+
+void break_tail(const Element &elem)
 {
-    if ( util::isBlockLevel(elem->tag) && elem->tag != "code" && elem->tag != "pre" ) {
-        if ( ( ! elem->hasText() || elem->text.trimmed().isEmpty() )
-             && elem->size() > 0 && util::isBlockLevel(elem->child().front()->tag) ) {
-            elem->text = "\n";
-        }
-        for ( const Element &e : elem->child() ) {
-            if ( util::isBlockLevel(e->tag) ) {
-                this->prettifyETree(e);
-            }
-        }
-        if ( ! elem->hasTail() || elem->tail.trimmed().isEmpty() ) {
-            elem->tail = "\n";
-        }
-    }
     if ( ! elem->hasTail() || elem->tail.trimmed().isEmpty() ) {
         elem->tail = "\n";
     }
 }
 
-Element PrettifyTreeProcessor::run(const Element &root)
+}
+
+PrettifyTreeProcessor::PrettifyTreeProcessor(const std::weak_ptr<Markdown> &md_instance) :
+    TreeVisitor(md_instance)
+{
+    this->onEnter(QString(), [this](const Element &elem){ return this->prettifyElement(elem); });
+    this->onEnter("br", [this](const Element &br){ return this->prettifyBreak(br); });
+    this->onEnter("pre", [this](const Element &pre){ return this->prettifyCode(pre); });
+}
+
+bool PrettifyTreeProcessor::prettifyElement(const Element &elem)
 {
-    this->prettifyETree(root);
-    //! Do <br />'s seperately as they are often in the middle of
-    //! inline content and missed by _prettifyETree.
-    for ( const Element &br : root->iter("br") ) {
-        if ( ! br->hasTail() || br->tail.trimmed().isEmpty() ) {
-            br->tail = "\n";
-        } else {
-            br->tail = "\n"+br->tail;
-        }
+    if ( ! util::isBlockLevel(elem->tag) ) {
+        return false;
+    }
+    break_tail(elem);
+    if ( elem->tag == "code" || elem->tag == "pre" ) {
+        return false;
     }
-    //! Clean up extra empty lines at end of code blocks.
-    for ( const Element &pre : root->iter("pre") ) {
-        if ( pre->size() > 0 && pre->child().front()->tag == "code" ) {
-            pre->child().front()->text = pypp::rstrip(pre->child().front()->text)+"\n";
-            pre->child().front()->atomic = true;
-        }
+    if ( ( ! elem->hasText() || elem->text.trimmed().isEmpty() )
+         && elem->size() > 0 && util::isBlockLevel((*elem->begin())->tag) ) {
+        elem->text = "\n";
     }
-    return Element();
+    return true;
+}
+
+bool PrettifyTreeProcessor::prettifyBreak(const Element &br)
+{
+    if ( ! br->hasTail() || br->tail.trimmed().isEmpty() ) {
+        br->tail = "\n";
+    } else {
+        br->tail = "\n"+br->tail;
+    }
+    return true;
+}
+
+bool PrettifyTreeProcessor::prettifyCode(const Element &pre)
+{
+    if ( pre->size() > 0 && (*pre->begin())->tag == "code" ) {
+        Element code = *pre->begin();
+        code->text = pypp::rstrip(code->text)+"\n";
+        code->atomic = true;
+    }
+    return true;
+}
+
+void PrettifyTreeProcessor::begin(const Element &root)
+{
+    //! the root gets its linebreak even if it isn't block level
+    break_tail(root);
 }
 
 } // namespace markdown
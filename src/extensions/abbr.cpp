@@ -1,37 +1,160 @@
 #include "extensions/abbr.h"
 
+#include <QHash>
+#include <QMap>
+#include <QVector>
+
+#include "Context.h"
+#include "InlinePatterns/common.h"
 #include "Markdown.h"
 #include "PreProcessors.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
 
-const QRegularExpression ABBR_REF_RE(R"([*]\[(?<abbr>[^\]]*)\][ ]?:\s*(?<title>.*))");
+const QRegularExpression ABBR_REF_RE = RegexCache::compile(R"([*]\[(?<abbr>[^\]]*)\][ ]?:\s*(?<title>.*))");
+const QString ABBR_REF_START("*[");  //!< every match of ABBR_REF_RE contains it
+
+//! AbbrPattern only finds its matches with scan(), so its expression is
+//! a constant one that matches nothing, compiled once for all documents
+const QString ABBR_RE("(?<abbr>(?!))");
 
 /*!
  * Abbreviation inline pattern.
+ *
+ * All abbreviations of a document are compiled into one Aho-Corasick
+ * automaton, so a text is searched for every one of them in a single
+ * pass instead of once per abbreviation.  Where abbreviations overlap,
+ * the leftmost and then the longest wins, as with an alternation of them
+ * sorted longest first, `\b(?:HTML5|HTML|W3C)\b`.
  */
 class AbbrPattern : public Pattern
 {
 public:
-    AbbrPattern(const QString &pattern, const QString &title) :
-        Pattern(pattern),
-        title(title)
-    {}
+    typedef QMap<QString, QString> Definitions;  //!< abbreviation -> title
+
+    explicit AbbrPattern(const Definitions &definitions) :
+        Pattern(ABBR_RE),
+        definitions(definitions),
+        abbrs(definitions.keys()),
+        states(),
+        longest(0)
+    {
+        this->build();
+    }
 
-    Element handleMatch(const ElementTree &, const QRegularExpressionMatch &m)
+    bool scans() const
+    { return true; }
+
+    std::tuple<int, int, Element> scan(const QString &data, int offset, ScanStatePtr &)
     {
+        int bestStart = -1, bestEnd = -1;
+        int state = 0;
+        for ( int i = qMax(offset, 0); i < data.size(); ++i ) {
+            //! nothing ending here can start at or before the best match
+            if ( bestStart != -1 && i+1-this->longest > bestStart ) {
+                break;
+            }
+            ushort ch = data.at(i).unicode();
+            while ( state != 0 && ! this->states.at(state).next.contains(ch) ) {
+                state = this->states.at(state).fail;
+            }
+            state = this->states.at(state).next.value(ch, 0);
+            for ( int s = state; s != -1; s = this->states.at(s).output ) {
+                int abbr = this->states.at(s).abbr;
+                if ( abbr == -1 ) {
+                    continue;
+                }
+                int end = i + 1;
+                int start = end - this->abbrs.at(abbr).size();
+                if ( ! isWordBoundary(data, start) || ! isWordBoundary(data, end) ) {
+                    continue;
+                }
+                if ( bestStart == -1 || start < bestStart || ( start == bestStart && end > bestEnd ) ) {
+                    bestStart = start;
+                    bestEnd = end;
+                }
+            }
+        }
+        if ( bestStart == -1 ) {
+            return std::make_tuple(-1, -1, Element());
+        }
+        QString text = data.mid(bestStart, bestEnd-bestStart);
         Element abbr = createElement("abbr");
-        abbr->text = m.captured("abbr");
+        abbr->text = text;
         abbr->atomic = true;
-        abbr->set("title", this->title);
-        return abbr;
+        abbr->set("title", this->definitions.value(text));
+        return std::make_tuple(bestStart, bestEnd, abbr);
     }
 
+    //! placeholders start with STX, so no match can reach back into one
+    int resumeOffset(int start) const
+    { return start; }
+
     QString type() const
     { return "AbbrPattern"; }
 
-    QString title;
+    Definitions definitions;
+
+private:
+    struct State
+    {
+        QHash<ushort, int> next;
+        int fail;
+        int abbr;    //!< index of the abbreviation ending here, or -1
+        int output;  //!< next state on the fail chain with an abbreviation, or -1
+    };
+
+    void build()
+    {
+        this->states.append(State{QHash<ushort, int>(), 0, -1, -1});
+        QString triggers;
+        for ( int i = 0; i < this->abbrs.size(); ++i ) {
+            const QString &abbr = this->abbrs.at(i);
+            int state = 0;
+            for ( const QChar &ch : abbr ) {
+                int next = this->states.at(state).next.value(ch.unicode(), -1);
+                if ( next == -1 ) {
+                    next = this->states.size();
+                    this->states.append(State{QHash<ushort, int>(), 0, -1, -1});
+                    this->states[state].next.insert(ch.unicode(), next);
+                }
+                state = next;
+            }
+            this->states[state].abbr = i;
+            this->longest = qMax(this->longest, abbr.size());
+            if ( ! triggers.contains(abbr.at(0)) ) {
+                triggers.append(abbr.at(0));
+            }
+        }
+        this->setTriggers(triggers);
+
+        //! breadth first, so the fail state of a state is done before it
+        QVector<int> queue;
+        for ( auto it = this->states.at(0).next.constBegin(); it != this->states.at(0).next.constEnd(); ++it ) {
+            queue.append(it.value());
+        }
+        for ( int head = 0; head < queue.size(); ++head ) {
+            int parent = queue.at(head);
+            const QHash<ushort, int> next = this->states.at(parent).next;
+            for ( auto it = next.constBegin(); it != next.constEnd(); ++it ) {
+                int fail = this->states.at(parent).fail;
+                while ( fail != 0 && ! this->states.at(fail).next.contains(it.key()) ) {
+                    fail = this->states.at(fail).fail;
+                }
+                fail = this->states.at(fail).next.value(it.key(), 0);
+                State &child = this->states[it.value()];
+                child.fail = fail;
+                child.output = this->states.at(fail).abbr != -1 ? fail : this->states.at(fail).output;
+                queue.append(it.value());
+            }
+        }
+    }
+
+    QStringList abbrs;
+    QVector<State> states;
+    int longest;
 
 };
 
@@ -42,44 +165,43 @@ class AbbrPreprocessor : public PreProcessor
 {
 public:
     using PreProcessor::PreProcessor;
+    using PreProcessor::run;
 
     /*!
      * Find and remove all Abbreviation references from the text.
-     * Each reference is set as a new AbbrPattern in the markdown instance.
+     * All references are set as one AbbrPattern of the current document.
      */
-    QStringList run(const QStringList &lines)
+    void run(LineBuffer &lines)
     {
-        std::shared_ptr<Markdown> markdown = this->markdown.lock();
+        OrderedDictPatterns &inlinePatterns = Context::current().inlinePatterns;
 
-        QStringList new_text;
-        for ( const QString &line : lines ) {
-            QRegularExpressionMatch m = ABBR_REF_RE.match(line);
+        AbbrPattern::Definitions definitions;
+        if ( inlinePatterns.exists("abbr") ) {
+            definitions = std::static_pointer_cast<AbbrPattern>(inlinePatterns["abbr"])->definitions;
+        }
+        LineBuffer::Spans new_text;
+        new_text.reserve(lines.size());
+        for ( int i = 0; i < lines.size(); ++i ) {
+            if ( ! lines.at(i).contains(ABBR_REF_START) ) {
+                new_text.append(lines.span(i));
+                continue;
+            }
+            QRegularExpressionMatch m = ABBR_REF_RE.match(lines.line(i));
             if ( m.hasMatch() ) {
                 QString abbr = m.captured("abbr").trimmed();
                 QString title = m.captured("title").trimmed();
-                markdown->inlinePatterns[QString("abbr-%1").arg(abbr)] = std::make_shared<AbbrPattern>(this->generate_pattern(abbr), title);
+                //! an empty abbreviation would match at every word boundary
+                if ( ! abbr.isEmpty() ) {
+                    definitions.insert(abbr, title);
+                }
             } else {
-                new_text.append(line);
+                new_text.append(lines.span(i));
             }
         }
-        return new_text;
-    }
-
-    /*!
-     * Given a string, returns an regex pattern to match that string.
-     *
-     * 'HTML' -> r'(?P<abbr>[H][T][M][L])'
-     *
-     * Note: we force each char as a literal match (in brackets) as we don't
-     * know what they will be beforehand.
-     */
-    QString generate_pattern(const QString &text)
-    {
-        QString chars;
-        for ( int i = 0; i < text.size(); ++i ) {
-            chars += QString("[%1]").arg(text.at(i));
+        lines.setSpans(new_text);
+        if ( ! definitions.isEmpty() ) {
+            inlinePatterns["abbr"] = std::make_shared<AbbrPattern>(definitions);
         }
-        return QString("(?<abbr>\\b%1\\b)").arg(chars);
     }
 
 };
@@ -3,6 +3,7 @@
 #include "Markdown.h"
 #include "BlockParser.h"
 #include "BlockProcessors.h"
+#include "RegexCache.h"
 
 namespace markdown
 {
@@ -12,8 +13,10 @@ class AdmonitionProcessor : public BlockProcessor
 public:
     AdmonitionProcessor(const std::weak_ptr<BlockParser> &parser) :
         BlockProcessor(parser),
-        RE("(?:^|\\n)!!!\\ ?([\\w\\-]+)(?:\\ \"(.*?)\")?")
-    {}
+        RE(RegexCache::compile("(?:^|\\n)!!!\\ ?([\\w\\-]+)(?:\\ \"(.*?)\")?"))
+    {
+        this->setPrefilter(BlockPrefilter::lineStart("!") | BlockPrefilter::indented(this->tab_length));
+    }
 
     bool test(const Element &parent, const QString &block)
     {
@@ -52,7 +55,7 @@ public:
         }
 
         std::shared_ptr<BlockParser> parser = this->parser.lock();
-        parser->parseChunk(div, block);
+        parser->scheduleChunk(div, block);
 
         if ( ! theRest.isEmpty() ) {
             //! This block contained unindented line(s) after the first indented
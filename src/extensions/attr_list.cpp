@@ -3,91 +3,160 @@
 #include "pypp/str.hpp"
 
 #include "Markdown.h"
+#include "RegexCache.h"
 #include "TreeProcessors.h"
 #include "util.h"
 
 namespace markdown{
 
-QPair<QString, QString> handle_double_quote(const QString &t)
-{
-    QStringList tmp = t.split("=");
-    return qMakePair(tmp[0], pypp::strip(tmp[1], "\""));
-}
+namespace {
 
-QPair<QString, QString> handle_single_quote(const QString &t)
-{
-    QStringList tmp = t.split("=");
-    return qMakePair(tmp[0], pypp::strip(tmp[1], "'"));
-}
+const QString CLASS_KEY(".");
+const QString ID_KEY("id");
 
-QPair<QString, QString> handle_key_value(const QString &t)
+/*!
+ * Returns: the end of `key="value"` (or with the other quote) starting
+ * at i, or -1.
+ *
+ * Like `[^ ]+=".*?"`, the key takes as much of the run of non-space
+ * characters [i, run) as it can while leaving a value closed on its
+ * line.  Candidates are tried from the right, and the search for the
+ * closing quote of one stops at the opening quote of the one tried
+ * before, so the run is scanned only once.
+ */
+int scan_quoted(const QChar *data, int size, int i, int run, QChar quote)
 {
-    QStringList tmp = t.split("=");
-    return qMakePair(tmp[0], tmp[1]);
+    for ( int k = run - 2; k > i; --k ) {
+        if ( data[k] == '=' && data[k+1] == quote ) {
+            int c = k + 2;
+            while ( c < size && data[c] != quote && data[c] != '\n' ) {
+                ++c;
+            }
+            if ( c < size && data[c] == quote ) {
+                return c + 1;
+            }
+        }
+    }
+    return -1;
 }
 
-QPair<QString, QString> handle_word(const QString &t)
+/*!
+ * Returns: the end of `key=value` starting at i, or -1, like
+ * `[^ ]+=[^ =]+`.
+ */
+int scan_unquoted(const QChar *data, int i, int run)
 {
-    if ( t.startsWith(".") ) {
-        return qMakePair(QString("."), t.mid(1));
-    }
-    if ( t.startsWith("#") ) {
-        return qMakePair(QString("id"), t.mid(1));
+    for ( int k = run - 2; k > i; --k ) {
+        if ( data[k] == '=' && data[k+1] != '=' ) {
+            int end = k + 1;
+            while ( end < run && data[end] != '=' ) {
+                ++end;
+            }
+            return end;
+        }
     }
-    return qMakePair(t, t);
+    return -1;
 }
 
-QList<QRegularExpression> SCAN_PATTERNS = {
-    QRegularExpression("[^ ]+=\".*?\""),
-    QRegularExpression("[^ ]+='.*?'"),
-    QRegularExpression("[^ ]+=[^ =]+"),
-    QRegularExpression("[^ =]+"),
-    QRegularExpression(" "),
-};
-
 /*!
- * Parse attribute list and return a list of attribute tuples.
+ * Parse attribute list and call assign(key, value) for every attribute.
+ *
+ * Scans str once, trying at each position what the expressions of
+ * Python-Markdown try, in the same order:
+ *
+ *     [^ ]+=".*?"    key="value"
+ *     [^ ]+='.*?'    key='value'
+ *     [^ ]+=[^ =]+   key=value
+ *     [^ =]+         .class, #id or a bare word
+ *
+ * A key ends at its first '=' and a value at the next one, as if the
+ * match was split on '=', and quotes come off both ends of a quoted
+ * value.  Keys and values refer to str.
  */
-QList<QPair<QString, QString>> get_attrs(const QString &str)
+template <typename Assign>
+void scan_attrs(const QString &str, Assign assign)
 {
-    QList<QPair<QString, QString>> result;
+    const QChar *data = str.constData();
+    const int size = str.size();
     int i = 0;
-    while ( true ) {
-        int i_re;
-        QRegularExpressionMatch match;
-        for ( i_re = 0; i_re < SCAN_PATTERNS.size(); ++i_re ) {
-            QRegularExpression re = SCAN_PATTERNS[i_re];
-            match = re.match(str.mid(i));
-            if ( match.hasMatch() && match.capturedStart() == 0 ) {
-                break;
-            }
+    while ( i < size ) {
+        if ( data[i] == ' ' ) {
+            ++i;
+            continue;
         }
-        if ( ! match.hasMatch() ) {
-            break;
+        int run = i;
+        while ( run < size && data[run] != ' ' ) {
+            ++run;
         }
-        int j = i + match.capturedEnd();
-        if ( i == j ) {
-            break;
+        QChar quote;
+        int end = scan_quoted(data, size, i, run, '"');
+        if ( end != -1 ) {
+            quote = '"';
+        } else if ( ( end = scan_quoted(data, size, i, run, '\'') ) != -1 ) {
+            quote = '\'';
+        } else {
+            end = scan_unquoted(data, i, run);
         }
-        switch ( i_re ) {
-        case 0:
-            result.append(handle_double_quote(match.captured()));
-            break;
-        case 1:
-            result.append(handle_single_quote(match.captured()));
-            break;
-        case 2:
-            result.append(handle_key_value(match.captured()));
-            break;
-        case 3:
-            result.append(handle_word(match.captured()));
-            break;
-        default:
+        if ( end != -1 ) {
+            int key = i;
+            while ( data[key] != '=' ) {
+                ++key;
+            }
+            int begin = key + 1;
+            int last = begin;
+            while ( last < end && data[last] != '=' ) {
+                ++last;
+            }
+            if ( ! quote.isNull() ) {
+                while ( begin < last && data[begin] == quote ) {
+                    ++begin;
+                }
+                while ( last > begin && data[last-1] == quote ) {
+                    --last;
+                }
+            }
+            assign(str.midRef(i, key-i), str.midRef(begin, last-begin));
+        } else if ( data[i] != '=' ) {
+            end = i;
+            while ( end < run && data[end] != '=' ) {
+                ++end;
+            }
+            QStringRef word = str.midRef(i, end-i);
+            if ( data[i] == '.' ) {
+                assign(QStringRef(&CLASS_KEY), word.mid(1));
+            } else if ( data[i] == '#' ) {
+                assign(QStringRef(&ID_KEY), word.mid(1));
+            } else {
+                assign(word, word);
+            }
+        } else if ( run < size ) {
+            //! nothing starts with a stray '=', skip to the next space
+            end = run + 1;
+        } else {
             break;
-        };
-        i = j;
+        }
+        i = end;
     }
-    return result;
+}
+
+/*!
+ * Whether a character may be part of an XML Name, minus the ":".
+ */
+bool isNameChar(ushort ch)
+{
+    if ( ch < 0x80 ) {
+        return ( ch >= 'a' && ch <= 'z' ) || ( ch >= 'A' && ch <= 'Z' ) || ( ch >= '0' && ch <= '9' )
+                || ch == '_' || ch == ':' || ch == '-' || ch == '.';
+    }
+    return ch == 0xb7
+            || ( ch >= 0xc0 && ch <= 0xd6 ) || ( ch >= 0xd8 && ch <= 0xf6 )
+            || ( ch >= 0xf8 && ch <= 0x37d ) || ( ch >= 0x37f && ch <= 0x1fff )
+            || ( ch >= 0x200c && ch <= 0x200d ) || ( ch >= 0x203f && ch <= 0x2040 )
+            || ( ch >= 0x2070 && ch <= 0x218f ) || ( ch >= 0x2c00 && ch <= 0x2fef )
+            || ( ch >= 0x3001 && ch <= 0xd7ff ) || ( ch >= 0xf900 && ch <= 0xfdcf )
+            || ( ch >= 0xfdf0 && ch <= 0xfffd );
+}
+
 }
 
 QSet<QString> HEADERS = {"h1", "h2", "h3", "h4", "h5", "h6"};
@@ -98,131 +167,165 @@ bool isheader(const Element &elem)
     return HEADERS.contains(elem->tag);
 }
 
-class AttrListTreeprocessor : public TreeProcessor
+class AttrListTreeprocessor : public TreeVisitor
 {
 public:
     AttrListTreeprocessor(const std::weak_ptr<Markdown> &md_instance) :
-        TreeProcessor(md_instance),
+        TreeVisitor(md_instance),
         BASE_RE("\\{\\:?([^\\}]*)\\}"),
-        HEADER_RE(QString("[ ]+%1[ ]*$").arg(this->BASE_RE)),
-        BLOCK_RE(QString("\\n[ ]*%1[ ]*$").arg(this->BASE_RE)),
-        INLINE_RE(QString("^%1").arg(this->BASE_RE)),
-        NAME_RE("[^A-Z_a-z\u00c0-\u00d6\u00d8-\u00f6\u00f8-\u02ff"
-                "\u0370-\u037d\u037f-\u1fff\u200c-\u200d"
-                "\u2070-\u218f\u2c00-\u2fef\u3001-\ud7ff"
-                "\uf900-\ufdcf\ufdf0-\ufffd"
-                "\\:\\-\\.0-9\u00b7\u0300-\u036f\u203f-\u2040]+")
-    {}
-
-    Element run(const Element &doc)
+        HEADER_RE(RegexCache::compile(QString("[ ]+%1[ ]*$").arg(this->BASE_RE))),
+        BLOCK_RE(RegexCache::compile(QString("\\n[ ]*%1[ ]*$").arg(this->BASE_RE))),
+        INLINE_RE(RegexCache::compile(QString("^%1").arg(this->BASE_RE))),
+        CELL_RE(RegexCache::compile(this->BASE_RE))
+    {
+        this->onExit(QString(), [this](const Element &elem){ this->assign(elem); });
+    }
+
+    /*!
+     * Attributes of an element and of the inline elements among its
+     * children, after all of them have been visited.  Attributes at the
+     * end of the block come off before the ones right after an inline
+     * element, the same as in document order.
+     */
+    void assign(const Element &elem)
+    {
+        if ( util::isBlockLevel(elem->tag) ) {
+            this->assign_block(elem);
+        }
+        for ( const Element &child : *elem ) {
+            if ( ! util::isBlockLevel(child->tag) ) {
+                this->assign_inline(child);
+            }
+        }
+    }
+
+    void end(const Element &doc)
+    {
+        //! the root has no parent to take care of it
+        if ( ! util::isBlockLevel(doc->tag) ) {
+            this->assign_inline(doc);
+        }
+    }
+
+    void assign_block(const Element &elem)
     {
-        for ( const Element &elem : doc->iter() ) {
-            if ( util::isBlockLevel(elem->tag) ) {
-                //! Block level: check for attrs on last line of text
-                QRegularExpression RE = this->BLOCK_RE;
-                if ( isheader(elem) || elem->tag == "dt" ) {
-                    //! header or def-term: check for attrs at end of line
-                    RE = this->HEADER_RE;
+        //! Block level: check for attrs on last line of text
+        QRegularExpression RE = this->BLOCK_RE;
+        if ( isheader(elem) || elem->tag == "dt" ) {
+            //! header or def-term: check for attrs at end of line
+            RE = this->HEADER_RE;
+        }
+        if ( elem->size() > 0 && elem->tag == "li" ) {
+            //! special case list items. children may include a ul or ol.
+            int pos = -1;
+            //! find the ul or ol position
+            for ( int i = 0; i < elem->size(); ++i ) {
+                Element child = (*elem)[i];
+                if ( LISTS.contains(child->tag) ) {
+                    pos = i;
                 }
-                if ( elem->size() > 0 && elem->tag == "li" ) {
-                    //! special case list items. children may include a ul or ol.
-                    int pos = -1;
-                    //! find the ul or ol position
-                    for ( int i = 0; i < elem->size(); ++i ) {
-                        Element child = (*elem)[i];
-                        if ( LISTS.contains(child->tag) ) {
-                            pos = i;
-                        }
-                    }
-                    if ( pos == -1 && (*elem)[-1]->hasTail() ) {
-                        //! use tail of last child. no ul or ol.
-                        QRegularExpressionMatch m = RE.match((*elem)[-1]->tail);
-                        if ( m.hasMatch() ) {
-                            this->assign_attrs(elem, m.captured(1));
-                            (*elem)[-1]->tail = (*elem)[-1]->tail.left(m.capturedStart());
-                        }
-                    } else if ( pos != -1 && pos > 0 && (*elem)[pos-1]->hasTail() ) {
-                        //! use tail of last child before ul or ol
-                        QRegularExpressionMatch m = RE.match((*elem)[pos-1]->tail);
-                        if ( m.hasMatch() ) {
-                            this->assign_attrs(elem, m.captured(1));
-                            (*elem)[pos-1]->tail = (*elem)[pos-1]->tail.left(m.capturedStart());
-                        }
-                    } else if ( elem->hasText() ) {
-                        //! use text. ul is first child.
-                        QRegularExpressionMatch m = RE.match(elem->text);
-                        if ( m.hasMatch() ) {
-                            this->assign_attrs(elem, m.captured(1));
-                            elem->text = elem->text.left(m.capturedStart());
-                        }
-                    }
-                } else if ( elem->size() > 0 && (*elem)[-1]->hasTail() ) {
-                    //! has children. Get from tail of last child
-                    QRegularExpressionMatch m = RE.match((*elem)[-1]->tail);
-                    if ( m.hasMatch() ) {
-                        this->assign_attrs(elem, m.captured(1));
-                        (*elem)[-1]->tail = (*elem)[-1]->tail.left(m.capturedStart());
-                        if ( isheader(elem) ) {
-                            //! clean up trailing #s
-                            (*elem)[-1]->tail = pypp::rstrip(pypp::rstrip((*elem)[-1]->tail, "#"));
-                        }
-                    }
-                } else if ( elem->hasText() ) {
-                    //! no children. Get from text.
-                    QRegularExpressionMatch m = RE.match(elem->text);
-                    if ( ! m.hasMatch() && elem->tag == "td" ) {
-                        m = QRegularExpression(this->BASE_RE).match(elem->text);
-                    }
-                    if ( m.hasMatch() ) {
-                        this->assign_attrs(elem, m.captured(1));
-                        elem->text = elem->text.left(m.capturedStart());
-                        if ( isheader(elem) ) {
-                            //! clean up trailing #s
-                            elem->text = pypp::rstrip(pypp::rstrip(elem->text, "#"));
-                        }
-                    }
+            }
+            if ( pos == -1 && (*elem)[-1]->hasTail() ) {
+                //! use tail of last child. no ul or ol.
+                QRegularExpressionMatch m = RE.match((*elem)[-1]->tail);
+                if ( m.hasMatch() ) {
+                    this->assign_attrs(elem, m.captured(1));
+                    (*elem)[-1]->tail = (*elem)[-1]->tail.left(m.capturedStart());
                 }
-            } else {
-                //! inline: check for attrs at start of tail
-                if ( elem->hasTail() ) {
-                    QRegularExpressionMatch m = this->INLINE_RE.match(elem->tail);
-                    if ( m.hasMatch() ) {
-                        this->assign_attrs(elem, m.captured(1));;
-                        elem->tail = elem->tail.mid(m.capturedEnd());
-                    }
+            } else if ( pos != -1 && pos > 0 && (*elem)[pos-1]->hasTail() ) {
+                //! use tail of last child before ul or ol
+                QRegularExpressionMatch m = RE.match((*elem)[pos-1]->tail);
+                if ( m.hasMatch() ) {
+                    this->assign_attrs(elem, m.captured(1));
+                    (*elem)[pos-1]->tail = (*elem)[pos-1]->tail.left(m.capturedStart());
+                }
+            } else if ( elem->hasText() ) {
+                //! use text. ul is first child.
+                QRegularExpressionMatch m = RE.match(elem->text);
+                if ( m.hasMatch() ) {
+                    this->assign_attrs(elem, m.captured(1));
+                    elem->text = elem->text.left(m.capturedStart());
+                }
+            }
+        } else if ( elem->size() > 0 && (*elem)[-1]->hasTail() ) {
+            //! has children. Get from tail of last child
+            QRegularExpressionMatch m = RE.match((*elem)[-1]->tail);
+            if ( m.hasMatch() ) {
+                this->assign_attrs(elem, m.captured(1));
+                (*elem)[-1]->tail = (*elem)[-1]->tail.left(m.capturedStart());
+                if ( isheader(elem) ) {
+                    //! clean up trailing #s
+                    (*elem)[-1]->tail = pypp::rstrip(pypp::rstrip((*elem)[-1]->tail, "#"));
+                }
+            }
+        } else if ( elem->hasText() ) {
+            //! no children. Get from text.
+            QRegularExpressionMatch m = RE.match(elem->text);
+            if ( ! m.hasMatch() && elem->tag == "td" ) {
+                m = this->CELL_RE.match(elem->text);
+            }
+            if ( m.hasMatch() ) {
+                this->assign_attrs(elem, m.captured(1));
+                elem->text = elem->text.left(m.capturedStart());
+                if ( isheader(elem) ) {
+                    //! clean up trailing #s
+                    elem->text = pypp::rstrip(pypp::rstrip(elem->text, "#"));
                 }
             }
         }
-        return Element();
+    }
+
+    void assign_inline(const Element &elem)
+    {
+        //! inline: check for attrs at start of tail
+        if ( elem->hasTail() ) {
+            QRegularExpressionMatch m = this->INLINE_RE.match(elem->tail);
+            if ( m.hasMatch() ) {
+                this->assign_attrs(elem, m.captured(1));;
+                elem->tail = elem->tail.mid(m.capturedEnd());
+            }
+        }
     }
 
     void assign_attrs(const Element &elem, const QString &attrs)
     {
-        for ( const QPair<QString, QString> &item : get_attrs(attrs) ) {
-            QString k = item.first;
-            QString v = item.second;
-            if ( k == "." ) {
+        scan_attrs(attrs, [&](const QStringRef &k, const QStringRef &v){
+            if ( k == CLASS_KEY ) {
                 //! add to class
                 QString cls = elem->get("class");
                 if ( ! cls.isEmpty() ) {
-                    elem->set("class", QString("%1 %2").arg(cls, v));
+                    elem->set("class", QString("%1 %2").arg(cls, v.toString()));
                 } else {
-                    elem->set("class", v);
+                    elem->set("class", v.toString());
                 }
             } else {
                 //! assign attr k with v
-                elem->set(this->sanitize_name(k), v);
+                elem->set(this->sanitize_name(k), v.toString());
             }
-        }
+        });
     }
 
     /*!
      * Sanitize name as 'an XML Name, minus the ":"'.
      * See http://www.w3.org/TR/REC-xml-names/#NT-NCName
+     *
+     * Every run of other characters becomes a single "_".
      */
-    QString sanitize_name(const QString &name)
+    QString sanitize_name(const QStringRef &name)
     {
-        return pypp::re::sub(this->NAME_RE, "_", name);
+        QString result;
+        result.reserve(name.size());
+        bool replaced = false;
+        for ( QChar ch : name ) {
+            if ( isNameChar(ch.unicode()) ) {
+                result.append(ch);
+                replaced = false;
+            } else if ( ! replaced ) {
+                result.append('_');
+                replaced = true;
+            }
+        }
+        return result;
     }
 
 protected:
@@ -230,7 +333,7 @@ protected:
     QRegularExpression HEADER_RE;
     QRegularExpression BLOCK_RE;
     QRegularExpression INLINE_RE;
-    QRegularExpression NAME_RE;
+    QRegularExpression CELL_RE;
 
 };
 
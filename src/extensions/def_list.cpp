@@ -3,6 +3,7 @@
 #include "Markdown.h"
 #include "BlockParser.h"
 #include "BlockProcessors.h"
+#include "RegexCache.h"
 
 #include "BlockProcessors/ListIndentProcessor.h"
 
@@ -17,9 +18,11 @@ class DefListProcessor : public BlockProcessor
 public:
     DefListProcessor(const std::weak_ptr<BlockParser> &parser) :
         BlockProcessor(parser),
-        RE("(^|\\n)[ ]{0,3}:[ ]{1,3}(.*?)(\\n|$)"),
-        NO_INDENT_RE("^[ ]{0,3}[^ :]")
-    {}
+        RE(RegexCache::compile("(^|\\n)[ ]{0,3}:[ ]{1,3}(.*?)(\\n|$)")),
+        NO_INDENT_RE(RegexCache::compile("^[ ]{0,3}[^ :]"))
+    {
+        this->setPrefilter(BlockPrefilter::lineStart(":", 3));
+    }
 
     bool test(const Element &, const QString &block)
     {
@@ -89,11 +92,8 @@ public:
         }
         //! Add definition
         std::shared_ptr<BlockParser> parser = this->parser.lock();
-        parser->state.set(state);;
         Element dd = createSubElement(dl, "dd");
-        QStringList new_block = {d};
-        parser->parseBlocks(dd, new_block);
-        parser->state.reset();
+        parser->scheduleBlocks(dd, {d}, state);
 
         if ( ! theRest.isEmpty() ) {
             blocks.insert(0, theRest);
@@ -118,6 +118,7 @@ public:
     {
         this->ITEM_TYPES = {"dd"};
         this->LIST_TYPES = {"dl"};
+        this->setPrefilter(BlockPrefilter::indented(this->tab_length));
     }
 
     /*!
@@ -127,8 +128,7 @@ public:
     {
         Element dd = createSubElement(parent, "dd");
         std::shared_ptr<BlockParser> parser = this->parser.lock();
-        QStringList new_block = {block};
-        parser->parseBlocks(dd, new_block);
+        parser->scheduleBlocks(dd, {block}, "detabbed");
     }
 
 };
@@ -11,6 +11,7 @@ namespace markdown
 void Nl2BrExtension::extendMarkdown(const std::shared_ptr<Markdown> &md)
 {
     std::shared_ptr<Pattern> br_tag = std::make_shared<SubstituteTagPattern>("\\n", "br");
+    br_tag->setTriggers("\n");
     md->inlinePatterns.add("nl", br_tag, "_end");
 }
 
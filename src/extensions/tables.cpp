@@ -7,18 +7,87 @@
 
 #include "extensions/tables.h"
 
+#include <algorithm>
+
+#include <QHash>
+#include <QSet>
 #include <QString>
 #include <QStringList>
+#include <QVector>
 
 #include "Markdown.h"
 #include "BlockParser.h"
 #include "BlockProcessors.h"
-
-#include "InlinePatterns/common.h"
-#include "InlinePatterns/BacktickPattern.h"
+#include "Context.h"
+#include "util.h"
 
 namespace markdown{
 
+namespace {
+
+/*!
+ * The code spans of a row, matched the way
+ * `(?<!\\)(`+)(.+?)(?<!`)\1(?!`)` matches at a position: the span
+ * closes with the first later run of exactly as many backticks as
+ * open it, and opening with fewer backticks is tried next.
+ */
+class CodeSpans
+{
+public:
+    explicit CodeSpans(const QString &row) :
+        row(row),
+        runs()
+    {
+        for ( int i = 0; i < row.size(); ) {
+            if ( row.at(i) != '`' ) {
+                ++i;
+                continue;
+            }
+            int begin = i;
+            while ( i < row.size() && row.at(i) == '`' ) {
+                ++i;
+            }
+            this->runs[i-begin].append(begin);
+        }
+    }
+
+    /*!
+     * Where to go on from a backtick at index: the end of the code
+     * span opening there, past the backticks if none can.
+     */
+    int end(int index) const
+    {
+        if ( index > 0 && this->row.at(index-1) == '\\' ) {
+            //! escaped, but the next backtick may still open one
+            return index + 1;
+        }
+        int after = index;
+        while ( after < this->row.size() && this->row.at(after) == '`' ) {
+            ++after;
+        }
+        for ( int length = after-index; length > 0; --length ) {
+            auto it = this->runs.constFind(length);
+            if ( it == this->runs.constEnd() ) {
+                continue;
+            }
+            auto close = std::lower_bound(it->constBegin(), it->constEnd(), after);
+            if ( close != it->constEnd() ) {
+                return *close + length;
+            }
+        }
+        //! none closes after a shorter opening either
+        return after;
+    }
+
+private:
+    const QString &row;
+    //! starts of the runs of backticks by their length
+    QHash<int, QVector<int>> runs;
+
+};
+
+}
+
 /*!
  * Process Tables.
  */
@@ -28,16 +97,23 @@ public:
     TableProcessor(const std::weak_ptr<BlockParser> &parser) :
         BlockProcessor(parser),
         CHECK_CHARS({'|', ':', '-'})
-    {}
+    {
+        this->setPrefilter(BlockPrefilter::contains("|"));
+    }
 
     bool test(const Element &, const QString &block)
     {
-        QStringList rows = block.split("\n");
-        return rows.size() > 1
-                && rows[0].contains('|')
-                && rows[1].contains('|')
-                && rows[1].contains('-')
-                && this->CHECK_CHARS.contains(rows[1].trimmed().at(0));
+        //! only the first two rows matter
+        const LineIndex lines = this->parser.lock()->lines(block);
+        if ( lines.size() < 2 ) {
+            return false;
+        }
+        QStringRef header = lines.line(0);
+        QStringRef separator = lines.line(1);
+        return header.contains('|')
+                && separator.contains('|')
+                && separator.contains('-')
+                && this->CHECK_CHARS.contains(separator.trimmed().at(0));
     }
 
     /*!
@@ -45,15 +121,13 @@ public:
      */
     bool run(const Element &parent, QStringList &blocks)
     {
-        QString blocksTmp = blocks.front();
+        std::shared_ptr<BlockParser> parser = this->parser.lock();
+
+        QString block = blocks.front();
         blocks.pop_front();
-        QStringList block = blocksTmp.split("\n");
-        QString header = block[0].trimmed();
-        QString separator = block[1].trimmed();
-        QStringList rows;
-        if ( block.size() >= 3 ) {
-            rows = block.mid(2);
-        }
+        const LineIndex lines = parser->lines(block);
+        QString header = lines.line(0).trimmed().toString();
+        QString separator = lines.line(1).trimmed().toString();
         //! Get format type (bordered by pipes or not)
         bool border = false;
         if ( header.startsWith('|') ) {
@@ -72,22 +146,53 @@ public:
                 align.push_back(boost::none);
             }
         }
-        //! Build table
+        Triggers triggers = this->triggers(parser->markdown.lock());
+        //! Build table, one row at a time straight from the lines
         Element table = createSubElement(parent, "table");
         Element thead = createSubElement(table, "thead");
-        this->build_row(header, thead, align, border);
+        this->build_row(header, thead, align, border, triggers);
         Element tbody = createSubElement(table, "tbody");
-        for ( const QString &row : rows ) {
-            this->build_row(row.trimmed(), tbody, align, border);
+        for ( int i = 2; i < lines.size(); ++i ) {
+            this->build_row(lines.line(i).trimmed().toString(), tbody, align, border, triggers);
         }
         return true;
     }
 
 private:
+    //! characters inline patterns start at, none if some pattern doesn't
+    //! tell
+    typedef boost::optional<QSet<QChar>> Triggers;
+
+    /*!
+     * Where inline processing could change the text of a cell.
+     *
+     * A cell with none of these characters comes out of the
+     * InlineProcessor as it went in, so it's made atomic right away.
+     */
+    Triggers triggers(const std::shared_ptr<Markdown> &markdown) const
+    {
+        QSet<QChar> chars;
+        QList<std::shared_ptr<Pattern>> patterns = markdown->inlinePatterns.toList() + Context::current().inlinePatterns.toList();
+        for ( const std::shared_ptr<Pattern> &pattern : patterns ) {
+            QString triggers = pattern->triggers();
+            if ( triggers.isEmpty() ) {
+                return boost::none;
+            }
+            for ( const QChar &ch : triggers ) {
+                chars.insert(ch);
+            }
+        }
+        chars.insert(util::STX.at(0));
+        if ( markdown->enable_attributes() ) {
+            chars.insert('{');
+        }
+        return chars;
+    }
+
     /*!
      * Given a row of text, build table cells.
      */
-    void build_row(const QString &row, const Element &parent, const QList<boost::optional<QString>> &align, bool border)
+    void build_row(const QString &row, const Element &parent, const QList<boost::optional<QString>> &align, bool border, const Triggers &triggers)
     {
         Element tr = createSubElement(parent, "tr");
         QString tag = "td";
@@ -98,11 +203,12 @@ private:
         //! We use align here rather than cells to ensure every row
         //! contains the same number of columns.
         for ( int i = 0; i < align.size(); ++i ) {
-            boost::optional<QString> a = align.at(i);
+            const boost::optional<QString> &a = align.at(i);
             Element c = createSubElement(tr, tag);
             if ( cells.size() > i ) {
                 QString cell = cells.at(i).trimmed();
                 c->text = cell;
+                c->atomic = triggers && std::none_of(cell.begin(), cell.end(), [&](const QChar &ch) { return triggers->contains(ch); });
             } else {
                 c->text = QString();
             }
@@ -130,6 +236,9 @@ private:
 
     /*!
      * split a row of text with some code into a list of cells.
+     *
+     * Markers inside code spans don't split; a code span is what the
+     * backtick pattern would match there.
      */
     QStringList split(const QString &row, const QChar &marker)
     {
@@ -137,34 +246,28 @@ private:
             //! fallback on old behaviour
             return row.split(marker);
         }
-        //! modify the backtick pattern to only match at the beginning of the search string
-        std::shared_ptr<Pattern> backtick_pattern = std::shared_ptr<Pattern>(new BacktickPattern("^" + BACKTICK_RE));
+        CodeSpans spans(row);
         QStringList elements;
-        QString current;
+        int begin = 0;  //!< start of the current cell
         for ( int i = 0; i < row.size(); ) {
             QChar letter = row.at(i);
             if ( letter == marker ) {
-                if ( ! current.isEmpty() || elements.size() == 0 ) {
+                if ( i > begin || elements.size() == 0 ) {
                     //! Don't append empty string unless it is the first element
                     //! The border is already removed when we get the row, then the line is strip()'d
                     //! If the first element is a marker, then we have an empty first cell
-                    elements.append(current);
+                    elements.append(row.mid(begin, i-begin));
                 }
-                current.clear();
+                begin = i + 1;
+                ++i;
+            } else if ( letter == '`' ) {
+                //! jump pointer to the end of the code span, if any
+                i = spans.end(i);
             } else {
-                QRegularExpressionMatch match = backtick_pattern->getCompiledRegExp().match(row.mid(i));
-                if ( ! match.hasMatch() ) {
-                    current += letter;
-                } else {
-                    QString delim = match.captured(2);  //! the code block delimeter (ie 1 or more backticks)
-                    QString row_contents = match.captured(3);  //! the text contained inside the code block
-                    i += match.capturedStart(4) - 1;  //! jump pointer to the beginning of the rest of the text (group #4)
-                    current += delim + row_contents + delim;  //! reinstert backticks
-                }
+                ++i;
             }
-            ++i;
         }
-        elements.append(current);
+        elements.append(row.mid(begin));
         return elements;
     }
 
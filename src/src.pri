@@ -3,10 +3,14 @@ CONFIG += c++11
 HEADERS += \
     $$PWD/../include/QMarkdown/BlockParser.h \
     $$PWD/../include/QMarkdown/BlockProcessors.h \
+    $$PWD/../include/QMarkdown/Context.h \
     $$PWD/../include/QMarkdown/InlinePatterns.h \
+    $$PWD/../include/QMarkdown/LineBuffer.h \
+    $$PWD/../include/QMarkdown/LineIndex.h \
     $$PWD/../include/QMarkdown/Markdown.h \
     $$PWD/../include/QMarkdown/PostProcessors.h \
     $$PWD/../include/QMarkdown/PreProcessors.h \
+    $$PWD/../include/QMarkdown/RegexCache.h \
     $$PWD/../include/QMarkdown/Serializers.h \
     $$PWD/../include/QMarkdown/TreeProcessors.h \
     $$PWD/../include/QMarkdown/htmlentitydefs.hpp \
@@ -21,6 +25,7 @@ HEADERS += \
     $$PWD/../include/QMarkdown/pypp/builtin.hpp \
     $$PWD/../include/QMarkdown/pypp/exceptions.hpp \
     $$PWD/../include/QMarkdown/pypp/slice.hpp \
+    $$PWD/../include/QMarkdown/ElementArena.h \
     $$PWD/../include/QMarkdown/ElementTree.hpp \
     $$PWD/../include/QMarkdown/pypp/xml/etree/elementtree.hpp \
     $$PWD/../include/QMarkdown/InlinePatterns/BacktickPattern.h \
@@ -57,11 +62,16 @@ HEADERS += \
 
 SOURCES += \
     $$PWD/BlockParser.cpp \
+    $$PWD/ElementArena.cpp \
     $$PWD/BlockProcessors.cpp \
+    $$PWD/Context.cpp \
     $$PWD/InlinePatterns.cpp \
+    $$PWD/LineBuffer.cpp \
+    $$PWD/LineIndex.cpp \
     $$PWD/Markdown.cpp \
     $$PWD/PostProcessors.cpp \
     $$PWD/PreProcessors.cpp \
+    $$PWD/RegexCache.cpp \
     $$PWD/Serializers.cpp \
     $$PWD/TreeProcessors.cpp \
     $$PWD/util.cpp \
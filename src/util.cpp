@@ -6,23 +6,27 @@
  */
 #include "util.h"
 
+#include <limits>
+
 #include <QRegularExpression>
 #include <QString>
 
+#include "RegexCache.h"
+
 namespace markdown{
 
-const QRegularExpression util::BLOCK_LEVEL_ELEMENTS("^(p|div|h[1-6]|blockquote|pre|table|dl|ol|ul"
-                                                    "|script|noscript|form|fieldset|iframe|math"
-                                                    "|hr|hr/|style|li|dt|dd|thead|tbody"
-                                                    "|tr|th|td|section|footer|header|group|figure"
-                                                    "|figcaption|aside|article|canvas|output"
-                                                    "|progress|video)$", QRegularExpression::CaseInsensitiveOption);
+const QRegularExpression util::BLOCK_LEVEL_ELEMENTS = RegexCache::compile("^(p|div|h[1-6]|blockquote|pre|table|dl|ol|ul"
+                                                                          "|script|noscript|form|fieldset|iframe|math"
+                                                                          "|hr|hr/|style|li|dt|dd|thead|tbody"
+                                                                          "|tr|th|td|section|footer|header|group|figure"
+                                                                          "|figcaption|aside|article|canvas|output"
+                                                                          "|progress|video)$", QRegularExpression::CaseInsensitiveOption);
 
 const QString util::STX = QString(1, QChar(2));
 const QString util::ETX = QString(1, QChar(3));
 const QString util::INLINE_PLACEHOLDER_PREFIX = util::STX+"klzzwxh:";
 const QString util::INLINE_PLACEHOLDER = util::INLINE_PLACEHOLDER_PREFIX + "%1" + util::ETX;
-const QRegularExpression util::INLINE_PLACEHOLDER_RE(util::INLINE_PLACEHOLDER.arg("([0-9]{4})"));
+const QRegularExpression util::INLINE_PLACEHOLDER_RE = RegexCache::compile(util::INLINE_PLACEHOLDER.arg("([0-9]+)"));
 const QString util::AMP_SUBSTITUTE = util::STX+"amp"+util::ETX;
 
 bool util::isBlockLevel(const QString &tag)
@@ -30,6 +34,61 @@ bool util::isBlockLevel(const QString &tag)
     return util::BLOCK_LEVEL_ELEMENTS.match(tag).hasMatch();
 }
 
+QString util::inlinePlaceholder(int id)
+{
+    QString digits = QString::number(id);
+    QString result;
+    result.reserve(util::INLINE_PLACEHOLDER_PREFIX.size() + digits.size() + 1);
+    result.append(util::INLINE_PLACEHOLDER_PREFIX);
+    result.append(digits);
+    result.append(util::ETX);
+    return result;
+}
+
+namespace {
+
+const QString HTML_PLACEHOLDER_PREFIX = util::STX+"wzxhzdk:";
+
+//! reads prefix, a decimal id and ETX at index, see inlinePlaceholderId()
+int read_placeholder(const QString &prefix, const QString &text, int index, int *end, int *digits)
+{
+    if ( index < 0 || text.size()-index < prefix.size()+2 ) {
+        return -1;
+    }
+    const QChar *data = text.constData();
+    for ( int i = 0; i < prefix.size(); ++i ) {
+        if ( data[index+i] != prefix.at(i) ) {
+            return -1;
+        }
+    }
+    int i = index + prefix.size();
+    qint64 id = 0;
+    *digits = 0;
+    while ( i < text.size() && data[i] >= '0' && data[i] <= '9' ) {
+        id = id*10 + ( data[i].unicode() - '0' );
+        if ( id > std::numeric_limits<int>::max() ) {
+            return -1;
+        }
+        ++*digits;
+        ++i;
+    }
+    if ( *digits == 0 || i == text.size() || data[i] != util::ETX.at(0) ) {
+        return -1;
+    }
+    if ( end != nullptr ) {
+        *end = i + 1;
+    }
+    return static_cast<int>(id);
+}
+
+}
+
+int util::inlinePlaceholderId(const QString &text, int index, int *end)
+{
+    int digits;
+    return read_placeholder(util::INLINE_PLACEHOLDER_PREFIX, text, index, end, &digits);
+}
+
 HtmlStash::HtmlStash() :
     html_counter(0), rawHtmlBlocks()
 {}
@@ -48,9 +107,25 @@ void HtmlStash::reset(void)
     this->rawHtmlBlocks = Items();
 }
 
-QString HtmlStash::get_placeholder(int key)
+QString HtmlStash::get_placeholder(int key) const
+{
+    return QString("%1%2%3").arg(HTML_PLACEHOLDER_PREFIX).arg(key).arg(util::ETX);
+}
+
+int HtmlStash::placeholderKey(const QString &text, int index, int *end) const
 {
-    return QString("%1wzxhzdk:%2%3").arg(util::STX).arg(key).arg(util::ETX);
+    int digits;
+    int itemEnd;
+    int key = read_placeholder(HTML_PLACEHOLDER_PREFIX, text, index, &itemEnd, &digits);
+    //! only what get_placeholder() writes, without leading zeros
+    if ( key < 0 || key >= this->html_counter
+         || ( digits > 1 && text.at(index+HTML_PLACEHOLDER_PREFIX.size()) == '0' ) ) {
+        return -1;
+    }
+    if ( end != nullptr ) {
+        *end = itemEnd;
+    }
+    return key;
 }
 
 } // end of namespace markdown
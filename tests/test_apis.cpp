@@ -1,6 +1,16 @@
 #include "test_apis.h"
 
+#include <QBuffer>
+#include <QFile>
+#include <QMutex>
+#include <QTemporaryDir>
 #include <QTest>
+#include <QThreadPool>
+
+#include "Context.h"
+#include "PreProcessors.h"
+#include "RegexCache.h"
+#include "InlinePatterns/LinkPattern.h"
 
 
 TestMarkdownBasics::TestMarkdownBasics() :
@@ -49,6 +59,411 @@ void TestMarkdownBasics::testSimpleInput()
     QCOMPARE(this->md->convert("foo"), QString("<p>foo</p>"));
 }
 
+namespace {
+
+class ConvertTask : public QRunnable
+{
+public:
+    ConvertTask(const std::shared_ptr<markdown::Markdown> &md, const QStringList &sources, QStringList *results) :
+        md(md), sources(sources), results(results)
+    {}
+
+    void run()
+    {
+        for ( const QString &source : this->sources ) {
+            this->results->append(this->md->convert(source));
+        }
+    }
+
+private:
+    std::shared_ptr<markdown::Markdown> md;
+    QStringList sources;
+    QStringList *results;
+
+};
+
+}
+
+/*!
+  Test converting on several threads against one instance.
+*/
+void TestMarkdownBasics::testConcurrentConvert()
+{
+    QStringList sources;
+    for ( int i = 0; i < 8; ++i ) {
+        sources.append(QString("# Title %1\n\n"
+                               "Some *text* with [a link][ref%1] and <span>html</span>.\n\n"
+                               "<div>\nblock %1\n</div>\n\n"
+                               "1. one\n2. two\n\n"
+                               "- - -\n\n"
+                               "[ref%1]: http://example.com/%1 \"Title\"\n").arg(i));
+    }
+    QStringList expected;
+    for ( const QString &source : sources ) {
+        expected.append(this->md->convert(source));
+    }
+
+    const int tasks = 4;
+    QList<QStringList> results;
+    for ( int i = 0; i < tasks; ++i ) {
+        results.append(QStringList());
+    }
+    QThreadPool pool;
+    for ( int i = 0; i < tasks; ++i ) {
+        pool.start(new ConvertTask(this->md, sources, &results[i]));
+    }
+    pool.waitForDone();
+
+    for ( const QStringList &result : results ) {
+        QCOMPARE(result, expected);
+    }
+}
+
+/*!
+  Test that instances share their compiled expressions.
+*/
+void TestMarkdownBasics::testRegexCache()
+{
+    QString source("# Title\n\n1. *one*\n2. [two](/two)\n\n<div>\nblock\n</div>\n");
+    QString expected = this->md->convert(source);
+
+    int size = markdown::RegexCache::size();
+    std::shared_ptr<markdown::Markdown> other = markdown::create_Markdown();
+    QCOMPARE(markdown::RegexCache::size(), size);
+
+    QRegularExpression re = markdown::RegexCache::compile("a+b", QRegularExpression::MultilineOption);
+    QCOMPARE(markdown::RegexCache::compile("a+b", QRegularExpression::MultilineOption), re);
+    QCOMPARE(markdown::RegexCache::size(), size+1);
+    QVERIFY(markdown::RegexCache::compile("a+b").patternOptions() == QRegularExpression::NoPatternOption);
+
+    QCOMPARE(markdown::RegexCache::warmUp(), markdown::RegexCache::size());
+    QCOMPARE(other->convert(source), expected);
+}
+
+namespace {
+
+class ThrowingPreprocessor : public markdown::PreProcessor
+{
+public:
+    using markdown::PreProcessor::PreProcessor;
+
+    void run(markdown::LineBuffer &lines)
+    {
+        if ( lines.join(0, lines.size()).contains("boom") ) {
+            throw pypp::ValueError();
+        }
+    }
+
+};
+
+}
+
+/*!
+  Test batch conversion, in order and through a callback.
+*/
+void TestMarkdownBasics::testConvertBatch()
+{
+    QStringList sources;
+    QStringList expected;
+    for ( int i = 0; i < 50; ++i ) {
+        sources.append(QString("*item %1*\n\n%2").arg(i).arg(QString("line\n").repeated(i)));
+        expected.append(this->md->convert(sources.back()));
+    }
+
+    markdown::Markdown::BatchStats stats;
+    QCOMPARE(this->md->convertBatch(sources, &stats, 4), expected);
+    QCOMPARE(stats.documents, 50);
+    QCOMPARE(stats.failures, 0);
+    QCOMPARE(stats.threads, 4);
+    QVERIFY(stats.characters > 0);
+
+    QMutex mutex;
+    QMap<int, QString> received;
+    int calls = 0;
+    this->md->convertBatch(sources, [&](int index, const QString &html){
+        QMutexLocker locker(&mutex);
+        received[index] = html;
+        calls += 1;
+    });
+    QCOMPARE(calls, 50);
+    QCOMPARE(received.values(), expected);
+
+    QCOMPARE(this->md->convertBatch(QStringList()), QStringList());
+
+    //! a document that throws fails alone
+    this->md->preprocessors.add("boom", std::make_shared<ThrowingPreprocessor>(this->md), "_begin");
+    QStringList results = this->md->convertBatch(QStringList({"a", "boom", "b", "c"}), &stats, 2);
+    QCOMPARE(results, QStringList({QString("<p>a</p>"), QString(), QString("<p>b</p>"), QString("<p>c</p>")}));
+    QCOMPARE(stats.documents, 3);
+    QCOMPARE(stats.failures, 1);
+
+    //! and so does one whose callback throws
+    calls = 0;
+    this->md->convertBatch(QStringList({"a", "b"}), [&](int index, const QString &){
+        QMutexLocker locker(&mutex);
+        calls += 1;
+        if ( index == 0 ) {
+            throw pypp::ValueError();
+        }
+    }, &stats, 1);
+    QCOMPARE(calls, 2);
+    QCOMPARE(stats.documents, 1);
+    QCOMPARE(stats.failures, 1);
+}
+
+/*!
+  Test batch conversion of files.
+*/
+void TestMarkdownBasics::testConvertFiles()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QStringList paths;
+    for ( int i = 0; i < 3; ++i ) {
+        paths.append(dir.path() + QString("/doc%1.md").arg(i));
+        QFile file(paths.back());
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write(QString("# \u00e9t\u00e9 %1").arg(i).toUtf8());
+    }
+    paths.append(dir.path() + "/missing.md");
+
+    markdown::Markdown::BatchStats stats;
+    QStringList results = this->md->convertFiles(paths, &stats);
+    QCOMPARE(results, QStringList({QString("<h1>\u00e9t\u00e9 0</h1>"),
+                                   QString("<h1>\u00e9t\u00e9 1</h1>"),
+                                   QString("<h1>\u00e9t\u00e9 2</h1>"),
+                                   QString()}));
+    QCOMPARE(stats.documents, 3);
+    QCOMPARE(stats.failures, 1);
+}
+
+namespace {
+
+class WrappingPostprocessor : public markdown::PostProcessor
+{
+public:
+    using markdown::PostProcessor::PostProcessor;
+
+    QString run(const QString &text)
+    {
+        return "<main>" + text + "</main>";
+    }
+
+};
+
+class IdentityPostprocessor : public markdown::PostProcessor
+{
+public:
+    using markdown::PostProcessor::PostProcessor;
+
+    QString run(const QString &text)
+    {
+        return text;
+    }
+
+};
+
+class RecordingSink : public markdown::SerializerSink
+{
+public:
+    using markdown::SerializerSink::write;
+    void write(const QChar *data, int size)
+    {
+        this->writes.append(QString(data, size));
+    }
+
+    QStringList writes;
+
+};
+
+}
+
+/*!
+  Test converting a file into a device and into a file.
+*/
+void TestMarkdownBasics::testConvertFile()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString source = "\n\n# \u00e9t\u00e9\n\ntext *with* <span>html</span>\n\n    code\n\n";
+    QString input = dir.path() + "/doc.md";
+    {
+        QFile file(input);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+        file.write("\xEF\xBB\xBF");
+        file.write(source.toUtf8());
+    }
+    //! the post-processors see the document as a whole
+    this->md->convert("foo");  //!< builds the default processors
+    this->md->postprocessors.add("wrap", std::make_shared<WrappingPostprocessor>(this->md), "_end");
+    QString expected = this->md->convert(source);
+    QCOMPARE(expected.count("<main>"), 1);
+
+    QBuffer buffer;
+    QVERIFY(buffer.open(QIODevice::WriteOnly));
+    this->md->convertFile(input, &buffer);
+    QCOMPARE(QString::fromUtf8(buffer.data()), expected);
+
+    QString output = dir.path() + "/doc.html";
+    this->md->convertFile(input, output);
+    QFile file(output);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(QString::fromUtf8(file.readAll()), expected);
+
+    bool excepted = false;
+    try {
+        this->md->convertFile(dir.path() + "/missing.md", &buffer);
+    } catch ( const pypp::IOError & ) {
+        excepted = true;
+    }
+    QCOMPARE(excepted, true);
+
+    //! the output device refuses to be written
+    QBuffer readOnly;
+    QVERIFY(readOnly.open(QIODevice::ReadOnly));
+    excepted = false;
+    try {
+        this->md->convertFile(input, &readOnly);
+    } catch ( const pypp::IOError & ) {
+        excepted = true;
+    }
+    QCOMPARE(excepted, true);
+}
+
+/*!
+  Test that the output goes into a sink a block at a time, the same as
+  with the post-processors run over the whole document.
+*/
+void TestMarkdownBasics::testConvertSink()
+{
+    QString source = "\n\n# head\n\n<div>raw</div>\n\ntext &amp; \\*not\\* *em*\n\n> quote\n\n";
+
+    std::shared_ptr<markdown::Markdown> whole = markdown::create_Markdown();
+    whole->convert("foo");  //!< builds the default processors
+    whole->postprocessors.add("identity", std::make_shared<IdentityPostprocessor>(whole), "_end");
+    RecordingSink wholeSink;
+    whole->convert(source, wholeSink);
+    QCOMPARE(wholeSink.writes.size(), 1);
+
+    std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown();
+    RecordingSink sink;
+    md->convert(source, sink);
+    QVERIFY(sink.writes.size() >= 4);
+    QCOMPARE(sink.writes.join(QString()), wholeSink.writes.join(QString()));
+    QCOMPARE(md->convert(source), wholeSink.writes.join(QString()));
+}
+
+namespace {
+
+class UpperPreprocessor : public markdown::LegacyPreProcessor
+{
+public:
+    using markdown::LegacyPreProcessor::LegacyPreProcessor;
+
+    QStringList run(const QStringList &lines)
+    {
+        QStringList result;
+        for ( const QString &line : lines ) {
+            result.append(line.toUpper());
+        }
+        return result;
+    }
+
+};
+
+}
+
+/*!
+  Test a preprocessor working on a plain list of lines.
+*/
+void TestMarkdownBasics::testLegacyPreprocessor()
+{
+    this->md->convert("foo");  //!< builds the default processors
+    this->md->preprocessors.add("upper", std::make_shared<UpperPreprocessor>(this->md), "_begin");
+    QCOMPARE(this->md->convert("foo\n\n*[bar]: baz\n\n[id]: http://example.com"), QString("<p>FOO</p>\n<p>*[BAR]: BAZ</p>"));
+
+    //! either run() works through the base class
+    std::shared_ptr<markdown::Processor> upper = std::make_shared<UpperPreprocessor>(this->md);
+    markdown::LineBuffer lines(QStringList({"a", "b"}));
+    upper->run(lines);
+    QCOMPARE(lines.toList(), QStringList({"A", "B"}));
+    QCOMPARE(upper->run(QStringList({"c"})), QStringList({"C"}));
+}
+
+namespace {
+
+//! logs every element it enters and every paragraph it leaves, and
+//! doesn't look into blockquotes
+class LoggingVisitor : public markdown::TreeVisitor
+{
+public:
+    LoggingVisitor(const std::weak_ptr<markdown::Markdown> &md, const QString &name, QStringList *log) :
+        markdown::TreeVisitor(md)
+    {
+        this->onEnter(QString(), [=](const markdown::Element &elem){
+            log->append(name+">"+elem->tag);
+            return elem->tag != "blockquote";
+        });
+        this->onExit("p", [=](const markdown::Element &elem){
+            log->append(name+"<"+elem->tag);
+        });
+    }
+
+};
+
+class LoggingTreeprocessor : public markdown::TreeProcessor
+{
+public:
+    LoggingTreeprocessor(const std::weak_ptr<markdown::Markdown> &md, QStringList *log) :
+        markdown::TreeProcessor(md),
+        log(log)
+    {}
+
+    markdown::Element run(const markdown::Element &/*root*/)
+    {
+        this->log->append("run");
+        return markdown::Element();
+    }
+
+private:
+    QStringList *log;
+
+};
+
+}
+
+void TestMarkdownBasics::testTreeVisitors()
+{
+    QStringList log;
+    this->md->convert("foo");  //!< builds the default processors
+    this->md->treeprocessors.add("a", std::make_shared<LoggingVisitor>(this->md, "a", &log), "_end");
+    this->md->treeprocessors.add("b", std::make_shared<LoggingVisitor>(this->md, "b", &log), "_end");
+    this->md->treeprocessors.add("run", std::make_shared<LoggingTreeprocessor>(this->md, &log), "_end");
+    this->md->treeprocessors.add("c", std::make_shared<LoggingVisitor>(this->md, "c", &log), "_end");
+    QCOMPARE(this->md->convert("> quote\n\nfoo  \nbar"), QString("<blockquote>\n<p>quote</p>\n</blockquote>\n<p>foo<br />\nbar</p>"));
+    //! a and b share the walk of prettify, c walks after the plain one
+    QCOMPARE(log, QStringList({
+        "a>div", "b>div", "a>blockquote", "b>blockquote", "a<p", "b<p",
+        "a>p", "b>p", "a>br", "b>br", "a<p", "b<p",
+        "run",
+        "c>div", "c>blockquote", "c<p", "c>p", "c>br", "c<p"}));
+}
+
+void TestMarkdownBasics::testContextAccessors()
+{
+    //! outside of a conversion they reach the default context of the thread
+    this->md->reset();
+    this->md->htmlStash().store("<b>raw</b>");
+    this->md->references().insert("id", qMakePair(QString("http://example.com/"), QString()));
+    QCOMPARE(markdown::Context::current().htmlStash.html_counter, 1);
+    QCOMPARE(&this->md->references(), &markdown::Context::current().references);
+
+    //! a conversion does not see them, and clears them for what comes next
+    QCOMPARE(this->md->convert("[a][id]"), QString("<p>[a][id]</p>"));
+    QCOMPARE(this->md->htmlStash().html_counter, 0);
+    QVERIFY(this->md->references().isEmpty());
+}
+
 
 
 TestBlockParser::TestBlockParser() :
@@ -95,6 +510,217 @@ void TestBlockParser::testParseDocument()
     QCOMPARE(markdown::to_xhtml_string(tree.getroot()), QString("<div><h1>foo</h1><p>bar</p><pre><code>baz\n</code></pre></div>"));
 }
 
+/*!
+  Test BlockParser.parseDocument on edited spans of a LineBuffer.
+*/
+void TestBlockParser::testParseLineBuffer()
+{
+    markdown::LineBuffer lines(QString("#foo\n\n\nbar\ndropped\n\n\n\n    baz"));
+    QCOMPARE(lines.size(), 9);
+    QCOMPARE(lines.at(3).toString(), QString("bar"));
+
+    markdown::LineBuffer::Spans spans = lines.spans();
+    spans.removeAt(4);
+    spans.insert(4, lines.add("added"));
+    lines.setSpans(spans);
+    QCOMPARE(lines.join(0, 3), QString("#foo\n\n"));
+    QCOMPARE(lines.join(3, 5), QString("bar\nadded"));
+    QCOMPARE(lines.toList(), QString("#foo\n\n\nbar\nadded\n\n\n\n    baz").split("\n"));
+
+    markdown::ElementTree tree = this->parser->parseDocument(lines);
+    QCOMPARE(markdown::to_xhtml_string(tree.getroot()), markdown::to_xhtml_string(this->parser->parseDocument(lines.toList()).getroot()));
+    QCOMPARE(markdown::to_xhtml_string(tree.getroot()), QString("<div><h1>foo</h1><p>bar\nadded</p><pre><code>baz\n</code></pre></div>"));
+}
+
+/*!
+  Test the line index of a block.
+*/
+void TestBlockParser::testLineIndex()
+{
+    typedef markdown::LineIndex Index;
+    Index lines(QString("12. one\n  * two\n    > three\n   \n#four\n-five\n"));
+    QCOMPARE(lines.size(), 7);
+
+    QCOMPARE(lines.at(0).marker, Index::Ordered);
+    QCOMPARE(lines.mid(0, lines.at(0).content), QString("one"));
+    QCOMPARE(lines.at(1).indent, 2);
+    QCOMPARE(lines.at(1).marker, Index::Bullet);
+    QCOMPARE(lines.mid(1, lines.at(1).content), QString("two"));
+    QCOMPARE(lines.at(2).marker, Index::Quote);
+    QCOMPARE(lines.mid(2, lines.at(2).content), QString("three"));
+    QVERIFY(lines.at(3).blank);
+    QCOMPARE(lines.at(3).first, QChar('\n'));
+    QCOMPARE(lines.at(4).marker, Index::Hash);
+    QCOMPARE(lines.at(5).marker, Index::NoMarker);
+    QCOMPARE(lines.line(6).toString(), QString());
+
+    QCOMPARE(lines.find(Index::Quote, 3), -1);
+    QCOMPARE(lines.find(Index::Quote, 4), 2);
+    QCOMPARE(lines.find(Index::Bullet, 3, 2), -1);
+    QCOMPARE(lines.join(1, 3), QString("  * two\n    > three"));
+    QCOMPARE(lines.join(5, 7), QString("-five\n"));
+
+    QString block("> quote");
+    QCOMPARE(this->parser->lines(block).text(), block);
+    QCOMPARE(this->parser->lines(block).at(0).marker, Index::Quote);
+}
+
+/*!
+  Test that nesting deeper than the call stack would take is parsed.
+*/
+void TestBlockParser::testDeepNesting()
+{
+    const int depth = 10000;
+    markdown::Element root = markdown::createElement("div");
+    this->parser->parseChunk(root, QString(depth, '>') + " deep");
+    markdown::Element elem = root;
+    for ( int i = 0; i < depth; ++i ) {
+        QCOMPARE(elem->size(), 1);
+        elem = (*elem)[0];
+        QCOMPARE(elem->tag, QString("blockquote"));
+    }
+    QCOMPARE(elem->size(), 1);
+    QCOMPARE((*elem)[0]->text, QString("deep"));
+    QVERIFY(markdown::Context::current().frames.isEmpty());
+
+    //! scheduled work outside of parseBlocks is done at once
+    root = markdown::createElement("div");
+    this->parser->scheduleChunk(root, "foo\n\nbar", "list");
+    QCOMPARE(markdown::to_xhtml_string(root), QString("<div>foo\nbar</div>"));
+    QVERIFY(! this->parser->state().isstate("list"));
+
+    //! the whole conversion, serializing included, takes any depth
+    QString html = this->md->convert(QString(depth, '>') + " deep");
+    QCOMPARE(html.count("<blockquote>"), depth);
+    QCOMPARE(html.count("</blockquote>"), depth);
+    QVERIFY(html.contains("<p>deep</p>"));
+
+    root = markdown::createElement("div");
+    this->parser->parseChunk(root, QString(depth, '>') + " deep");
+    QCOMPARE(root->iter("blockquote").size(), depth);
+    QCOMPARE(markdown::to_html_string(root->copy()), markdown::to_html_string(root));
+}
+
+/*!
+  Test the conditions of BlockPrefilter.
+*/
+void TestBlockParser::testPrefilter()
+{
+    typedef markdown::BlockPrefilter Filter;
+    typedef markdown::BlockPrefilter::Shape Shape;
+
+    QVERIFY(Filter().accepts(Shape("anything")));
+
+    QVERIFY(Filter::start("\n").accepts(Shape("")));
+    QVERIFY(Filter::start("\n").accepts(Shape("\nfoo")));
+    QVERIFY(! Filter::start("\n").accepts(Shape("   \nfoo")));
+
+    QVERIFY(Filter::start("0123456789", 0, 3).accepts(Shape("   1. item")));
+    QVERIFY(! Filter::start("0123456789", 0, 3).accepts(Shape("    1. item")));
+    QVERIFY(! Filter::start("0123456789", 0, 3).accepts(Shape("item\n1. item")));
+
+    QVERIFY(Filter::indented(4).accepts(Shape("    code")));
+    QVERIFY(Filter::indented(4).accepts(Shape("     ")));
+    QVERIFY(! Filter::indented(4).accepts(Shape("   text")));
+
+    QVERIFY(Filter::lineStart(">", 3).accepts(Shape("foo\n   > quote")));
+    QVERIFY(! Filter::lineStart(">", 3).accepts(Shape("foo\n    > code")));
+    QVERIFY(! Filter::lineStart(">", 3).accepts(Shape("foo > bar")));
+    QVERIFY(Filter::lineStart("#").accepts(Shape("foo\n#bar")));
+    QVERIFY(! Filter::lineStart("#").accepts(Shape("foo\n #bar")));
+
+    QVERIFY(Filter::contains("|").accepts(Shape("a\nb | c")));
+    QVERIFY(! Filter::contains("|").accepts(Shape("a\nb c")));
+    QVERIFY(Filter::contains("\u00e9").accepts(Shape("caf\u00e9")));
+
+    Filter either = Filter::lineStart("!") | Filter::indented(4);
+    QVERIFY(either.accepts(Shape("!!! note")));
+    QVERIFY(either.accepts(Shape("    text")));
+    QVERIFY(! either.accepts(Shape("text")));
+    QVERIFY((either | Filter()).accepts(Shape("text")));
+}
+
+namespace {
+
+class PercentProcessor : public markdown::BlockProcessor
+{
+public:
+    PercentProcessor(const std::weak_ptr<markdown::BlockParser> &parser, int *tested) :
+        markdown::BlockProcessor(parser),
+        tested(tested)
+    {
+        this->setPrefilter(markdown::BlockPrefilter::start("%"));
+    }
+
+    bool test(const markdown::Element &, const QString &block)
+    {
+        ++(*this->tested);
+        return block.startsWith("%%");
+    }
+
+    bool run(const markdown::Element &parent, QStringList &blocks)
+    {
+        markdown::Element p = markdown::createSubElement(parent, "p");
+        p->set("class", "percent");
+        p->text = blocks.front().mid(2).trimmed();
+        blocks.pop_front();
+        return true;
+    }
+
+private:
+    int *tested;
+
+};
+
+class ThrowingProcessor : public markdown::BlockProcessor
+{
+public:
+    using markdown::BlockProcessor::BlockProcessor;
+
+    bool test(const markdown::Element &, const QString &block)
+    {
+        return block.startsWith("!!");
+    }
+
+    bool run(const markdown::Element &, QStringList &)
+    {
+        throw pypp::ValueError();
+    }
+
+};
+
+}
+
+/*!
+  Test that processors added after parsing take part, behind their prefilter.
+*/
+void TestBlockParser::testPrefilterDispatch()
+{
+    QCOMPARE(this->md->convert("%% foo\n\nbar"), QString("<p>%% foo</p>\n<p>bar</p>"));
+
+    int tested = 0;
+    this->parser->blockprocessors.add("percent", std::make_shared<PercentProcessor>(this->parser, &tested), "_begin");
+    QCOMPARE(this->md->convert("%% foo\n\nbar\n\n% baz"), QString("<p class=\"percent\">foo</p>\n<p>bar</p>\n<p>% baz</p>"));
+    QCOMPARE(tested, 2);
+}
+
+/*!
+  Test that a processor that throws leaves no scheduling behind.
+*/
+void TestBlockParser::testThrowingProcessor()
+{
+    this->parser->blockprocessors.add("throwing", std::make_shared<ThrowingProcessor>(this->parser), "_begin");
+    markdown::Element root = markdown::createElement("div");
+    bool excepted = false;
+    try {
+        this->parser->parseChunk(root, "> foo\n\n!! bar");
+    } catch ( const pypp::ValueError & ) {
+        excepted = true;
+    }
+    QCOMPARE(excepted, true);
+    QVERIFY(markdown::Context::current().scheduled == nullptr);
+}
+
 
 TestBlockParserState::TestBlockParserState()
 {}
@@ -229,6 +855,24 @@ void TestHtmlStash::testSafeStore()
     }));
 }
 
+/*!
+  Test HtmlStash.placeholderKey.
+*/
+void TestHtmlStash::testPlaceholderKey()
+{
+    this->stash.store("bar");
+    QString placeholder = this->stash.get_placeholder(1);
+    QString text = "x" + placeholder + "y";
+    int end = -1;
+    QCOMPARE(this->stash.placeholderKey(text, 1, &end), 1);
+    QCOMPARE(end, 1 + placeholder.size());
+    QCOMPARE(this->stash.placeholderKey(text, 0), -1);
+    //! only placeholders of stored blocks, written without leading zeros
+    QCOMPARE(this->stash.placeholderKey(this->stash.get_placeholder(2), 0), -1);
+    QCOMPARE(this->stash.placeholderKey(QString(placeholder).replace("1", "01"), 0), -1);
+    QCOMPARE(this->stash.placeholderKey(placeholder.left(placeholder.size()-1), 0), -1);
+}
+
 /*!
   Test HtmlStash.reset.
 */
@@ -406,6 +1050,57 @@ void TestOrderedDict::testChangeOrder()
                                                                         }));
 }
 
+/*!
+  Test OrderedDict keeps the order when linking to an invalid location.
+*/
+void TestOrderedDict::testBadLinkLocation()
+{
+    bool excepted = false;
+    try {
+        this->odict.link("fourth", "third");
+    } catch ( const std::invalid_argument & ) {
+        excepted = true;
+    }
+    QCOMPARE(excepted, true);
+    QCOMPARE(this->odict.keys(), QStringList({"first", "third", "fourth", "fifth"}));
+    QCOMPARE(this->odict["fourth"], QString("self"));
+}
+
+/*!
+  Test OrderedDict positions by key and by index.
+*/
+void TestOrderedDict::testIndex()
+{
+    this->odict.add("second", "is", "<third");
+    QCOMPARE(this->odict.index("first"), 0);
+    QCOMPARE(this->odict.index("second"), 1);
+    QCOMPARE(this->odict.index("fifth"), 4);
+    QCOMPARE(this->odict.index("sixth"), -1);
+    QCOMPARE(this->odict.at(2), QString("a"));
+    QCOMPARE(this->odict.at(-1), QString("test"));
+
+    this->odict.link("first", "_end");
+    QCOMPARE(this->odict.index("first"), 4);
+    QCOMPARE(this->odict.index("second"), 0);
+    QCOMPARE(this->odict[3], QString("test"));
+}
+
+/*!
+  Test OrderedDict.toList() is a snapshot and version() tracks changes.
+*/
+void TestOrderedDict::testSnapshot()
+{
+    const markdown::OrderedDict<QString> &odict = this->odict;
+    quint64 version = odict.version();
+    QList<QString> values = odict.toList();
+    QCOMPARE(odict.version(), version);
+
+    this->odict.add("zero", "CRAZY", "_begin");
+    QVERIFY(odict.version() != version);
+    QCOMPARE(values, QList<QString>({"This", "a", "self", "test"}));
+    QCOMPARE(odict.toList(), QList<QString>({"CRAZY", "This", "a", "self", "test"}));
+}
+
 TestInlinePattern::TestInlinePattern()
 {
 
@@ -444,6 +1139,185 @@ void TestInlinePattern::test_backtick()
     QCOMPARE(match.captured(), QString("`code`"));
 }
 
+void TestInlinePattern::test_triggers()
+{
+    QCOMPARE(this->md->inlinePatterns["backtick"]->triggers(), QString("`"));
+    QCOMPARE(this->md->inlinePatterns["emphasis"]->triggers(), QString("*"));
+    QCOMPARE(this->md->convert("plain text without triggers"), QString("<p>plain text without triggers</p>"));
+    QCOMPARE(this->md->convert("100%1 is *more* than %2"), QString("<p>100%1 is <em>more</em> than %2</p>"));
+}
+
+void TestInlinePattern::test_match_offset()
+{
+    std::shared_ptr<markdown::Pattern> link = this->md->inlinePatterns["link"];
+    QString text = "see [text](http://example.com \"title\") here";
+    QRegularExpressionMatch match = link->getCompiledRegExp().match(text, 4);
+    QCOMPARE(match.hasMatch(), true);
+    QCOMPARE(match.capturedStart(), 4);
+    QCOMPARE(match.captured(), QString("[text](http://example.com \"title\")"));
+    QCOMPARE(match.captured(1), QString("text"));
+    QCOMPARE(match.captured(8), QString("http://example.com"));
+    QCOMPARE(match.captured(12), QString("title"));
+
+    //! `!` before the offset is still seen by the look-behind assertion
+    QCOMPARE(link->getCompiledRegExp().match("![alt](image.png)", 1).hasMatch(), false);
+}
+
+void TestInlinePattern::test_unescape()
+{
+    //! placeholders of patterns that ran before inside alt texts and urls
+    QCOMPARE(this->md->convert("![*em* and `code`](image.png)"), QString("<p><img alt=\"*em* and code\" src=\"image.png\" /></p>"));
+    QCOMPARE(this->md->convert("<http://example.com/`path`>"), QString("<p><a href=\"http://example.com/path\">http://example.com/<code>path</code></a></p>"));
+
+    //! text without placeholders and unknown ids
+    std::shared_ptr<markdown::Pattern> link = this->md->inlinePatterns["link"];
+    QCOMPARE(link->unescape("plain"), QString("plain"));
+    QCOMPARE(link->unescape("a" + markdown::util::inlinePlaceholder(1000000) + "b"), QString("ab"));
+    QString broken = markdown::util::INLINE_PLACEHOLDER_PREFIX + "x";
+    QCOMPARE(link->unescape(broken), broken);
+}
+
+void TestInlinePattern::test_emphasis_locators()
+{
+    std::shared_ptr<markdown::Markdown> plain = markdown::create_Markdown();
+    plain->set_smart_emphasis(false);
+    QList<std::shared_ptr<markdown::Pattern>> patterns = {
+        this->md->inlinePatterns["not_strong"],
+        this->md->inlinePatterns["em_strong"],
+        this->md->inlinePatterns["strong_em"],
+        this->md->inlinePatterns["strong"],
+        this->md->inlinePatterns["emphasis"],
+        this->md->inlinePatterns["emphasis2"],
+        plain->inlinePatterns["emphasis2"],
+    };
+
+    //! every text of up to seven characters from the delimiters, a space
+    //! and a word character has to match exactly like the expressions
+    QStringList texts = {"", "*\n", " _\n", "_a_\n", "x_\u00e9_"};
+    const QString alphabet = "*_ a";
+    for ( int i = 0; i < texts.size(); ++i ) {
+        if ( texts.at(i).size() < 7 && ! texts.at(i).contains('\n') ) {
+            for ( const QChar &ch : alphabet ) {
+                texts.append(texts.at(i) + ch);
+            }
+        }
+    }
+    for ( const std::shared_ptr<markdown::Pattern> &pattern : patterns ) {
+        for ( const QString &text : texts ) {
+            for ( int offset = 0; offset <= qMin(2, text.size()); ++offset ) {
+                QRegularExpressionMatch expected = pattern->getCompiledRegExp().match(text, offset);
+                QRegularExpressionMatch actual = pattern->match(text, offset);
+                QCOMPARE(actual.hasMatch(), expected.hasMatch());
+                if ( expected.hasMatch() ) {
+                    QCOMPARE(actual.capturedTexts(), expected.capturedTexts());
+                    QCOMPARE(actual.capturedStart(), expected.capturedStart());
+                }
+            }
+        }
+    }
+}
+
+void TestInlinePattern::test_emphasis_resume()
+{
+    //! new matches around the placeholder of an earlier one
+    QCOMPARE(this->md->convert("**a*b*"), QString("<p><em><em>a</em>b</em></p>"));
+    QCOMPARE(this->md->convert("***a*b** c*d*"), QString("<p><strong><em>a</em>b</strong> c<em>d</em></p>"));
+    QCOMPARE(this->md->convert("_a_ _b_ __c__"), QString("<p><em>a</em> <em>b</em> <strong>c</strong></p>"));
+
+    //! runs of delimiters that never close are given up on in one scan
+    QString text = "___";
+    QString expected = "<p>___";
+    for ( int i = 0; i < 20000; ++i ) {
+        text += "a_";
+        expected += "a_";
+    }
+    QCOMPARE(this->md->convert(text), expected + "</p>");
+}
+
+void TestInlinePattern::test_link_scanners()
+{
+    typedef QPair<QString, markdown::LinkScanner> Scanner;
+    QList<Scanner> scanners = {
+        Scanner("link", markdown::scanLink),
+        Scanner("image_link", markdown::scanImageLink),
+        Scanner("reference", markdown::scanReference),
+        Scanner("image_reference", markdown::scanImageReference),
+        Scanner("short_reference", markdown::scanShortReference),
+    };
+
+    //! pseudo-random texts from the link syntax, shallow enough for BRK
+    const QStringList alphabet = {"[", "]", "(", ")", "!", "<", ">", "\"", "'", " ", "a", "\n", "](", "[a]", "(<u>)"};
+    QStringList texts;
+    quint32 seed = 1;
+    for ( int i = 0; i < 2000; ++i ) {
+        QString text;
+        int length = 1 + i % 12;
+        for ( int j = 0; j < length; ++j ) {
+            seed = seed * 1103515245 + 12345;
+            text += alphabet.at(( seed >> 16 ) % alphabet.size());
+        }
+        texts.append(text);
+    }
+    for ( const Scanner &scanner : scanners ) {
+        QRegularExpression re = this->md->inlinePatterns[scanner.first]->getCompiledRegExp();
+        for ( const QString &text : texts ) {
+            for ( int offset = 0; offset <= qMin(1, text.size()); ++offset ) {
+                QRegularExpressionMatch expected = re.match(text, offset);
+                markdown::LinkMatch actual = scanner.second(text, offset, nullptr);
+                QCOMPARE(actual.start, expected.hasMatch() ? expected.capturedStart() : -1);
+                if ( expected.hasMatch() ) {
+                    QCOMPARE(actual.end, expected.capturedEnd());
+                    QCOMPARE(actual.text, expected.captured(1));
+                    QCOMPARE(actual.href, expected.captured(8));
+                    QCOMPARE(actual.title, expected.captured(12));
+                }
+            }
+        }
+    }
+
+    //! a state carried over each match, which is either replaced or
+    //! left as text the way InlineProcessor does it, finds what a fresh
+    //! scan of the new text finds
+    const QString placeholder = QString(QChar(0x0002)) + "klzzwxh:12" + QChar(0x0003);
+    for ( const Scanner &scanner : scanners ) {
+        for ( const QString &text : texts ) {
+            QString data = text + text + text;
+            markdown::LinkScanState state;
+            int offset = 0;
+            for ( int count = 0; ; ++count ) {
+                markdown::LinkMatch expected = scanner.second(data, offset, nullptr);
+                markdown::LinkMatch actual = scanner.second(data, offset, &state);
+                QCOMPARE(actual.start, expected.start);
+                if ( actual.start == -1 ) {
+                    break;
+                }
+                QCOMPARE(actual.end, expected.end);
+                QCOMPARE(actual.href, expected.href);
+                if ( count % 3 == 1 ) {
+                    offset = actual.end;
+                } else {
+                    data.replace(actual.start, actual.end-actual.start, placeholder);
+                    offset = 0;
+                }
+            }
+        }
+    }
+}
+
+void TestInlinePattern::test_nested_links()
+{
+    //! deeper than the six levels BRK is written out for
+    QCOMPARE(this->md->convert("[a[b[c[d[e[f[g[h]]]]]]]](/url)"), QString("<p><a href=\"/url\">a[b[c[d[e[f[g[h]]]]]]]</a></p>"));
+
+    //! unbalanced brackets and parentheses
+    QString text = "[x](/url) ";
+    for ( int i = 0; i < 20000; ++i ) {
+        text += "[(";
+    }
+    QString html = this->md->convert(text);
+    QVERIFY(html.startsWith("<p><a href=\"/url\">x</a> [(["));
+}
+
 TestTreeProcessor::TestTreeProcessor()
 {
 
@@ -488,3 +1362,31 @@ void TestTreeProcessor::test_inline()
     QCOMPARE(ret->child()[0]->child()[0]->tag, QString("code"));
     QCOMPARE(ret->child()[0]->child()[0]->text, QString("<http://example.com>"));
 }
+
+void TestTreeProcessor::test_placeholder()
+{
+    QString placeholder = markdown::util::inlinePlaceholder(123456);
+    QCOMPARE(placeholder, markdown::util::INLINE_PLACEHOLDER.arg(123456));
+
+    QString text = "ab" + placeholder + "cd";
+    int end = -1;
+    QCOMPARE(markdown::util::inlinePlaceholderId(text, 2, &end), 123456);
+    QCOMPARE(end, 2 + placeholder.size());
+    QCOMPARE(markdown::util::inlinePlaceholderId(text, 1), -1);
+
+    //! no digits, no terminator, or more than fits an int
+    QCOMPARE(markdown::util::inlinePlaceholderId(markdown::util::INLINE_PLACEHOLDER.arg(""), 0), -1);
+    QCOMPARE(markdown::util::inlinePlaceholderId(markdown::util::INLINE_PLACEHOLDER_PREFIX + "12", 0), -1);
+    QCOMPARE(markdown::util::inlinePlaceholderId(markdown::util::INLINE_PLACEHOLDER.arg("99999999999"), 0), -1);
+}
+
+void TestTreeProcessor::test_many_placeholders()
+{
+    //! more nodes than four-digit ids could address
+    QStringList words, expected;
+    for ( int i = 0; i < 12000; ++i ) {
+        words.append(QString("*%1*").arg(i));
+        expected.append(QString("<em>%1</em>").arg(i));
+    }
+    QCOMPARE(this->md->convert(words.join(" ")), "<p>" + expected.join(" ") + "</p>");
+}
@@ -27,6 +27,15 @@ private slots:
     void testBlankInput();
     void testWhitespaceOnly();
     void testSimpleInput();
+    void testConcurrentConvert();
+    void testRegexCache();
+    void testConvertBatch();
+    void testConvertFiles();
+    void testConvertFile();
+    void testConvertSink();
+    void testLegacyPreprocessor();
+    void testTreeVisitors();
+    void testContextAccessors();
 
 private:
     std::shared_ptr<markdown::Markdown> md;
@@ -53,6 +62,12 @@ private slots:
 
     void testParseChunk();
     void testParseDocument();
+    void testParseLineBuffer();
+    void testLineIndex();
+    void testDeepNesting();
+    void testPrefilter();
+    void testPrefilterDispatch();
+    void testThrowingProcessor();
 
 private:
     std::shared_ptr<markdown::Markdown> md;
@@ -107,6 +122,7 @@ private slots:
     void testSimpleStore();
     void testStoreMore();
     void testSafeStore();
+    void testPlaceholderKey();
     void testReset();
     //void testUnsafeHtmlInSafeMode();
     //void build_extension();
@@ -147,6 +163,9 @@ private slots:
     void testChangeValue();
     void testChangeOrder();
     //void textBadLink();
+    void testBadLinkLocation();
+    void testIndex();
+    void testSnapshot();
 
 private:
     markdown::OrderedDict<QString> odict;
@@ -169,6 +188,13 @@ private slots:
     void cleanup();
 
     void test_backtick();
+    void test_triggers();
+    void test_match_offset();
+    void test_unescape();
+    void test_emphasis_locators();
+    void test_emphasis_resume();
+    void test_link_scanners();
+    void test_nested_links();
 
 private:
     std::shared_ptr<markdown::Markdown> md;
@@ -191,6 +217,8 @@ private slots:
     void cleanup();
 
     void test_inline();
+    void test_placeholder();
+    void test_many_placeholders();
 
 private:
     std::shared_ptr<markdown::Markdown> md;
@@ -1,5 +1,6 @@
 #include "test_etree.h"
 
+#include <QBuffer>
 #include <QTest>
 
 #include "ElementTree.hpp"
@@ -87,3 +88,143 @@ void TestEtree::test_element_child()
     QCOMPARE(excepted2, true);
 }
 
+
+void TestEtree::test_element_insert_after()
+{
+    markdown::Element root = markdown::createElement("root");
+    markdown::Element a = markdown::createSubElement(root, "a");
+    markdown::Element d = markdown::createSubElement(root, "d");
+    markdown::Element b = markdown::createElement("b");
+    markdown::Element c = markdown::createElement("c");
+    root->insertAfter(a, {b, c});
+    root->insertAfter(markdown::Element(), {markdown::createElement("first")});
+    //! moves an element that already is a child
+    root->insertAfter(d, {a});
+    QStringList tags;
+    for ( const markdown::Element &child : *root ) {
+        tags.append(child->tag);
+    }
+    QCOMPARE(tags, QStringList({"first", "b", "c", "d", "a"}));
+
+    bool excepted = false;
+    try {
+        root->insertAfter(markdown::createElement("stray"), {markdown::createElement("e")});
+    } catch ( const pypp::ValueError & ) {
+        excepted = true;
+    }
+    QCOMPARE(excepted, true);
+    QCOMPARE(root->size(), 5);
+}
+
+void TestEtree::test_element_arena()
+{
+    std::shared_ptr<markdown::ElementArena> arena = std::make_shared<markdown::ElementArena>();
+    markdown::Element root;
+    {
+        markdown::ElementArena::Scope scope(arena);
+        root = markdown::createElement("root");
+        markdown::Element a = markdown::createSubElement(root, "p");
+        markdown::Element b = markdown::createSubElement(root, "p");
+        QCOMPARE(a->tag, b->tag);
+        QCOMPARE(a->arena(), arena);
+        QCOMPARE(arena->size(), 3);
+    }
+    markdown::Element outside = markdown::createElement("p");
+    QVERIFY(outside->arena() != arena);
+    //! elements made outside of a scope share an arena while one is alive
+    QCOMPARE(markdown::createElement("p")->arena(), outside->arena());
+
+    //! an element has a single parent, appending moves it
+    markdown::Element last = (*root)[-1];
+    root->insert(0, last);
+    outside->append(last);
+    QCOMPARE(root->size(), 1);
+    QCOMPARE(outside->size(), 1);
+
+    //! the arena lives as long as a handle into it
+    std::weak_ptr<markdown::ElementArena> weak = arena;
+    arena.reset();
+    root.reset();
+    QVERIFY( ! weak.expired());
+    outside.reset();
+    last.reset();
+    QVERIFY(weak.expired());
+
+    //! removing the child lets go of its arena
+    arena = std::make_shared<markdown::ElementArena>();
+    weak = arena;
+    {
+        markdown::ElementArena::Scope scope(arena);
+        last = markdown::createElement("p");
+    }
+    outside = markdown::createElement("div");
+    outside->append(last);
+    arena.reset();
+    last.reset();
+    QVERIFY( ! weak.expired());
+    outside->removeAt(0);
+    QVERIFY(weak.expired());
+}
+
+void TestEtree::test_serializer_escape()
+{
+    markdown::Element elem = markdown::createElement("p");
+    elem->text = "a < b & \"c\"";
+    elem->set("title", "<\"x\">\n");
+    elem->set("checked", "checked");
+    markdown::Element br = markdown::createSubElement(elem, "br");
+    br->tail = "1 > 0";
+    QCOMPARE(markdown::to_html_string(elem), QString("<p checked title=\"&lt;&quot;x&quot;&gt;\n\">a &lt; b &amp; \"c\"<br>1 &gt; 0</p>"));
+    QCOMPARE(markdown::to_xhtml_string(elem), QString("<p checked=\"checked\" title=\"&lt;&quot;x&quot;&gt;\n\">a &lt; b &amp; \"c\"<br />1 &gt; 0</p>"));
+}
+
+void TestEtree::test_serializer_namespaces()
+{
+    markdown::Element root = markdown::createElement("div");
+    root->set("{http://example.com/ns}x", "1");
+    root->set("id", "a");
+    markdown::Element p = markdown::createSubElement(root, "p");
+    p->set("{http://example.com/ns}y", "2");
+    QCOMPARE(markdown::to_html_string(root), QString("<div id=\"a\" {http://example.com/ns}x=\"1\"><p {http://example.com/ns}y=\"2\"></p></div>"));
+    QCOMPARE(markdown::to_namespaced_html_string(root), QString("<div id=\"a\" ns0:x=\"1\" xmlns:ns0=\"http://example.com/ns\"><p ns0:y=\"2\"></p></div>"));
+    QCOMPARE(markdown::to_namespaced_xhtml_string(root), markdown::to_namespaced_html_string(root));
+}
+
+void TestEtree::test_serializer_sink()
+{
+    markdown::Element root = markdown::createElement("div");
+    for ( int i = 0; i < 100; ++i ) {
+        markdown::Element p = markdown::createSubElement(root, "p");
+        //! some of the surrogate pairs straddle a chunk boundary
+        p->text = QString("paragraph %1 ").arg(i).append(QChar(0xD83D)).append(QChar(0xDE00));
+    }
+    QString expected = markdown::to_html_string(root);
+
+    QStringList chunks;
+    {
+        markdown::CallbackSink sink([&](const QString &chunk){ chunks.append(chunk); }, 64);
+        markdown::to_html(sink, root);
+    }
+    QVERIFY(chunks.size() > 1);
+    for ( const QString &chunk : chunks ) {
+        QVERIFY( ! chunk.at(chunk.size()-1).isHighSurrogate());
+    }
+    QCOMPARE(chunks.join(QString()), expected);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    {
+        markdown::DeviceSink sink(&buffer, 64);
+        markdown::to_html(sink, root);
+        QVERIFY( ! sink.hasError());
+    }
+    QCOMPARE(QString::fromUtf8(buffer.data()), expected);
+
+    //! a device that refuses the output
+    QBuffer readOnly;
+    readOnly.open(QIODevice::ReadOnly);
+    markdown::DeviceSink failing(&readOnly, 64);
+    markdown::to_html(failing, root);
+    QVERIFY(failing.hasError());
+    QVERIFY(readOnly.data().isEmpty());
+}
@@ -24,6 +24,12 @@ private slots:
 
     void test_element_names();
     void test_element_child();
+    void test_element_insert_after();
+    void test_element_arena();
+
+    void test_serializer_escape();
+    void test_serializer_namespaces();
+    void test_serializer_sink();
 
 private:
     markdown::ElementTree root;
@@ -3,6 +3,7 @@
 #include <QDebug>
 #include <QTest>
 
+#include "BlockParser.h"
 #include "extensions/admonition.h"
 
 #include "extensions/abbr.h"
@@ -279,6 +280,25 @@ void TestExtensions::attr_list()
                      "<p><em>More weirdness</em></p>"));
 }
 
+void TestExtensions::attr_list_values()
+{
+    std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
+        markdown::AttrListExtension::generate(),
+    });
+
+    //! quoted values keep their spaces, a stray '=' is skipped and names
+    //! are sanitized
+    QCOMPARE(md->convert(
+                 "para" "\n"
+                 R"({: k="a b" x=1 .c #i bare = stray y='q z' .d weird@name=v })"),
+             QString(R"(<p bare="bare" class="c d" id="i" k="a b" stray="stray" weird_name="v" x="1" y="q z">para</p>)"));
+    //! the first '=' ends the key, the next one the value
+    QCOMPARE(md->convert(
+                 "para" "\n"
+                 R"({: a=b="c" d="e=f" })"),
+             QString(R"(<p a="b" d="e">para</p>)"));
+}
+
 void TestExtensions::abbr()
 {
     std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
@@ -307,6 +327,45 @@ void TestExtensions::abbr()
                      R"(is maintained by the <abbr title="World Wide Web Consortium">W3C</abbr>.</p>)"));
 }
 
+void TestExtensions::abbr_overlap()
+{
+    std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
+        markdown::AbbrExtension::generate(),
+    });
+
+    //! leftmost, then longest, whatever the order of the definitions
+    QString converted = md->convert(
+                "HTML 5 and HTML, SHTML and HTML5 are not." "\n"
+                "" "\n"
+                "*[HTML]: Hyper Text Markup Language" "\n"
+                "*[HTML 5]: Fifth revision" "\n"
+                "*[5 and]: Never matched" "\n"
+                "");
+    QCOMPARE(converted,
+             QString(R"(<p><abbr title="Fifth revision">HTML 5</abbr> and <abbr title="Hyper Text Markup Language">HTML</abbr>, SHTML and HTML5 are not.</p>)"));
+
+    //! abbreviations of a document don't carry over into the next one
+    QCOMPARE(md->convert("HTML"), QString("<p>HTML</p>"));
+}
+
+void TestExtensions::abbr_many()
+{
+    std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
+        markdown::AbbrExtension::generate(),
+    });
+
+    const int count = 500;
+    QStringList words, definitions, expected;
+    for ( int i = 0; i < count; ++i ) {
+        QString abbr = QString("A%1").arg(i);
+        words.append(abbr);
+        definitions.append(QString("*[%1]: Title %2").arg(abbr).arg(i));
+        expected.append(QString(R"(<abbr title="Title %1">%2</abbr>)").arg(i).arg(abbr));
+    }
+    QString converted = md->convert(words.join(" ") + " *A1*\n\n" + definitions.join("\n"));
+    QCOMPARE(converted, QString("<p>%1 <em>%2</em></p>").arg(expected.join(" "), expected.at(1)));
+}
+
 void TestExtensions::def_in_list()
 {
     std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
@@ -698,6 +757,31 @@ void TestExtensions::tables()
                      "</table>"));
 }
 
+void TestExtensions::tables_split_cells()
+{
+    std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
+        markdown::TableExtension::generate(),
+    });
+
+    markdown::ElementTree tree = md->parser->parseDocument(QStringList({
+        "a | b",
+        "--|--",
+        "12 | *em*",
+        R"(\``x|y` | `` ` | ` ``)",
+    }));
+    markdown::Element tbody = (*(*tree.getroot())[0])[1];
+    QCOMPARE(tbody->size(), 2);
+    markdown::Element row = (*tbody)[0];
+    QCOMPARE((*row)[0]->text, QString("12"));
+    QCOMPARE((*row)[1]->text, QString("*em*"));
+    //! nothing for the InlineProcessor in a plain cell
+    QVERIFY((*row)[0]->atomic);
+    QVERIFY(! (*row)[1]->atomic);
+    row = (*tbody)[1];
+    QCOMPARE((*row)[0]->text, QString(R"(\``x|y`)"));
+    QCOMPARE((*row)[1]->text, QString("`` ` | ` ``"));
+}
+
 void TestExtensions::tables_and_attr_list()
 {
     std::shared_ptr<markdown::Markdown> md = markdown::create_Markdown({
@@ -21,12 +21,16 @@ private slots:
 
     void admonition();
     void attr_list();
+    void attr_list_values();
 
     // extra
     void abbr();
+    void abbr_overlap();
+    void abbr_many();
     void def_in_list();
     void tables();
     void tables_and_attr_list();
+    void tables_split_cells();
 
 };
 
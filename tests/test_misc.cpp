@@ -589,6 +589,37 @@ void TestMISC::block_html_attr()
                      "<!-- #current-content -->"));
 }
 
+void TestMISC::block_html_nested()
+{
+    QString converted = this->md->convert(
+                "<table>" "\n"
+                "<tr><td><table><tr><td>x</td></tr></table></td></tr>" "\n"
+                "</table>" "\n"
+                "*para*" "\n"
+                "" "\n"
+                R"(<div title="a > b" data-x=1>)" "\n"
+                "" "\n"
+                "<div>" "\n"
+                "<div>inner</div>" "\n"
+                "</div>" "\n"
+                "" "\n"
+                "</div>" "\n"
+                "");
+    QCOMPARE(converted,
+             QString("<table>" "\n"
+                     "<tr><td><table><tr><td>x</td></tr></table></td></tr>" "\n"
+                     "</table>" "\n"
+                     "" "\n"
+                     "<p><em>para</em></p>" "\n"
+                     R"(<div title="a > b" data-x=1>)" "\n"
+                     "" "\n"
+                     "<div>" "\n"
+                     "<div>inner</div>" "\n"
+                     "</div>" "\n"
+                     "" "\n"
+                     "</div>"));
+}
+
 void TestMISC::block_html_simple()
 {
     QString converted = this->md->convert(
@@ -34,6 +34,7 @@ private slots:
     void blank_lines_in_codeblocks();
     void block_html5();
     void block_html_attr();
+    void block_html_nested();
     void block_html_simple();
     void blockquote();
     void blockquote_below_paragraph();